@@ -0,0 +1,333 @@
+#include "vkcore.h"
+#include "vwmemory.h"
+#include "vwtransfer.h"
+#include "vwrender.h"
+#include "vwdescriptor.h"
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+
+//Records the same number of command buffers with 1 up to all hardware threads, every thread records from its own pools
+static void measureRecordingScaling(vw::Device& device)
+{
+	const uint32_t bufferCount = 1024;
+	const uint32_t commandsPerBuffer = 64;
+	uint32_t queueFamily = device.getGraphicsQueueFamily();
+	uint32_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	vk::MemoryBarrier memoryBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead);
+	double singleThreadTime = 0.0;
+	for (uint32_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> threads;
+		for (uint32_t t = 0; t < threadCount; ++t)
+		{
+			threads.emplace_back([&, t]()
+			{
+				for (uint32_t i = t; i < bufferCount; i += threadCount)
+				{
+					vw::CommandBuffer cmdBuffer = device.createCommandBuffer(queueFamily, vk::CommandBufferLevel::ePrimary);
+					cmdBuffer.begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+					for (uint32_t c = 0; c < commandsPerBuffer; ++c)
+						cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), { memoryBarrier }, {}, {});
+					cmdBuffer.end();
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+
+		double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (threadCount == 1)
+			singleThreadTime = time;
+		std::cout << "Recording " << bufferCount << " command buffers on " << threadCount << " threads: " << time << " ms, speedup " << singleThreadTime / time << std::endl;
+	}
+}
+
+//Uploads the same buffers and images once with one command buffer per object and once through a single UploadBatch
+static void measureUploadBatching(vw::Device& device)
+{
+	const uint32_t bufferCount = 1024;
+	const vk::DeviceSize bufferSize = 16 * 1024;
+	const uint32_t imageCount = 256;
+	const uint32_t imageSize = 64;
+	uint32_t dstFamily = device.getGraphicsQueueFamily();
+	std::vector<char> data(bufferSize, 1);
+
+	typedef vw::Image<vk::ImageType::e2D, vw::TransferDst> UploadImage;
+	for (bool batched : { false, true })
+	{
+		std::vector<std::unique_ptr<vw::StorageBuffer>> buffers;
+		std::vector<std::unique_ptr<UploadImage>> images;
+		for (uint32_t i = 0; i < bufferCount; ++i)
+			buffers.push_back(std::make_unique<vw::StorageBuffer>(device, bufferSize));
+		for (uint32_t i = 0; i < imageCount; ++i)
+			images.push_back(std::make_unique<UploadImage>(device, imageSize, imageSize, vk::Format::eR8G8B8A8Unorm, vk::ImageLayout::eUndefined));
+		device.waitIdle();
+
+		uint32_t submitCount = 0;
+		auto start = std::chrono::steady_clock::now();
+		if (batched)
+		{
+			vw::UploadBatch batch(device, dstFamily);
+			for (auto& buffer : buffers)
+				batch.loadBuffer(*buffer, 0, data.data(), bufferSize);
+			for (auto& image : images)
+				batch.loadImage(*image, imageSize, imageSize, data.data(), imageSize * imageSize * 4);
+			for (auto& image : images)
+				batch.transitionLayout(*image, vk::ImageLayout::eShaderReadOnlyOptimal);
+			batch.flush().wait();
+			submitCount = 1;
+		}
+		else
+		{
+			std::vector<vw::GpuFuture> futures;
+			for (auto& buffer : buffers)
+				futures.push_back(buffer->loadData(data.data(), { vk::BufferCopy(0, 0, bufferSize) }, dstFamily).submit());
+			for (auto& image : images)
+			{
+				futures.push_back(image->loadData(data.data(), imageSize * imageSize * 4, dstFamily).submit());
+				futures.push_back(image->transitionLayout(vk::ImageLayout::eShaderReadOnlyOptimal, dstFamily).submit());
+			}
+			vw::waitForFutures(futures);
+			submitCount = (uint32_t)futures.size();
+		}
+		double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << (batched ? "Batched" : "Per-object") << " upload of " << bufferCount << " buffers and " << imageCount << " images: " << time << " ms, " << submitCount << " submits" << std::endl;
+		device.waitIdle();
+	}
+}
+
+//Records the same draws with per draw data from a descriptor set allocated per draw, from push descriptors and from push constants
+static void measureDrawDataPaths(vw::Device& device)
+{
+	const uint32_t drawCount = 10000;
+	const uint32_t frameCount = 8;
+	//Largest minUniformBufferOffsetAlignment a device may require
+	const vk::DeviceSize drawDataAlignment = 256;
+	const vk::Extent2D extent(256, 256);
+
+	struct DrawData
+	{
+		float offset[4];
+	};
+
+	std::string shaderPath = SHADER_DIR;
+	vw::Shader uniformShader(device, vk::ShaderStageFlagBits::eVertex, shaderPath + "draw_uniform.vert");
+	vw::Shader pushShader(device, vk::ShaderStageFlagBits::eVertex, shaderPath + "draw_push.vert");
+	vw::Shader fragmentShader(device, vk::ShaderStageFlagBits::eFragment, shaderPath + "shader.frag");
+
+	vk::DescriptorSetLayoutBinding drawDataBinding(0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex);
+	vk::DescriptorSetLayout setLayout = device.getLayoutCache().getSetLayout({ drawDataBinding });
+	vw::PushDescriptorSet pushSet(device, { drawDataBinding });
+
+	//One render pass per path, they are compatible so their pipelines share the framebuffer
+	std::vector<vw::GraphicsPipelineSettings> settings(3);
+	std::vector<std::unique_ptr<vw::RenderPass>> renderPasses;
+	for (uint32_t i = 0; i < settings.size(); ++i)
+	{
+		settings[i].addShaderStages({ i == 2 ? pushShader : uniformShader, fragmentShader });
+		settings[i].setBlendModes({ vw::BlendMode::disabled });
+		if (i < 2)
+			settings[i].setDescriptorSetLayout(0, i == 0 ? setLayout : pushSet.getSetLayout());
+
+		vw::SubpassDescription subpass;
+		subpass.colorAttachments = { 0 };
+		subpass.attachmentBlendModes = { vw::BlendMode::disabled };
+		subpass.pipelineSettings = &settings[i];
+		renderPasses.push_back(std::make_unique<vw::RenderPass>(device, std::vector<vk::Format>{ vk::Format::eR8G8B8A8Unorm }, std::vector<vk::ImageLayout>{ vk::ImageLayout::eColorAttachmentOptimal }, std::vector<vw::SubpassDescription>{ subpass }));
+		renderPasses[i]->waitForPipelines();
+	}
+
+	vw::Image<vk::ImageType::e2D, vw::ColorAttachment> image(device, extent.width, extent.height, vk::Format::eR8G8B8A8Unorm);
+	vw::Framebuffer framebuffer(device, *renderPasses[0], extent, { image.createView(vk::ImageAspectFlagBits::eColor) });
+
+	vk::PipelineLayout pushLayout = renderPasses[2]->getSubpassLayout(0);
+	vw::PushConstantBlock<DrawData> pushConstants(pushLayout, *device.getLayoutCache().getPushConstantRanges(pushLayout), vk::ShaderStageFlagBits::eVertex);
+	vw::TransientBuffer drawDataBuffer(device, drawCount * drawDataAlignment, 1, vk::BufferUsageFlagBits::eUniformBuffer);
+	vw::DescriptorAllocator allocator(device, 1);
+
+	vk::ClearValue clearValue;
+	clearValue.color.setFloat32({ 0.0f, 0.0f, 0.0f, 1.0f });
+	const char* pathNames[] = { "Descriptor set per draw", pushSet.isPushed() ? "Push descriptors" : "Push descriptors (emulated, VK_KHR_push_descriptor unavailable)", "Push constants" };
+	for (uint32_t path = 0; path < 3; ++path)
+	{
+		vk::PipelineLayout pipelineLayout = renderPasses[path]->getSubpassLayout(0);
+		double recordTime = 0.0;
+		for (uint32_t frame = 0; frame < frameCount; ++frame)
+		{
+			vw::CommandBuffer cmdBuffer = device.createCommandBuffer(device.getGraphicsQueueFamily(), vk::CommandBufferLevel::ePrimary);
+			auto start = std::chrono::steady_clock::now();
+			cmdBuffer.begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+			framebuffer.beginRenderPass(cmdBuffer, { clearValue }, true);
+			cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, renderPasses[path]->getSubpassPipeline(0));
+			cmdBuffer.setScissor(0, { vk::Rect2D(0, extent) });
+			cmdBuffer.setViewport(0, { vk::Viewport(0, 0, (float)extent.width, (float)extent.height, 0.0f, 1.0f) });
+			vw::DescriptorSetBindings bindings;
+			for (uint32_t i = 0; i < drawCount; ++i)
+			{
+				DrawData drawData = { { (i % 100) * 0.02f - 1.0f, (i / 100 % 100) * 0.02f - 1.0f, 0.0f, 0.0f } };
+				if (path == 2)
+					pushConstants.push(cmdBuffer, drawData);
+				else
+				{
+					auto region = drawDataBuffer.allocate(0, sizeof(DrawData), drawDataAlignment);
+					memcpy(region.data, &drawData, sizeof(DrawData));
+					if (path == 0)
+					{
+						vk::DescriptorSet set = allocator.allocate(setLayout);
+						vk::DescriptorBufferInfo bufferInfo(region.buffer, region.offset, region.size);
+						device.updateDescriptorSets({ vk::WriteDescriptorSet(set, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &bufferInfo) }, {});
+						cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, { set }, {});
+					}
+					else
+					{
+						bindings.setBuffer(0, region.buffer, region.offset, region.size);
+						pushSet.push(cmdBuffer, vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, bindings, allocator);
+					}
+				}
+				cmdBuffer.draw(3, 1, 0, 0);
+			}
+			cmdBuffer.endRenderPass();
+			cmdBuffer.end();
+			recordTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			cmdBuffer.submitAndSync();
+			drawDataBuffer.reset(0);
+			allocator.nextFrame();
+		}
+		std::cout << pathNames[path] << ": " << recordTime / frameCount << " ms to record " << drawCount << " draws, " << recordTime * 1000000.0 / (frameCount * drawCount) << " ns per draw" << std::endl;
+	}
+}
+
+//Creates and destroys mixed size buffers while keeping a working set alive, so blocks fragment and free ranges are reused
+static void measureAllocatorChurn(vw::Device& device)
+{
+	const uint32_t bufferCount = 100000;
+	const uint32_t liveBufferCount = 1024;
+	//Sizes from 256 bytes to 4 MiB, small ones are far more common
+	std::mt19937 random(1);
+	std::uniform_int_distribution<uint32_t> sizeShift(8, 22);
+	std::uniform_int_distribution<uint32_t> liveIndex(0, liveBufferCount - 1);
+
+	std::vector<std::unique_ptr<vw::Buffer>> buffers(liveBufferCount);
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < bufferCount; ++i)
+	{
+		uint32_t shift = std::min(sizeShift(random), sizeShift(random));
+		vk::DeviceSize size = (vk::DeviceSize(1) << shift) + random() % (vk::DeviceSize(1) << shift);
+		buffers[liveIndex(random)] = std::make_unique<vw::Buffer>(device, size, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal);
+	}
+	double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	vw::MemoryStatistics statistics = device.getAllocator().getStatistics();
+	std::cout << "Created and destroyed " << bufferCount << " buffers in " << time * 1000.0 << " ms, " << bufferCount / time << " allocations/s" << std::endl;
+	std::cout << "Live allocations: " << statistics.liveAllocationCount << " of " << statistics.allocationCount << " made" << std::endl;
+	std::cout << "Blocks: " << statistics.blockCount << ", peak " << statistics.peakBlockCount << std::endl;
+	std::cout << "Used " << statistics.usedBytes / 1024 << " KiB of " << statistics.blockBytes / 1024 << " KiB in blocks, "
+		<< (statistics.blockBytes ? 100.0 * statistics.usedBytes / statistics.blockBytes : 0.0) << "% occupancy" << std::endl;
+}
+
+//Submits 1, 8 and 64 command buffers per frame one vkQueueSubmit each and all in one SubmitBatch, only the submission is timed
+static void measureSubmitBatching(vw::Device& device)
+{
+	const uint32_t frameCount = 200;
+	uint32_t queueFamily = device.getGraphicsQueueFamily();
+	vk::MemoryBarrier memoryBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead);
+
+	for (uint32_t buffersPerFrame : { 1u, 8u, 64u })
+	{
+		for (bool batched : { false, true })
+		{
+			double submitTime = 0.0;
+			uint32_t queueSubmits = 0;
+			vw::SubmitBatch batch;
+			std::vector<vw::GpuFuture> futures;
+			for (uint32_t frame = 0; frame < frameCount; ++frame)
+			{
+				std::vector<vw::CommandBuffer> cmdBuffers;
+				for (uint32_t i = 0; i < buffersPerFrame; ++i)
+				{
+					cmdBuffers.push_back(device.createCommandBuffer(queueFamily, vk::CommandBufferLevel::ePrimary));
+					cmdBuffers.back().begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+					cmdBuffers.back().pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), { memoryBarrier }, {}, {});
+					cmdBuffers.back().end();
+				}
+
+				futures.clear();
+				auto start = std::chrono::steady_clock::now();
+				if (batched)
+				{
+					for (auto& cmdBuffer : cmdBuffers)
+						batch.add(cmdBuffer);
+					futures.push_back(batch.flush());
+					queueSubmits++;
+				}
+				else
+				{
+					for (auto& cmdBuffer : cmdBuffers)
+						futures.push_back(cmdBuffer.submit());
+					queueSubmits += buffersPerFrame;
+				}
+				submitTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				vw::waitForFutures(futures);
+			}
+			std::cout << buffersPerFrame << " command buffers per frame, " << (batched ? "one SubmitBatch" : "one submit each") << ": "
+				<< frameCount * buffersPerFrame / submitTime << " command buffers/s, " << queueSubmits / submitTime << " vkQueueSubmit/s, "
+				<< submitTime * 1000.0 / frameCount << " ms per frame" << std::endl;
+		}
+	}
+}
+
+//Push descriptors are measured where the device supports them
+static vw::Device createBenchmarkDevice(vw::Instance& instance)
+{
+	try
+	{
+		return instance.createDevice(vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute, 0, { VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME });
+	}
+	catch (const std::runtime_error&)
+	{
+		return instance.createDevice(vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute, 0, {});
+	}
+}
+
+//Headless, runs the benchmarks named on the command line or lists them without arguments
+int main(int argc, char** argv)
+{
+	const std::map<std::string, void(*)(vw::Device&)> benchmarks =
+	{
+		{ "recording", measureRecordingScaling },
+		{ "upload", measureUploadBatching },
+		{ "draws", measureDrawDataPaths },
+		{ "allocator", measureAllocatorChurn },
+		{ "submits", measureSubmitBatching }
+	};
+
+	if (argc < 2)
+	{
+		std::cout << "Usage: benchmarks <name>..." << std::endl;
+		for (auto& benchmark : benchmarks)
+			std::cout << "\t" << benchmark.first << std::endl;
+		return 0;
+	}
+
+	//Validation would dominate the measured CPU time
+	vw::Instance instance("benchmarks", VK_MAKE_VERSION(1, 0, 0), vw::ValidationMode::release, {});
+	vw::Device device = createBenchmarkDevice(instance);
+	for (int i = 1; i < argc; ++i)
+	{
+		auto benchmark = benchmarks.find(argv[i]);
+		if (benchmark == benchmarks.end())
+		{
+			std::cout << "Unknown benchmark " << argv[i] << std::endl;
+			return 1;
+		}
+		benchmark->second(device);
+		device.waitIdle();
+	}
+	return 0;
+}
@@ -1,6 +1,27 @@
 #include "vwpresent.h"
 #include "vkcore.h"
 #include "vwmemory.h"
+#include "vwframe.h"
+#include "vwgraph.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+//Counts every heap allocation of the process so the frame loop can check it stays allocation-free
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	++allocationCount;
+	if (void* memory = std::malloc(size ? size : 1))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
 
 int main()
 {
@@ -19,10 +40,9 @@ int main()
 	graphicsPipelineConfig.addShaderStages({ vertexShader, fragmentShader });
 	graphicsPipelineConfig.setBlendModes({ vw::BlendMode::disabled });
 
-	vw::Swapchain swapchain(device, device.getPhysicalDevice(), window.getSurface());
+	vw::Swapchain swapchain(device, window.getSurface());
 	auto swapImages = swapchain.getImages();
 	vk::Extent2D screenExtent = swapchain.getExtent();
-	vw::Semaphore nextImageAquired(device);
 
 	vw::ExternalDependency dependency;
 	dependency.srcStageMask = vk::PipelineStageFlagBits::eTransfer;
@@ -36,50 +56,101 @@ int main()
 	subpass.preDependencies = { dependency};
 	subpass.pipelineSettings = &graphicsPipelineConfig;
 
-	vw::Image<vk::ImageType::e2D, vw::ColorAttachment, vw::TransferSrc> image(device, screenExtent.width, screenExtent.height, vk::Format::eR8G8B8A8Unorm);
-	auto imageView = image.createView(vk::ImageAspectFlagBits::eColor);
+	//Pipelines come from the device pipeline cache, a second run shows the warm creation time
+	auto pipelineStart = std::chrono::steady_clock::now();
+	vw::RenderPass renderPass(device, { vk::Format::eR8G8B8A8Unorm }, { vk::ImageLayout::eColorAttachmentOptimal }, { subpass });
+	std::cout << "Pipeline creation: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count() << " ms" << std::endl;
 
-	vw::RenderPass renderPass(device, { image.getFormat() }, { vk::ImageLayout::eColorAttachmentOptimal }, { subpass });
+	vw::FrameRing frames(device, 2);
+	uint32_t graphicsFamily = device.getGraphicsQueueFamily();
 
-	vw::Framebuffer framebuffer(device, renderPass, screenExtent, { imageView });
+	//Every frame slot renders into its own image so frames in flight never share an attachment
+	std::vector<std::unique_ptr<vw::Image<vk::ImageType::e2D, vw::ColorAttachment, vw::TransferSrc>>> images;
+	std::vector<std::unique_ptr<vw::Framebuffer>> framebuffers;
+	for (uint32_t i = 0; i < frames.getFrameCount(); ++i)
+	{
+		images.push_back(std::make_unique<vw::Image<vk::ImageType::e2D, vw::ColorAttachment, vw::TransferSrc>>(device, screenExtent.width, screenExtent.height, vk::Format::eR8G8B8A8Unorm));
+		auto imageView = images[i]->createView(vk::ImageAspectFlagBits::eColor);
+		framebuffers.push_back(std::make_unique<vw::Framebuffer>(device, renderPass, screenExtent, std::vector<vk::ImageView>{ imageView }));
+	}
  
 	vk::ClearValue clearValue;
 	clearValue.color.setFloat32({ 0.0f, 0.0f, 0.0f, 1.0f });
 
-	auto renderCmdBuffer = device.createCommandBuffer(vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eTransfer);
-	
-	renderCmdBuffer.begin();
-	framebuffer.beginRenderPass(renderCmdBuffer, { clearValue }, true);
-
-	renderCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, renderPass.getSubpassPipeline(0));
-	renderCmdBuffer.setScissor(0, { vk::Rect2D(0, screenExtent) });
-	renderCmdBuffer.setViewport(0, { vk::Viewport(0, 0, (float)screenExtent.width, (float)screenExtent.height, 0.0f, 1.0f) });
-	renderCmdBuffer.draw(3, 1, 0, 0);
-
-	renderCmdBuffer.endRenderPass();
-	renderCmdBuffer.end();
-
 	vk::ImageSubresourceLayers imageSubresources(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
 	vk::ImageCopy imageCopyRegion(imageSubresources, { 0, 0, 0 }, imageSubresources, { 0, 0, 0 }, { screenExtent.width, screenExtent.height, 1 });
 
-	auto transferCmdBuffers = device.createCommandBufferSet(swapImages.size(), vk::QueueFlagBits::eTransfer);
-	for (size_t i = 0; i < transferCmdBuffers.size(); ++i)
+	//The graph derives the layout transitions and barriers between drawing, copying and presenting
+	//It is built once, every frame only rebinds the images of the frame slot and the acquired swapchain image
+	uint32_t frameIndex = 0;
+	uint32_t imageIndex = 0;
+	vw::RenderGraph graph;
+	uint32_t colorImage = graph.importImage(*images[0], "color");
+	uint32_t swapImage = graph.importImage(swapImages[0], vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined, "swapchain");
+	graph.setOutput(swapImage, vk::ImageLayout::ePresentSrcKHR);
+
+	uint32_t drawPass = graph.addPass("draw", vw::graphicsPass, [&](vk::CommandBuffer cmdBuffer)
 	{
-		transferCmdBuffers[i]->begin();
-		image.transitionLayout(*transferCmdBuffers[i], vk::ImageLayout::eTransferSrcOptimal);
-		image.copyToImage(*transferCmdBuffers[i], swapImages[i], vk::ImageLayout::ePresentSrcKHR, {imageCopyRegion});
-		image.transitionLayout(*transferCmdBuffers[i], vk::ImageLayout::eColorAttachmentOptimal);
-		transferCmdBuffers[i]->end();
-	}
+		framebuffers[frameIndex]->beginRenderPass(cmdBuffer, { clearValue }, true);
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, renderPass.getSubpassPipeline(0));
+		cmdBuffer.setScissor(0, { vk::Rect2D(0, screenExtent) });
+		cmdBuffer.setViewport(0, { vk::Viewport(0, 0, (float)screenExtent.width, (float)screenExtent.height, 0.0f, 1.0f) });
+		cmdBuffer.draw(3, 1, 0, 0);
+		cmdBuffer.endRenderPass();
+	});
+	graph.write(drawPass, colorImage, vw::colorAttachment);
 
+	uint32_t copyPass = graph.addPass("copy", vw::transferPass, [&](vk::CommandBuffer cmdBuffer)
+	{
+		images[frameIndex]->copyToImage(cmdBuffer, swapImages[imageIndex], vk::ImageLayout::eTransferDstOptimal, { imageCopyRegion });
+	});
+	graph.read(copyPass, colorImage, vw::transferResource);
+	graph.write(copyPass, swapImage, vw::transferResource);
+	std::cout << graph.exportDot();
+
+	uint64_t frameCount = 0;
+	uint64_t barrierCount = 0;
+	//Frame slots allocate their command buffers and submit storage and the graph its scratch storage during their first use
+	uint64_t warmupFrames = 2 * frames.getFrameCount();
+	uint64_t steadyAllocations = 0;
 	window.untilClosed([&]()
 	{
-		uint32_t imageIndex = swapchain.getNextImageIndex(nextImageAquired);
-		renderCmdBuffer.submit();
-		transferCmdBuffers[imageIndex]->setWaitConditions({ renderCmdBuffer, nextImageAquired }, { vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer });
-		transferCmdBuffers[imageIndex]->submit();
-		swapchain.present(imageIndex, { *transferCmdBuffers[imageIndex] });
+		//Everything from acquiring to presenting counts, a steady-state frame must not allocate at all
+		uint64_t allocationsBefore = allocationCount;
+
+		//Only waits if the GPU has not finished the frame previously recorded in this slot
+		vw::FrameContext& frame = frames.beginFrame();
+		imageIndex = swapchain.getNextImageIndex(frame.imageAcquired);
+		frameIndex = frame.getIndex();
+		graph.rebindImage(colorImage, *images[frameIndex]);
+		graph.rebindImage(swapImage, swapImages[imageIndex], vk::ImageLayout::eUndefined);
+
+		vw::CommandBuffer& cmdBuffer = frame.createCommandBuffer(graphicsFamily);
+		cmdBuffer.begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+		graph.execute(cmdBuffer);
+		barrierCount += graph.getStatistics().imageBarriers + graph.getStatistics().bufferBarriers;
+		cmdBuffer.end();
+		cmdBuffer.setWaitConditions({ frame.imageAcquired }, { vk::PipelineStageFlagBits::eTransfer });
+		cmdBuffer.setCompletionFence(frame.getFence());
+		cmdBuffer.submit(frame.renderFinished);
+		swapchain.present(imageIndex, { frame.renderFinished });
+
+		if (frameCount >= warmupFrames)
+			steadyAllocations += allocationCount - allocationsBefore;
+		++frameCount;
 	});
+	frames.waitIdle();
 	device.waitIdle();
+
+	if (frameCount)
+	{
+		std::cout << "Average CPU stall per frame: " << frames.getTotalStallTime() / frameCount << " ms" << std::endl;
+		std::cout << "Average barriers per frame: " << (double)barrierCount / frameCount << std::endl;
+	}
+	if (steadyAllocations)
+	{
+		std::cout << "Steady-state frames allocated " << steadyAllocations << " times!" << std::endl;
+		return 1;
+	}
 	return 0;
 }
@@ -0,0 +1,99 @@
+#include "vkcore.h"
+#include "vwmemory.h"
+#include "vwcompute.h"
+#include "vwdescriptor.h"
+#include "vwrender.h"
+#include <chrono>
+#include <iostream>
+#include <random>
+
+//Inclusive prefix sum on the GPU, one compute dispatch per step ping-ponging between two storage buffers, checked against the CPU
+int main()
+{
+	const uint32_t valueCount = 1 << 20;
+	const vk::DeviceSize bufferSize = valueCount * sizeof(uint32_t);
+
+	struct Step
+	{
+		uint32_t offset;
+		uint32_t count;
+	};
+
+	vw::Instance instance("prefix sum", VK_MAKE_VERSION(1, 0, 0), vw::ValidationMode::debug, {});
+	vw::Device device = instance.createDevice(vk::QueueFlagBits::eCompute, 0, {});
+	uint32_t computeFamily = device.getComputeQueueFamily();
+
+	std::string shaderPath = SHADER_DIR;
+	vw::Shader shader(device, vk::ShaderStageFlagBits::eCompute, shaderPath + "prefix_sum.comp");
+
+	std::vector<vk::DescriptorSetLayoutBinding> bindings =
+	{
+		vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute),
+		vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute)
+	};
+	std::vector<vk::PushConstantRange> pushConstantRanges = { vk::PushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(Step)) };
+	vk::DescriptorSetLayout setLayout = device.getLayoutCache().getSetLayout(bindings);
+	vk::PipelineLayout pipelineLayout = device.getLayoutCache().getPipelineLayout({ setLayout }, pushConstantRanges);
+	vw::ComputePipeline pipeline(device, shader, pipelineLayout);
+	vw::PushConstantBlock<Step> stepConstants(pipelineLayout, pushConstantRanges, vk::ShaderStageFlagBits::eCompute);
+
+	std::vector<uint32_t> values(valueCount);
+	std::mt19937 random(1);
+	for (auto& value : values)
+		value = random() % 1000;
+
+	vw::StorageBuffer buffers[2] = { vw::StorageBuffer(device, bufferSize), vw::StorageBuffer(device, bufferSize) };
+	vw::StorageBuffer readback(device, bufferSize, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+	//Acquired on the compute family by the command buffer begun below
+	buffers[0].loadData(values.data(), { vk::BufferCopy(0, 0, bufferSize) }, computeFamily).submit();
+
+	//Set i reads buffers[i] and writes the other one
+	vw::DescriptorAllocator allocator(device, 1);
+	vk::DescriptorSet sets[2];
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		sets[i] = allocator.allocate(setLayout);
+		vk::DescriptorBufferInfo sourceInfo(buffers[i], 0, VK_WHOLE_SIZE);
+		vk::DescriptorBufferInfo destinationInfo(buffers[1 - i], 0, VK_WHOLE_SIZE);
+		device.updateDescriptorSets({ vk::WriteDescriptorSet(sets[i], 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &sourceInfo),
+			vk::WriteDescriptorSet(sets[i], 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &destinationInfo) }, {});
+	}
+
+	vw::CommandBuffer cmdBuffer = pipeline.createCommandBuffer();
+	cmdBuffer.begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+	pipeline.bind(cmdBuffer);
+	uint32_t source = 0;
+	for (uint32_t offset = 1; offset < valueCount; offset *= 2)
+	{
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, { sets[source] }, {});
+		stepConstants.push(cmdBuffer, { offset, valueCount });
+		pipeline.dispatchInvocations(cmdBuffer, valueCount);
+		vw::computeBarrier(cmdBuffer);
+		source = 1 - source;
+	}
+
+	vk::MemoryBarrier copyBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead);
+	cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), { copyBarrier }, {}, {});
+	cmdBuffer.copyBuffer(buffers[source], readback, { vk::BufferCopy(0, 0, bufferSize) });
+	vk::MemoryBarrier hostBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+	cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), { hostBarrier }, {}, {});
+	cmdBuffer.end();
+
+	auto start = std::chrono::steady_clock::now();
+	cmdBuffer.submitAndSync();
+	std::cout << "GPU prefix sum of " << valueCount << " values: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+
+	uint32_t sum = 0;
+	const uint32_t* result = static_cast<const uint32_t*>(readback.getMappedData());
+	for (uint32_t i = 0; i < valueCount; ++i)
+	{
+		sum += values[i];
+		if (result[i] != sum)
+		{
+			std::cout << "Mismatch at " << i << ": GPU " << result[i] << ", CPU " << sum << std::endl;
+			return 1;
+		}
+	}
+	std::cout << "GPU result matches the CPU" << std::endl;
+	return 0;
+}
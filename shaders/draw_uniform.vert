@@ -0,0 +1,23 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(location = 0) out vec3 fragColor;
+
+layout(set = 0, binding = 0) uniform DrawData {
+    vec4 offset;
+} drawData;
+
+vec2 positions[3] = vec2[](
+    vec2(0.0, -0.05),
+    vec2(0.05, 0.05),
+    vec2(-0.05, 0.05)
+);
+
+void main() {
+    gl_Position = vec4(positions[gl_VertexIndex] + drawData.offset.xy, 0.0, 1.0);
+    fragColor = vec3(1.0, 1.0, 1.0);
+}
\ No newline at end of file
@@ -3,6 +3,12 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <map>
+#include <deque>
 #include <iostream>
 #include <vulkan\vulkan.hpp>
 #include "vwutils.h"
@@ -40,57 +46,371 @@ namespace vw
 		vk::Device deviceHandle;
 	};
 
-	class CommandBuffer : public vk::CommandBuffer, public vw::Semaphore
+	class MemoryAllocator;
+	class ThreadPool;
+	class LayoutCache;
+	class ShaderModuleRegistry;
+	class StagingRing;
+	class CommandBuffer;
+	class SubmitBatch;
+
+	enum QueueSchedulingMode
+	{
+		roundRobin,
+		//Queue with the fewest submissions still executing
+		leastLoaded
+	};
+
+	class Timeline;
+
+	//Point on a queue timeline, reached once the submission that returned it has completed
+	struct GpuFuture
+	{
+		vw::Timeline* timeline = nullptr;
+		uint64_t value = 0;
+		bool isReady();
+		void wait();
+		bool isValid() { return timeline != nullptr; };
+	};
+
+	//Waits for all futures with one host wait when every timeline is a timeline semaphore
+	void waitForFutures(std::vector<vw::GpuFuture> futures);
+
+	//Monotonic submission counter of one queue, backed by a timeline semaphore on Vulkan 1.2 and by one fence per submission otherwise
+	class Timeline
+	{
+	public:
+		Timeline(vk::Device device, bool useTimelineSemaphore);
+		~Timeline();
+		//Must be called with the queue locked, submitFence is the fence the submission has to signal (null for timeline semaphores)
+		uint64_t reserveValue(vk::Fence& submitFence);
+		uint64_t getCompletedValue();
+		//Submissions reserved but not yet completed
+		uint64_t getPendingCount();
+		void wait(uint64_t value);
+		bool isTimelineSemaphore() { return timelineSemaphore; };
+		vk::Semaphore getSemaphore() { return semaphore; };
+		vk::Device getDevice() { return deviceHandle; };
+	private:
+		struct PendingFence
+		{
+			uint64_t value;
+			vk::Fence fence;
+		};
+		void retireFences(bool block, uint64_t value);
+
+		vk::Device deviceHandle;
+		bool timelineSemaphore;
+		vk::Semaphore semaphore;
+		uint64_t lastValue = 0, completedValue = 0;
+		std::vector<PendingFence> pendingFences;
+		std::vector<vk::Fence> freeFences;
+		std::mutex timelineMutex;
+	};
+
+	//Acquire half of a queue family ownership transfer, recorded by the first primary command buffer begun on dstQueueFamily after the release was submitted
+	struct OwnershipTransfer
+	{
+		uint32_t dstQueueFamily = 0;
+		std::shared_ptr<vw::Semaphore> semaphore;
+		std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+		std::vector<vk::ImageMemoryBarrier> imageBarriers;
+	};
+
+	//Queue handle locked for the lifetime of the lease, queue submission must be externally synchronized
+	struct QueueLease
+	{
+		vk::Queue queue;
+		std::unique_lock<std::mutex> lock;
+		vw::Timeline* timeline = nullptr;
+	};
+
+	//Spreads submissions over all queues of one family
+	class QueueScheduler
+	{
+	public:
+		QueueScheduler(vk::Device device, std::vector<vk::Queue> familyQueues, vw::QueueSchedulingMode mode, bool timelineSemaphores);
+		//Waits for the submissions still holding deferred objects
+		~QueueScheduler();
+		vw::QueueLease acquire();
+		void waitIdle();
+		uint32_t getQueueCount() { return (uint32_t)queues.size(); };
+		//Ownership released to this family, the release has to be submitted already
+		void queueAcquire(vw::OwnershipTransfer transfer);
+		//Moves every queued acquire into transfers, returns without locking if there is none
+		void takeAcquires(std::vector<vw::OwnershipTransfer>& transfers);
+		//Command buffers begun on the family afterwards wait for future, their submission may go to another queue than the writes
+		void queueWriteWait(vw::GpuFuture future);
+		//Appends the write waits that have not completed yet
+		void getWriteWaits(std::vector<vw::GpuFuture>& futures);
+		//Keeps object alive until future is ready, e.g. semaphores of a submission outliving its command buffer
+		void releaseAfter(std::shared_ptr<void> object, vw::GpuFuture future);
+	private:
+		struct DeferredRelease
+		{
+			std::shared_ptr<void> object;
+			vw::GpuFuture future;
+		};
+		void releaseCompleted();
+
+		std::vector<vk::Queue> queues;
+		std::vector<std::unique_ptr<vw::Timeline>> timelines;
+		std::vector<std::mutex> queueMutexes;
+		std::atomic<uint32_t> nextQueue;
+		vw::QueueSchedulingMode schedulingMode;
+		std::vector<vw::OwnershipTransfer> pendingAcquires;
+		std::atomic<uint32_t> pendingAcquireCount;
+		//At most one per queue, a later value of a timeline includes the earlier ones
+		std::vector<vw::GpuFuture> writeWaits;
+		std::atomic<uint32_t> writeWaitCount;
+		std::vector<DeferredRelease> deferredReleases;
+		std::mutex acquireMutex, releaseMutex;
+	};
+
+	//Command pool owned by one thread, buffers handed back from any thread are reused instead of freed
+	class CommandPool
 	{
 	public:
-		CommandBuffer(vk::Device device, vk::CommandPool commandPool, vk::CommandBufferLevel level, std::function<vk::Queue()> queueRequestFunc);
-		CommandBuffer(vk::Device device, vk::CommandBuffer bufferHandle, std::function<vk::Queue()> queueRequestFunc); //External alloc/dealloc
+		CommandPool(vk::Device device, uint32_t queueFamilyIndex);
+		~CommandPool();
+		//Node of one allocated command buffer, owned by the pool and handed back with recycle instead of being freed
+		struct PooledBuffer
+		{
+			vk::CommandBuffer buffer;
+			vk::CommandBufferLevel level;
+			//Last submission of the buffer, it is handed out again once this is ready
+			vw::GpuFuture future;
+			PooledBuffer* next = nullptr;
+		};
+
+		operator vk::CommandPool() { return pool; };
+		//Only from the thread owning the pool
+		vw::CommandPool::PooledBuffer* allocate(vk::CommandBufferLevel level);
+		//From any thread, the buffer must not be used by the caller anymore
+		void recycle(vw::CommandPool::PooledBuffer* pooledBuffer, vw::GpuFuture future);
+		//Resets every buffer of the pool at once, no buffer of the pool may be pending or recorded concurrently
+		//Buffers still held by command buffers stay with them and are only handed out again once recycled
+		void reset();
+		uint32_t getQueueFamilyIndex() { return familyIndex; };
+	private:
+		void collectRecycled(bool poolIdle);
+
+		vk::Device deviceHandle;
+		vk::CommandPool pool;
+		uint32_t familyIndex;
+		std::atomic<PooledBuffer*> recycled;
+		//Nodes keep their address, the deque only grows while new buffers are allocated
+		std::deque<PooledBuffer> bufferNodes;
+		std::vector<PooledBuffer*> allocatedBuffers[2], availableBuffers[2];
+		//Recycled while their last submission was still executing
+		std::vector<PooledBuffer*> pendingBuffers;
+	};
+
+	//One set of command pools per recording thread and per slot, slots are reset as a whole
+	class ThreadCommandPools
+	{
+	public:
+		ThreadCommandPools(vk::Device device, uint32_t queueFamilyCount, uint32_t slotCount = 1);
+		vw::CommandPool& get(uint32_t queueFamilyIndex, uint32_t slot = 0);
+		//Resets the pools of the calling thread, the pools of other threads are reset by their own thread on its next get of the slot
+		void reset(uint32_t slot);
+	private:
+		struct PoolList
+		{
+			std::vector<std::unique_ptr<vw::CommandPool>> pools;
+			//Last slot reset this thread has applied to its pools
+			std::vector<uint64_t> appliedResets;
+		};
+		PoolList& getThreadPools();
+		void resetSlot(PoolList& poolList, uint32_t slot, uint64_t resetCount);
+
+		vk::Device deviceHandle;
+		uint32_t familyCount;
+		uint32_t slots;
+		uint64_t ownerId;
+		std::unique_ptr<std::atomic<uint64_t>[]> slotResets;
+		std::map<std::thread::id, PoolList> threadPools;
+		std::mutex poolMutex;
+	};
+
+	class CommandBuffer : public vk::CommandBuffer
+	{
+	public:
+		CommandBuffer(vk::Device device, vw::CommandPool& commandPool, vk::CommandBufferLevel level, vw::QueueScheduler& queueScheduler);
+		CommandBuffer(vk::Device device, vk::CommandBuffer bufferHandle, vw::QueueScheduler& queueScheduler); //External alloc/dealloc
 		CommandBuffer(vw::CommandBuffer&& other);
+		//Primary buffers first record the acquires of ownership released to their family, they have to be submitted before other users of those resources
 		void begin(vk::CommandBufferUsageFlags usageFlags = vk::CommandBufferUsageFlagBits());
-		void setWaitConditions(std::vector<vk::Semaphore> waitSemaphores, std::vector<vk::PipelineStageFlags> waitStages);
-		void submit();
-		void submit(vk::Semaphore triggerSemaphore);
+		void setWaitConditions(vk::ArrayProxy<const vk::Semaphore> waitSemaphores, vk::ArrayProxy<const vk::PipelineStageFlags> waitStages);
+		void setCompletionFence(vk::Fence fence);
+		//Semaphores only waited on/signaled by the next submission, kept alive by the queue scheduler until that submission has completed
+		void addSubmitWait(std::shared_ptr<vw::Semaphore> semaphore, vk::PipelineStageFlags waitStage);
+		void addSubmitSignal(std::shared_ptr<vw::Semaphore> semaphore);
+		//Waited on by the GPU with timeline semaphores, resolved on the host before submitting otherwise
+		void addSubmitWait(const vw::GpuFuture& future, vk::PipelineStageFlags waitStage);
+		//Called once with the future of the next submission, or with an empty future if the buffer is destroyed or reallocated before being submitted
+		void addSubmitCallback(std::function<void(vw::GpuFuture)> callback);
+		//Binary semaphore signaled by every following submission, only created on request
+		vk::Semaphore getSemaphore();
+		vw::GpuFuture submit();
+		vw::GpuFuture submit(vk::Semaphore triggerSemaphore);
 		void submitAndSync();
+		vw::GpuFuture getFuture() { return lastFuture; };
+		uint32_t getQueueFamilyIndex() { return poolRef ? poolRef->getQueueFamilyIndex() : 0; };
+		//Takes a new buffer from commandPool while keeping the storage of this object, the previous buffer is recycled once its last submission has finished
+		void reallocate(vw::CommandPool& commandPool, vk::CommandBufferLevel level);
 		~CommandBuffer();
 		CommandBuffer& operator=(vw::CommandBuffer&& other);
 	private:
+		friend class vw::SubmitBatch;
+		vw::GpuFuture queueSubmit(vk::Semaphore triggerSemaphore, bool sync);
+		void completeSubmit(vw::GpuFuture future);
+		void recordAcquires();
+		void releaseSignalSemaphore();
+		void runSubmitCallbacks(vw::GpuFuture future);
+
 		vk::Device deviceHandle;
-		vk::CommandPool poolHandle;
-		std::function<vk::Queue()> requestQueue;
-		std::vector<vk::Semaphore> wSemaphores;
-		std::vector<vk::PipelineStageFlags> wStages;
+		vw::CommandPool* poolRef = nullptr;
+		vw::CommandPool::PooledBuffer* pooledBuffer = nullptr;
+		vk::CommandBufferLevel bufferLevel = vk::CommandBufferLevel::ePrimary;
+		vw::QueueScheduler* scheduler;
+		vw::InlineVector<vk::Semaphore, 8> wSemaphores;
+		vw::InlineVector<vk::PipelineStageFlags, 8> wStages;
+		vk::Fence completionFence;
+		std::vector<std::shared_ptr<vw::Semaphore>> submitWaits, submitSignals;
+		std::vector<vk::PipelineStageFlags> submitWaitStages;
+		std::vector<vw::GpuFuture> futureWaits;
+		std::vector<vk::PipelineStageFlags> futureWaitStages;
+		std::vector<std::function<void(vw::GpuFuture)>> submitCallbacks;
+		std::unique_ptr<vw::Semaphore> signalSemaphore;
+		vw::GpuFuture lastFuture;
 	};
 	
 	class CommandBufferSet : public std::vector<std::unique_ptr<vw::CommandBuffer>>
 	{
 	public:
-		CommandBufferSet(size_t count, vk::Device device, vk::CommandPool commandPool, vk::CommandBufferLevel level, std::function<vk::Queue()> queueRequestFunc);
-		~CommandBufferSet();
+		CommandBufferSet(size_t count, vk::Device device, vw::CommandPool& commandPool, vk::CommandBufferLevel level, vw::QueueScheduler& queueScheduler);
+	};
+
+	//Submits command buffers of one queue family with a single vkQueueSubmit, storage is kept across flushes
+	class SubmitBatch
+	{
+	public:
+		//Takes over the pending waits, signals and completion fence of cmdBuffer, they apply to its own batch only
+		//Throws if cmdBuffer belongs to another queue family than the buffers already added
+		void add(vw::CommandBuffer& cmdBuffer, vk::Semaphore triggerSemaphore = nullptr);
+		vw::GpuFuture flush();
+		//Drops everything added since the last flush
+		void clear();
+		bool empty() { return entries.empty(); };
 	private:
-		vk::Device deviceHandle;
-		std::vector<vk::CommandBuffer> buffers;
-		vk::CommandPool poolHandle;
+		struct Entry
+		{
+			vw::CommandBuffer* cmdBuffer;
+			uint32_t waitOffset, waitCount;
+			uint32_t signalOffset, signalCount;
+		};
+
+		std::vector<Entry> entries;
+		std::vector<vk::Semaphore> waitSemaphores, signalSemaphores;
+		std::vector<vk::PipelineStageFlags> waitStages;
+		std::vector<uint64_t> waitValues, signalValues;
+		std::vector<vk::Fence> fences;
+		std::vector<vk::SubmitInfo> submitInfos;
+#ifdef VK_VERSION_1_2
+		std::vector<vk::TimelineSemaphoreSubmitInfo> timelineInfos;
+#endif
+	};
+
+	//Per-frame command buffers, a frame slot's pools are reset wholesale instead of freeing each buffer
+	class CommandBufferRecycler
+	{
+	public:
+		CommandBufferRecycler(vw::Device& device, uint32_t frameCount);
+		//Caller guarantees the command buffers of the frame being reused have finished executing
+		//Pools of other recording threads are reset by those threads on their next createCommandBuffer
+		void nextFrame();
+		vw::CommandBuffer createCommandBuffer(uint32_t queueFamilyIndex, vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
+		//Gives a command buffer of an earlier frame a new buffer of the current frame and the same queue family
+		void reallocateCommandBuffer(vw::CommandBuffer& cmdBuffer, vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
+		uint32_t getFrameIndex() { return frameIndex; };
+	private:
+		vw::Device& deviceRef;
+		vw::ThreadCommandPools framePools;
+		uint32_t frameIndex = 0;
+		uint32_t frames;
 	};
 
 	class Device : public vk::Device
 	{
 	public:
-		Device(vk::Instance instance, vk::PhysicalDevice physicalDevice, bool presentationSupport, bool enableValidation, std::vector<const char*> extensions);
+		//An empty pipelineCachePath disables loading and saving the pipeline cache
+		Device(vk::Instance instance, vk::PhysicalDevice physicalDevice, bool presentationSupport, bool enableValidation, std::vector<const char*> extensions, std::vector<float> queuePriorities = {}, vw::QueueSchedulingMode schedulingMode = vw::roundRobin, std::string pipelineCachePath = "vw_pipeline_cache.bin");
 		vk::PhysicalDevice getPhysicalDevice() { return physicalDeviceHandle; };
+		vw::MemoryAllocator& getAllocator() { return *allocator; };
+		vw::StagingRing& getStagingRing();
+		//Job system of the device for shader compilation and pipeline creation, drained before the device is destroyed
+		vw::ThreadPool& getThreadPool() { return *threadPool; };
+		uint32_t getQueueFamilyCount() { return (uint32_t)queueFamilies.size(); };
+		bool supportsTimelineSemaphores() { return timelineSemaphores; };
+		//Update after bind, partially bound and non uniformly indexed arrays of sampled images and storage buffers
+		bool supportsDescriptorIndexing() { return descriptorIndexing; };
+		bool isExtensionEnabled(const char* extensionName);
+		//Lower of the instance and device API versions
+		uint32_t getApiVersion() { return apiVersion; };
+		//Shared by all pipeline creation of the device
+		vk::PipelineCache getPipelineCache() { return pipelineCache; };
+		//Writes the cache to a temporary file first and renames it over the previous one
+		bool savePipelineCache();
+		//Descriptor set and pipeline layouts shared by every pipeline of the device
+		vw::LayoutCache& getLayoutCache() { return *layoutCache; };
+		//Pipelines created on demand, shared by all compatible render passes
+		vw::PipelineCache& getPipelines() { return *pipelines; };
+		//Shader modules shared by every shader of the device with identical SPIR-V
+		vw::ShaderModuleRegistry& getShaderModuleRegistry() { return *shaderModules; };
+		//Listeners are called before vw buffers and image views are destroyed, e.g. to drop descriptor sets referring to them
+		uint64_t addDestructionListener(std::function<void(vk::DebugReportObjectTypeEXT, uint64_t)> listener);
+		void removeDestructionListener(uint64_t listenerId);
+		void notifyDestruction(vk::DebugReportObjectTypeEXT objectType, uint64_t handle);
+		vw::QueueLease acquireQueue(uint32_t queueFamilyIndex);
+		vw::QueueScheduler& getQueueScheduler(uint32_t queueFamilyIndex) { return *queueSchedulers[queueFamilyIndex]; };
+		uint32_t getGraphicsQueueFamily();
+		uint32_t getTransferQueueFamily();
+		uint32_t getComputeQueueFamily();
+		//Records the release barriers into cmdBuffer, once it is submitted the acquire is recorded by the next primary command buffer begun on dstQueueFamily
+		//Within one family command buffers begun after the submission wait for it instead, they may be submitted to another queue
+		void transferOwnership(vw::CommandBuffer& cmdBuffer, uint32_t srcQueueFamily, uint32_t dstQueueFamily, std::vector<vk::BufferMemoryBarrier> bufferBarriers, std::vector<vk::ImageMemoryBarrier> imageBarriers);
 		std::vector<uint32_t> getQueueFamilyIndices(vk::QueueFlags flagMask);
 		vw::CommandBuffer createCommandBuffer(vk::QueueFlags flags, vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
+		vw::CommandBuffer createCommandBuffer(uint32_t queueFamilyIndex, vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
 		vw::CommandBufferSet createCommandBufferSet(uint32_t count, vk::QueueFlags flags, vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
 		void waitIdle();
 		~Device();
 	private:
-		std::function<vk::Queue()> createQueueRequest(uint32_t queueFamilyIndex);
+		friend class vw::CommandBufferRecycler;
 		uint32_t findQueueFamily(vk::QueueFlags flags);
 		vk::PhysicalDevice physicalDeviceHandle;
 		vk::PhysicalDeviceFeatures deviceFeatures;
+		bool timelineSemaphores = false;
+		bool descriptorIndexing = false;
+		std::vector<std::string> enabledExtensions;
+		uint32_t apiVersion;
+		vk::PipelineCache pipelineCache;
+		std::string pipelineCacheFile;
+		std::unique_ptr<vw::LayoutCache> layoutCache;
+		std::unique_ptr<vw::PipelineCache> pipelines;
+		std::unique_ptr<vw::ShaderModuleRegistry> shaderModules;
+		std::unique_ptr<vw::ThreadPool> threadPool;
 	 
 		std::vector<vk::QueueFamilyProperties> queueFamilies;
-		std::vector<vk::Queue> queues;
-		std::vector<vk::CommandPool> commandPools;
+		std::vector<std::unique_ptr<vw::QueueScheduler>> queueSchedulers;
+		std::unique_ptr<vw::ThreadCommandPools> commandPools;
+		std::unique_ptr<vw::MemoryAllocator> allocator;
+		std::unique_ptr<vw::StagingRing> stagingRing;
+		std::once_flag stagingRingCreated;
+		std::map<uint64_t, std::function<void(vk::DebugReportObjectTypeEXT, uint64_t)>> destructionListeners;
+		uint64_t nextListenerId = 0;
+		std::mutex listenerMutex;
 	};
 
 	class Instance
@@ -98,7 +418,8 @@ namespace vw
 	public:
 		Instance(std::string appName, uint32_t version, vw::ValidationMode validationMode, std::vector<const char*> platformExtensions);
 		operator vk::Instance();
-		vw::Device createDevice(vk::QueueFlags requiredQueueFlags, VkSurfaceKHR requiredSurfaceSupport, std::vector<const char*> requiredExtensions);
+		//Queue priorities are given per queue index within a family, missing entries default to 1.0
+		vw::Device createDevice(vk::QueueFlags requiredQueueFlags, VkSurfaceKHR requiredSurfaceSupport, std::vector<const char*> requiredExtensions, std::vector<float> queuePriorities = {}, vw::QueueSchedulingMode schedulingMode = vw::roundRobin, std::string pipelineCachePath = "vw_pipeline_cache.bin");
 		~Instance();
 	private:
 		bool checkValidationLayerSupport(vw::ValidationMode mode);
@@ -0,0 +1,50 @@
+#pragma once
+#include "vkcore.h"
+#include "vwmemory.h"
+
+namespace vw
+{
+	//Pipeline of a single compute shader, the layout is derived from shader reflection unless one is given
+	class ComputePipeline
+	{
+	public:
+		ComputePipeline(vw::Device& device, vw::Shader& shader, vk::PipelineLayout layout = nullptr, const vw::SpecializationData* specialization = nullptr);
+		~ComputePipeline();
+		operator vk::Pipeline() { return current.pipeline; };
+		vk::PipelineLayout getLayout() { return current.layout; };
+		//Command buffer on the compute queue family
+		vw::CommandBuffer createCommandBuffer(vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
+		void bind(vk::CommandBuffer cmdBuffer);
+		//Dispatches enough workgroups to cover the invocation counts, the shader has to skip invocations past the end
+		void dispatchInvocations(vk::CommandBuffer cmdBuffer, uint32_t x, uint32_t y = 1, uint32_t z = 1);
+		uint32_t getLocalSize(uint32_t dimension) { return current.localSize[dimension]; };
+		//Recreates the pipeline in the background if it uses the shader, returns whether it does
+		bool rebuildPipeline(vw::Shader& shader);
+		//Never blocks, replaces the pipeline once its rebuild has finished and returns whether it did, call at a frame boundary
+		bool swapPipeline();
+		//Only once frames in flight can no longer use the pipelines replaced by swapPipeline
+		void destroyRetiredPipelines();
+	private:
+		//The layout and workgroup size follow the reflection of the shader the pipeline was created from
+		struct PipelineState
+		{
+			vk::Pipeline pipeline;
+			vk::PipelineLayout layout;
+			uint32_t localSize[3];
+		};
+		PipelineState createPipeline();
+
+		PipelineState current;
+		//Latest rebuild, superseded ones are destroyed once they finish
+		std::shared_future<PipelineState> rebuild;
+		std::vector<std::shared_future<PipelineState>> supersededRebuilds;
+		std::vector<vk::Pipeline> retiredPipelines;
+		vw::Shader& shaderRef;
+		vk::PipelineLayout givenLayout;
+		vw::SpecializationData specializationData;
+		vw::Device& deviceRef;
+	};
+
+	//Makes shader writes of previous dispatches visible to the following ones
+	void computeBarrier(vk::CommandBuffer cmdBuffer);
+}
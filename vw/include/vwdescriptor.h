@@ -0,0 +1,258 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "vkcore.h"
+
+namespace vw
+{
+	class DescriptorSetCache;
+	class PushDescriptorSet;
+	class ImageBase;
+
+	struct DescriptorAllocatorStatistics
+	{
+		uint64_t setsAllocated = 0;
+		uint32_t poolCount = 0;
+		//Pools chained because the current pool of an arena ran out
+		uint32_t poolGrowths = 0;
+	};
+
+	//Descriptor sets valid until their frame slot is reset, every recording thread allocates from arenas of its own
+	//An arena chains pools when it runs out and is rebuilt as a single pool sized to its usage when its slot is reset
+	class DescriptorAllocator
+	{
+	public:
+		DescriptorAllocator(vw::Device& device, uint32_t frameCount = 2, uint32_t initialSetCount = 64);
+		~DescriptorAllocator();
+		vk::DescriptorSet allocate(vk::DescriptorSetLayout layout);
+		//Resets every arena of the next slot with vkResetDescriptorPool, sets of the slot must no longer be in use
+		//No thread may allocate while the frame advances
+		void nextFrame();
+		uint32_t getFrameIndex() { return frameIndex; };
+		vw::DescriptorAllocatorStatistics getStatistics();
+	private:
+		struct PoolSizing
+		{
+			uint32_t setCount = 0;
+			std::map<vk::DescriptorType, uint32_t> descriptorCounts;
+		};
+
+		struct Arena
+		{
+			std::vector<vk::DescriptorPool> pools;
+			PoolSizing usage;
+			uint32_t nextSetCount;
+			//Bindings of layouts known to the device layout cache, nullptr for other layouts
+			std::map<vk::DescriptorSetLayout, const std::vector<vk::DescriptorSetLayoutBinding>*> layoutBindings;
+		};
+		typedef std::vector<Arena> ArenaList;
+
+		ArenaList& getThreadArenas();
+		//requiredBindings is the layout of a set that has to fit into the pool, if known
+		PoolSizing sizePool(uint32_t setCount, const PoolSizing& usage, uint32_t headroomDivisor, const std::vector<vk::DescriptorSetLayoutBinding>* requiredBindings = nullptr);
+		vk::DescriptorPool createPool(const PoolSizing& sizing);
+		void growArena(Arena& arena, const std::vector<vk::DescriptorSetLayoutBinding>* requiredBindings = nullptr);
+		void resetArena(Arena& arena);
+
+		vw::Device& deviceRef;
+		uint32_t frames;
+		uint32_t frameIndex = 0;
+		uint32_t initialSets;
+		uint64_t ownerId;
+		std::map<std::thread::id, ArenaList> threadArenas;
+		std::atomic<uint64_t> setsAllocated;
+		std::atomic<uint32_t> poolGrowths;
+		std::atomic<uint32_t> poolCount;
+		std::mutex arenaMutex;
+	};
+
+	//One descriptor in the layout expected by descriptor update templates, zero filled so it can be hashed and compared bytewise
+	union DescriptorData
+	{
+		VkDescriptorImageInfo image;
+		VkDescriptorBufferInfo buffer;
+		VkBufferView texelBufferView;
+	};
+
+	//Resources bound to the bindings of one descriptor set
+	class DescriptorSetBindings
+	{
+	public:
+		void setBuffer(uint32_t binding, vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE, uint32_t arrayElement = 0);
+		void setImage(uint32_t binding, vk::ImageView imageView, vk::ImageLayout imageLayout, vk::Sampler sampler = nullptr, uint32_t arrayElement = 0);
+		void setSampler(uint32_t binding, vk::Sampler sampler, uint32_t arrayElement = 0);
+		void setTexelBuffer(uint32_t binding, vk::BufferView bufferView, uint32_t arrayElement = 0);
+		void clear() { entries.clear(); };
+	private:
+		friend class vw::DescriptorSetCache;
+		friend class vw::PushDescriptorSet;
+		struct Entry
+		{
+			uint32_t binding;
+			uint32_t arrayElement;
+			vw::DescriptorData data;
+		};
+		vw::DescriptorData& set(uint32_t binding, uint32_t arrayElement);
+
+		std::vector<Entry> entries;
+	};
+
+	struct DescriptorSetCacheStatistics
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		size_t liveSets = 0;
+		double getHitRate() { return hits + misses ? double(hits) / double(hits + misses) : 0.0; };
+	};
+
+	//Written descriptor sets keyed by layout and bound resources, sets unused for maxAge frames are freed
+	//maxAge has to exceed the number of frames in flight
+	//Sets referring to destroyed vw buffers and image views are freed, other resources have to be invalidated before they are destroyed
+	class DescriptorSetCache
+	{
+	public:
+		DescriptorSetCache(vw::Device& device, uint32_t maxAge = 8, uint32_t poolSetCount = 256);
+		~DescriptorSetCache();
+		//Layouts not created by the device layout cache, e.g. set layouts of explicit vw::PipelineLayouts, have to be added first
+		void addLayout(vk::DescriptorSetLayout layout, std::vector<vk::DescriptorSetLayoutBinding> bindings);
+		vk::DescriptorSet getSet(vk::DescriptorSetLayout layout, const vw::DescriptorSetBindings& bindings);
+		vk::DescriptorSet getSet(vw::PipelineLayout& pipelineLayout, uint32_t setIndex, const vw::DescriptorSetBindings& bindings);
+		//Frees every set referring to the resource, the sets must no longer be in use
+		void invalidate(vk::Buffer buffer);
+		void invalidate(vk::ImageView imageView);
+		void invalidate(vk::Sampler sampler);
+		void invalidate(vk::BufferView bufferView);
+		void nextFrame();
+		vw::DescriptorSetCacheStatistics getStatistics();
+	private:
+		//Descriptors of a layout are written from one DescriptorData array, each binding starting at its first slot
+		struct LayoutWriter
+		{
+			std::vector<vk::DescriptorSetLayoutBinding> bindings;
+			std::map<uint32_t, uint32_t> firstSlots;
+			std::map<uint32_t, uint32_t> descriptorCounts;
+			uint32_t slotCount = 0;
+			VkDescriptorUpdateTemplate updateTemplate = VK_NULL_HANDLE;
+		};
+
+		struct CachedSet
+		{
+			vk::DescriptorSet set;
+			vk::DescriptorPool pool;
+			vk::DescriptorSetLayout layout;
+			std::vector<vw::DescriptorData> data;
+			uint64_t lastUsedFrame;
+		};
+
+		LayoutWriter& getLayoutWriter(vk::DescriptorSetLayout layout);
+		LayoutWriter& createLayoutWriter(vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorSetLayoutBinding>& bindings);
+		//usesResource is called with the type and data of every descriptor of a set
+		void invalidateWhere(std::function<bool(vk::DescriptorType, const vw::DescriptorData&)> usesResource);
+		vk::DescriptorSet allocateSet(vk::DescriptorSetLayout layout, const LayoutWriter& writer, vk::DescriptorPool& pool);
+		void writeSet(LayoutWriter& writer, vk::DescriptorSet set, const std::vector<vw::DescriptorData>& data);
+
+		vw::Device& deviceRef;
+		uint32_t maximumAge;
+		uint32_t setsPerPool;
+		uint64_t frame = 0;
+		bool updateTemplates;
+		std::vector<vk::DescriptorPool> pools;
+		std::map<vk::DescriptorSetLayout, LayoutWriter> layoutWriters;
+		std::unordered_multimap<uint64_t, CachedSet> cachedSets;
+		vw::DescriptorSetCacheStatistics statistics;
+		uint64_t destructionListener;
+		std::mutex cacheMutex;
+	};
+
+	//One set holding every registered sampled image and storage buffer, shaders index the arrays with the returned slots
+	//With descriptor indexing the set is bound once and slots are written while it is in use, the arrays are partially bound
+	//Without it each frame has a copy of the set, written when the frame first gets it, and empty slots repeat a live descriptor
+	//Shaders then have to declare the arrays with the heap capacity and must not read an array before something is registered
+	class BindlessHeap
+	{
+	public:
+		static constexpr uint32_t imageBinding = 0;
+		static constexpr uint32_t bufferBinding = 1;
+
+		//Capacities are clamped to the per stage and per set descriptor limits of the device, together they stay within the per stage resource limit
+		BindlessHeap(vw::Device& device, uint32_t imageCapacity = 4096, uint32_t bufferCapacity = 4096, uint32_t frameCount = 2);
+		~BindlessHeap();
+		uint32_t addImage(vk::ImageView imageView, vk::Sampler sampler, vk::ImageLayout imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal);
+		//The view is created for aspectFlags and destroyed with the image
+		uint32_t addImage(vw::ImageBase& image, vk::Sampler sampler, vk::ImageAspectFlags aspectFlags = vk::ImageAspectFlagBits::eColor, vk::ImageLayout imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal);
+		uint32_t addBuffer(vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE);
+		//Slots are handed out again once every frame that could still read them has finished
+		void removeImage(uint32_t slot);
+		void removeBuffer(uint32_t slot);
+		//Call after waiting for the fence of the next frame slot, like DescriptorAllocator::nextFrame
+		void nextFrame();
+		vk::DescriptorSetLayout getSetLayout() { return setLayout; };
+		vk::DescriptorSet getSet();
+		void bind(vk::CommandBuffer cmdBuffer, vk::PipelineLayout pipelineLayout, uint32_t setIndex, vk::PipelineBindPoint bindPoint = vk::PipelineBindPoint::eGraphics);
+		bool usesDescriptorIndexing() { return descriptorIndexing; };
+		uint32_t getImageCapacity() { return images.capacity; };
+		uint32_t getBufferCapacity() { return buffers.capacity; };
+	private:
+		struct SlotArray
+		{
+			uint32_t binding;
+			vk::DescriptorType type;
+			uint32_t capacity;
+			std::vector<vw::DescriptorData> descriptors;
+			std::vector<bool> used;
+			std::vector<uint32_t> freeSlots;
+			uint32_t nextSlot = 0;
+			//Removed slots per frame slot, recycled when that frame slot comes around again
+			std::vector<std::vector<uint32_t>> retiredSlots;
+		};
+
+		//Slots of each array not yet written to a copy of the set, and the filler the copy holds in its empty slots
+		struct SetState
+		{
+			vk::DescriptorSet set;
+			std::map<uint32_t, std::set<uint32_t>> pendingSlots;
+			std::map<uint32_t, vw::DescriptorData> writtenFiller;
+			bool handedOut = false;
+		};
+
+		uint32_t addSlot(SlotArray& slots, const vw::DescriptorData& data);
+		void removeSlot(SlotArray& slots, uint32_t slot);
+		void markPending(SlotArray& slots, uint32_t slot);
+		void writeSet(SetState& setState);
+		void writeSlots(SetState& setState, SlotArray& slots);
+
+		vw::Device& deviceRef;
+		bool descriptorIndexing;
+		uint32_t frames;
+		uint32_t frameIndex = 0;
+		vk::DescriptorSetLayout setLayout;
+		vk::DescriptorPool pool;
+		std::vector<SetState> sets;
+		SlotArray images;
+		SlotArray buffers;
+		std::mutex heapMutex;
+	};
+
+	//Per draw bindings of one set recorded straight into the command buffer with VK_KHR_push_descriptor, no set is allocated
+	//Without the extension enabled on the device a set is taken from the frame's descriptor allocator, written and bound
+	class PushDescriptorSet
+	{
+	public:
+		PushDescriptorSet(vw::Device& device, std::vector<vk::DescriptorSetLayoutBinding> bindings);
+		//A pipeline layout may contain only one push descriptor set layout
+		vk::DescriptorSetLayout getSetLayout() { return setLayout; };
+		bool isPushed() { return pushDescriptorSet != nullptr; };
+		//The allocator is only used without push descriptors
+		void push(vk::CommandBuffer cmdBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipelineLayout, uint32_t setIndex, const vw::DescriptorSetBindings& bindings, vw::DescriptorAllocator& allocator);
+	private:
+		vw::Device& deviceRef;
+		std::vector<vk::DescriptorSetLayoutBinding> layoutBindings;
+		vk::DescriptorSetLayout setLayout;
+		PFN_vkCmdPushDescriptorSetKHR pushDescriptorSet = nullptr;
+	};
+}
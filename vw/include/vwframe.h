@@ -0,0 +1,63 @@
+#pragma once
+#include <chrono>
+#include "vwmemory.h"
+#include "vwdescriptor.h"
+
+namespace vw
+{
+	class FrameRing;
+
+	//Resources of one frame slot, reused once the GPU finished the frame last recorded in the slot
+	class FrameContext
+	{
+	public:
+		FrameContext(vw::Device& device, vw::FrameRing& ring, uint32_t index);
+		//Owned by the frame and kept alive until the slot is reused, the object is then reused for a buffer of the same family
+		vw::CommandBuffer& createCommandBuffer(uint32_t queueFamilyIndex, vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
+		vw::StagingRegion allocateTransient(vk::DeviceSize size, vk::DeviceSize alignment = 16);
+		//Freed wholesale when the slot is reused
+		vk::DescriptorSet allocateDescriptorSet(vk::DescriptorSetLayout layout);
+		//Must be signaled by the last submission of the frame, the slot is not waited on if it is never requested
+		vk::Fence getFence();
+		uint32_t getIndex() { return frameIndex; };
+		//Milliseconds the CPU waited for the slot before the frame could start
+		double getStallTime() { return stallTime; };
+
+		vw::Semaphore imageAcquired;
+		vw::Semaphore renderFinished;
+	private:
+		friend class vw::FrameRing;
+
+		vw::FrameRing& ringRef;
+		uint32_t frameIndex;
+		vw::Fence fence;
+		bool fencePending = false;
+		double stallTime = 0.0;
+		vw::InlineVector<vw::CommandBuffer, 16> commandBuffers;
+		size_t usedCommandBuffers = 0;
+	};
+
+	//Keeps up to frameCount frames in flight, beginFrame only waits for the fence of the slot being reused
+	class FrameRing
+	{
+	public:
+		FrameRing(vw::Device& device, uint32_t frameCount = 2, vk::DeviceSize transientSize = 4 * 1024 * 1024);
+		~FrameRing();
+		vw::FrameContext& beginFrame();
+		vw::FrameContext& getCurrentFrame();
+		uint32_t getFrameCount() { return (uint32_t)frames.size(); };
+		double getTotalStallTime() { return totalStallTime; };
+		//Waits for every frame in flight
+		void waitIdle();
+	private:
+		friend class vw::FrameContext;
+		void waitForFrame(vw::FrameContext& frame);
+
+		vw::Device& deviceRef;
+		vw::CommandBufferRecycler recycler;
+		vw::TransientBuffer transientBuffer;
+		vw::DescriptorAllocator descriptorAllocator;
+		std::vector<std::unique_ptr<vw::FrameContext>> frames;
+		double totalStallTime = 0.0;
+	};
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include "vkcore.h"
+#include "vwmemory.h"
+
+namespace vw
+{
+	//Shader stages of a pass follow from its type
+	enum PassType
+	{
+		graphicsPass,
+		computePass,
+		transferPass
+	};
+
+	//How a pass accesses a resource, the layout, stages and access masks follow from the usage and whether it is a read or a write
+	enum ResourceUsage
+	{
+		colorAttachment,
+		depthStencilAttachment,
+		sampledImage,
+		storageResource,
+		transferResource,
+		uniformBuffer,
+		vertexBuffer,
+		indexBuffer,
+		indirectBuffer
+	};
+
+	struct RenderGraphStatistics
+	{
+		uint32_t passCount = 0;
+		uint32_t culledPassCount = 0;
+		//vkCmdPipelineBarrier calls, one at most before each dependency level
+		uint32_t barrierBatches = 0;
+		uint32_t imageBarriers = 0;
+		uint32_t bufferBarriers = 0;
+	};
+
+	//Passes of one frame declare the resources they read and write, the graph culls passes nothing depends on,
+	//groups the rest into dependency levels and records one batched barrier before each level
+	//Build it once and rebind the per-frame images before every execute, the compiled graph and its scratch storage are reused
+	//Imported vw::ImageBase images start from their tracked layout at every execute
+	class RenderGraph
+	{
+	public:
+		typedef std::function<void(vk::CommandBuffer)> RecordFunction;
+
+		//The tracked layout of the image is used as the starting layout, it is updated before each pass using the image records
+		uint32_t importImage(vw::ImageBase& image, std::string name);
+		uint32_t importImage(vk::Image image, vk::ImageAspectFlags aspectFlags, vk::ImageLayout currentLayout, std::string name);
+		uint32_t importBuffer(vk::Buffer buffer, std::string name, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE);
+		//Replaces an imported image with one of the same aspects without compiling the graph again, e.g. the acquired swapchain image
+		void rebindImage(uint32_t resource, vw::ImageBase& image);
+		void rebindImage(uint32_t resource, vk::Image image, vk::ImageLayout currentLayout);
+		//Passes that only contribute to resources which are neither outputs nor read by kept passes are culled
+		//Images are transitioned to finalLayout after the last pass unless it is eUndefined
+		void setOutput(uint32_t resource, vk::ImageLayout finalLayout = vk::ImageLayout::eUndefined);
+		uint32_t addPass(std::string name, vw::PassType type, vw::RenderGraph::RecordFunction record);
+		void read(uint32_t pass, uint32_t resource, vw::ResourceUsage usage);
+		void write(uint32_t pass, uint32_t resource, vw::ResourceUsage usage);
+		//For passes with effects outside of their declared writes, they are never culled
+		void setSideEffect(uint32_t pass);
+		void execute(vk::CommandBuffer cmdBuffer);
+		void reset();
+		//Of the last execute
+		vw::RenderGraphStatistics getStatistics() { return statistics; };
+		//Graphviz graph of passes and resources, culled passes are dashed
+		std::string exportDot();
+	private:
+		struct Resource
+		{
+			std::string name;
+			vw::ImageBase* trackedImage = nullptr;
+			vk::Image image;
+			vk::ImageAspectFlags aspectFlags;
+			vk::ImageLayout initialLayout = vk::ImageLayout::eUndefined;
+			vk::Buffer buffer;
+			vk::DeviceSize offset = 0;
+			vk::DeviceSize size = VK_WHOLE_SIZE;
+			bool output = false;
+			vk::ImageLayout finalLayout = vk::ImageLayout::eUndefined;
+		};
+
+		struct Access
+		{
+			uint32_t resource;
+			vw::ResourceUsage usage;
+			bool read;
+			bool write;
+			vk::PipelineStageFlags stages;
+			vk::AccessFlags access;
+			vk::ImageLayout layout;
+		};
+
+		struct Pass
+		{
+			std::string name;
+			vw::PassType type;
+			vw::RenderGraph::RecordFunction record;
+			std::vector<Access> accesses;
+			bool sideEffect = false;
+			bool culled = false;
+			uint32_t level = 0;
+		};
+
+		//Synchronization state of a resource while the passes are walked in execution order
+		struct ResourceState
+		{
+			vk::ImageLayout layout;
+			vk::PipelineStageFlags writeStages;
+			vk::AccessFlags writeAccess;
+			vk::PipelineStageFlags readStages;
+			vk::PipelineStageFlags visibleStages;
+			vk::AccessFlags visibleAccess;
+		};
+
+		struct BarrierBatch
+		{
+			vk::PipelineStageFlags srcStages;
+			vk::PipelineStageFlags dstStages;
+			std::vector<vk::ImageMemoryBarrier> imageBarriers;
+			std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+		};
+
+		void addAccess(uint32_t pass, uint32_t resource, vw::ResourceUsage usage, bool write);
+		void compile();
+		void synchronize(ResourceState& state, const Access& access, BarrierBatch& batch);
+		void addBarrier(BarrierBatch& batch, uint32_t resource, vk::PipelineStageFlags srcStages, vk::AccessFlags srcAccess, vk::PipelineStageFlags dstStages, vk::AccessFlags dstAccess, vk::ImageLayout oldLayout, vk::ImageLayout newLayout);
+		void recordBatch(vk::CommandBuffer cmdBuffer, BarrierBatch& batch);
+
+		std::vector<Resource> resources;
+		std::vector<Pass> passes;
+		//Kept passes sorted by level, then by declaration
+		std::vector<uint32_t> executionOrder;
+		//Kept between executes so executing a compiled graph does not allocate
+		std::vector<ResourceState> states;
+		BarrierBatch levelBatch;
+		bool compiled = false;
+		vw::RenderGraphStatistics statistics;
+	};
+}
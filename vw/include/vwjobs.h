@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+namespace vw
+{
+	//Workers always take the highest priority task available
+	enum JobPriority
+	{
+		highPriority,
+		normalPriority,
+		lowPriority
+	};
+
+	//Fixed set of worker threads running queued tasks by priority, in submission order within a priority
+	class ThreadPool
+	{
+	public:
+		//threadCount 0 uses one worker per hardware thread except the calling one
+		ThreadPool(uint32_t threadCount = 0);
+		~ThreadPool();
+		//Exceptions thrown by the task are rethrown by the future
+		template<typename Task>
+		auto submit(Task&& task, vw::JobPriority priority = vw::normalPriority) -> std::future<decltype(task())>
+		{
+			auto packagedTask = std::make_shared<std::packaged_task<decltype(task())()>>(std::forward<Task>(task));
+			auto future = packagedTask->get_future();
+			enqueue([packagedTask]() { (*packagedTask)(); }, priority);
+			return future;
+		}
+		//Drops every task no worker has started yet, their futures report std::future_errc::broken_promise
+		void cancelPending();
+		uint32_t getThreadCount() { return (uint32_t)workers.size(); };
+	private:
+		void enqueue(std::function<void()> task, vw::JobPriority priority);
+		void workerLoop();
+		bool hasTasks();
+
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()>> tasks[3];
+		std::mutex queueMutex;
+		std::condition_variable queueCondition;
+		bool stopping = false;
+	};
+}
@@ -1,17 +1,81 @@
 #pragma once
+#include <map>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 #include "vkcore.h"
 namespace vw
 {
+	struct MemoryBlock
+	{
+		vk::DeviceMemory memory;
+		vk::DeviceSize size = 0;
+		void* mappedData = nullptr;
+		//Free ranges of the block, offset -> size
+		std::map<vk::DeviceSize, vk::DeviceSize> freeRanges;
+		uint32_t allocationCount = 0;
+		bool dedicated = false;
+	};
+
+	struct Allocation
+	{
+		vk::DeviceMemory memory;
+		vk::DeviceSize offset = 0;
+		vk::DeviceSize size = 0;
+		void* mappedData = nullptr;
+		uint32_t poolIndex = 0;
+		vw::MemoryBlock* block = nullptr;
+	};
+
+	struct MemoryStatistics
+	{
+		uint64_t allocationCount = 0;
+		uint64_t liveAllocationCount = 0;
+		uint32_t blockCount = 0;
+		uint32_t peakBlockCount = 0;
+		vk::DeviceSize usedBytes = 0;
+		vk::DeviceSize blockBytes = 0;
+	};
+
+	//Sub-allocates resources from large per-memory-type blocks instead of one vkAllocateMemory per resource
+	class MemoryAllocator
+	{
+	public:
+		MemoryAllocator(vk::Device device, vk::PhysicalDevice physicalDevice, vk::DeviceSize preferredBlockSize = 64 * 1024 * 1024);
+		~MemoryAllocator();
+		vw::Allocation allocate(vk::MemoryRequirements memoryRequirements, vk::MemoryPropertyFlags requiredProperties, bool linearResource);
+		void free(vw::Allocation& allocation);
+		vw::MemoryStatistics getStatistics();
+	private:
+		uint32_t findMemoryType(vk::MemoryRequirements memoryRequirements, vk::MemoryPropertyFlags requiredProperties);
+		std::unique_ptr<vw::MemoryBlock> createBlock(uint32_t memoryTypeIndex, vk::DeviceSize size, bool dedicated);
+		void destroyBlock(vw::MemoryBlock* block);
+		bool allocateFromBlock(vw::MemoryBlock* block, vk::MemoryRequirements memoryRequirements, vw::Allocation& allocation);
+
+		vk::Device deviceHandle;
+		vk::PhysicalDeviceMemoryProperties memoryProperties;
+		vk::DeviceSize bufferImageGranularity;
+		vk::DeviceSize preferredSize;
+		//Linear and optimal resources get separate pools when the device requires a buffer-image granularity
+		std::vector<std::vector<std::unique_ptr<vw::MemoryBlock>>> blockPools;
+		vw::MemoryStatistics statistics;
+		std::mutex allocatorMutex;
+	};
+
 	class Buffer : public vk::Buffer
 	{
 	public:
 		Buffer(vw::Device& device, vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags requiredProperties);
-		Buffer(vk::Device device, vk::PhysicalDevice physicalDevice, vk::DeviceSize size, vk::BufferUsageFlags usage, std::vector<uint32_t> queueFamilies, vk::MemoryPropertyFlags requiredProperties);
+		Buffer(vw::Device& device, vk::DeviceSize size, vk::BufferUsageFlags usage, std::vector<uint32_t> queueFamilies, vk::MemoryPropertyFlags requiredProperties);
 		~Buffer();
 	protected:
-		vk::DeviceMemory bufferMemory;
+		vw::Allocation bufferAllocation;
 		vk::DeviceSize bufferSize;
 		vk::Device deviceHandle;
+		vw::MemoryAllocator& allocatorRef;
+	private:
+		vw::Device& deviceRef;
 	};
 
 	class StagingBuffer : public vw::Buffer
@@ -19,12 +83,77 @@ namespace vw
 	public:
 		StagingBuffer(vw::Device& device, vk::DeviceSize size);
 		void loadData(void* data);
-		vw::CommandBuffer copyToBuffer(vk::Buffer dstBuffer, std::vector<vk::BufferCopy> regions);
-		vw::CommandBuffer copyToImage(vk::Image dstImage, std::vector<vk::BufferImageCopy> regions);
+		//Recorded on the transfer family, the next command buffer begun on dstQueueFamily after the submission acquires the destination
+		vw::CommandBuffer copyToBuffer(vk::Buffer dstBuffer, std::vector<vk::BufferCopy> regions, uint32_t dstQueueFamily);
+		//The aspects of the released range are taken from the regions
+		vw::CommandBuffer copyToImage(vk::Image dstImage, std::vector<vk::BufferImageCopy> regions, uint32_t dstQueueFamily);
 	private:
 		vw::Device& deviceRef;
 	};
 
+	struct StagingRegion
+	{
+		vk::Buffer buffer;
+		vk::DeviceSize offset = 0;
+		vk::DeviceSize size = 0;
+		void* data = nullptr;
+		//Staging ring segment the region belongs to, 0 for other buffers
+		uint64_t segment = 0;
+	};
+
+	//Persistently mapped upload heap, regions are grouped into segments per submission and recycled once that submission has finished
+	class StagingRing : public vw::Buffer
+	{
+	public:
+		StagingRing(vw::Device& device, vk::DeviceSize size);
+		//Segment 0 opens a new segment owned by the calling thread, further regions of the same submission pass region.segment
+		vw::StagingRegion allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16, uint64_t segment = 0);
+		//The regions of the segment are reused once future is ready, an empty future releases a segment that is never submitted
+		void releaseSegment(uint64_t segment, vw::GpuFuture future);
+		//Releases the segment with the next submission of cmdBuffer, or right away if it is destroyed without being submitted
+		void releaseSegment(uint64_t segment, vw::CommandBuffer& cmdBuffer);
+		void waitForSegment(uint64_t segment);
+		bool isSegmentRetired(uint64_t segment);
+	private:
+		struct Segment
+		{
+			//Allocations of the segment still occupying the ring
+			uint32_t allocationCount = 0;
+			bool released = false;
+			vw::GpuFuture future;
+			std::thread::id owner;
+		};
+		struct RingAllocation
+		{
+			vk::DeviceSize end;
+			vk::DeviceSize byteCount;
+			uint64_t segment;
+		};
+		void retireAllocation();
+		void retireCompleted();
+
+		//In ring order, the front is the oldest allocation
+		std::deque<RingAllocation> allocations;
+		std::map<uint64_t, Segment> segments;
+		vk::DeviceSize head = 0, tail = 0, usedBytes = 0;
+		uint64_t segmentCounter = 0;
+		std::mutex ringMutex;
+		std::condition_variable releaseCondition;
+	};
+
+	//Host visible buffer split into one linear region per frame slot, a region is rewound when its slot is reused
+	class TransientBuffer : public vw::Buffer
+	{
+	public:
+		TransientBuffer(vw::Device& device, vk::DeviceSize frameSize, uint32_t frameCount, vk::BufferUsageFlags usage);
+		vw::StagingRegion allocate(uint32_t frameIndex, vk::DeviceSize size, vk::DeviceSize alignment = 16);
+		//Only valid once the GPU finished reading the frame's allocations
+		void reset(uint32_t frameIndex);
+	private:
+		vk::DeviceSize regionSize;
+		std::vector<vk::DeviceSize> regionHeads;
+	};
+
 	enum BufferStagingMode
 	{
 		DymanicStaging,
@@ -35,12 +164,30 @@ namespace vw
 	{
 	public:
 		VertexBuffer(vw::Device& device, vk::DeviceSize size);
-		vw::CommandBuffer loadData(void* data, std::vector<vk::BufferCopy> regions);
+		vw::CommandBuffer loadData(void* data, std::vector<vk::BufferCopy> regions, uint32_t dstQueueFamily);
+	private:
+		vw::Device& deviceRef;
+	};
+
+	//Shader read/write buffer, device local buffers are filled through the staging ring and released to dstQueueFamily
+	class StorageBuffer : public vw::Buffer
+	{
+	public:
+		StorageBuffer(vw::Device& device, vk::DeviceSize size, vk::MemoryPropertyFlags requiredProperties = vk::MemoryPropertyFlagBits::eDeviceLocal);
+		vw::CommandBuffer loadData(void* data, std::vector<vk::BufferCopy> regions, uint32_t dstQueueFamily);
+		//Only for host visible buffers
+		void* getMappedData();
+		vk::DeviceSize getSize() { return bufferSize; };
 	private:
-		std::unique_ptr<vw::StagingBuffer> stagingBuffer;
 		vw::Device& deviceRef;
 	};
 
+	//Access and stages an image in the layout is typically used with, for transitions without more specific usage information
+	vk::AccessFlags getLayoutAccessFlags(vk::ImageLayout layout);
+	vk::PipelineStageFlags getLayoutStageFlags(vk::ImageLayout layout);
+	//Depth and stencil aspects for depth/stencil formats, color otherwise
+	vk::ImageAspectFlags getFormatAspectFlags(vk::Format format);
+
 	class ImageBase
 	{
 	public:
@@ -48,9 +195,17 @@ namespace vw
 		~ImageBase();
 		operator vk::Image();
 		vk::Format getFormat();
-		vw::CommandBuffer transitionLayout(vk::ImageLayout newLayout);
+		//Recorded on queueFamilyIndex, the image has to be owned by that family
+		vw::CommandBuffer transitionLayout(vk::ImageLayout newLayout, uint32_t queueFamilyIndex);
 		void transitionLayout(vk::CommandBuffer cmdBuffer, vk::ImageLayout newLayout);
+		//Builds the barrier for a transition recorded elsewhere and advances the tracked layout
+		vk::ImageMemoryBarrier createLayoutBarrier(vk::ImageLayout newLayout, vk::PipelineStageFlags& srcStages, vk::PipelineStageFlags& dstStages);
+		vk::ImageMemoryBarrier createOwnershipBarrier();
 		vk::ImageView createView(vk::ImageAspectFlags aspectFlags);
+		vk::ImageAspectFlags getAspectFlags();
+		vk::ImageLayout getLayout() { return currentLayout; };
+		//For transitions recorded without createLayoutBarrier, e.g. by a render graph
+		void setLayout(vk::ImageLayout layout) { currentLayout = layout; };
 	protected:
 		void createImage();
 		
@@ -63,7 +218,7 @@ namespace vw
 		vw::Device& deviceRef;
 	private:
 		vk::Image image;
-		vk::DeviceMemory imageMemory;
+		vw::Allocation imageAllocation;
 		std::vector<vk::ImageView> imageViews;
 	};
 
@@ -72,13 +227,14 @@ namespace vw
 	{
 	public:
 		TransferSrc(vw::Device& device);
-		void copyToImage(vk::CommandBuffer cmdBuffer, vk::Image dstImage, vk::ImageLayout dstLayout, std::vector<vk::ImageCopy> regions);
+		void copyToImage(vk::CommandBuffer cmdBuffer, vk::Image dstImage, vk::ImageLayout dstLayout, vk::ArrayProxy<const vk::ImageCopy> regions);
 	};
 
 	class TransferDst : public virtual ImageBase
 	{
 	public:
 		TransferDst(vw::Device& device);
+		vw::CommandBuffer loadData(void* data, vk::DeviceSize size, uint32_t dstQueueFamily);
 	};
 
 	class ColorAttachment : public virtual ImageBase
@@ -26,9 +26,9 @@ namespace vw
 	class Swapchain
 	{
 	public:
-		Swapchain(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface);
-		void present(uint32_t imageIndex, std::vector<vk::Semaphore> waitConditions);
-		void presentAndSync(uint32_t imageIndex, std::vector<vk::Semaphore> waitConditions);
+		Swapchain(vw::Device& device, vk::SurfaceKHR surface);
+		//Frames are throttled by the fences of their frame ring slots, presenting never waits for the queue
+		void present(uint32_t imageIndex, vk::ArrayProxy<const vk::Semaphore> waitConditions);
 		vk::Extent2D getExtent();
 		vk::Format getImageFormat();
 		vk::Image getImage(uint32_t index);
@@ -42,7 +42,8 @@ namespace vw
 		std::vector<vk::ImageView> swapchainImageViews;
 
 		vk::Device deviceHandle;
-		vk::Queue presentQueue;
+		vw::Device& deviceRef;
+		uint32_t presentQueueFamily;
 		vk::SurfaceCapabilitiesKHR surfaceCapabilities;
 		vk::SurfaceFormatKHR selectedFormat;
 		vk::PresentModeKHR selectedMode;
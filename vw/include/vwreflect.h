@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <vulkan\vulkan.hpp>
+
+namespace vw
+{
+	class Shader;
+
+	struct ReflectedBinding
+	{
+		uint32_t set;
+		uint32_t binding;
+		vk::DescriptorType descriptorType;
+		//0 for runtime sized arrays
+		uint32_t descriptorCount;
+		vk::ShaderStageFlags stageFlags;
+		//False if the descriptor type or array length is not known to reflection, the set layout has to be given explicitly then
+		bool derivable = true;
+	};
+
+	struct ReflectedVertexInput
+	{
+		uint32_t location;
+		//eUndefined if the input has no single attribute format, e.g. matrices and arrays, the vertex input state has to be given explicitly then
+		vk::Format format;
+		uint32_t size;
+	};
+
+	//Interface of a SPIR-V module, only the subset needed to build pipeline and descriptor set layouts
+	//Valid modules always reflect, what can not be derived is marked and only an error once a pipeline relies on it
+	struct ShaderReflection
+	{
+		vk::ShaderStageFlags stageFlags;
+		std::vector<vw::ReflectedBinding> bindings;
+		//Bytes of push constant block used by the stage, 0 if it has none
+		uint32_t pushConstantSize = 0;
+		vk::ShaderStageFlags pushConstantStages;
+		//Sorted by location, only filled in for vertex shaders
+		std::vector<vw::ReflectedVertexInput> vertexInputs;
+		//Workgroup size of compute shaders, sizes given by spec constants hold the default value
+		uint32_t localSize[3] = { 1, 1, 1 };
+		//Spec constant id of each workgroup size component, ~0u if the component is fixed
+		uint32_t localSizeSpecIds[3] = { ~0u, ~0u, ~0u };
+	};
+
+	vw::ShaderReflection reflectSpirv(const uint32_t* code, size_t wordCount, vk::ShaderStageFlagBits stage);
+	//Bindings used by several stages are combined, push constants become a single range visible to every stage using them
+	vw::ShaderReflection mergeReflections(const std::vector<vw::ShaderReflection>& reflections);
+
+	//Deduplicates identical descriptor set and pipeline layouts of a device, layouts live as long as the cache
+	class LayoutCache
+	{
+	public:
+		LayoutCache(vk::Device device);
+		~LayoutCache();
+		vk::DescriptorSetLayout getSetLayout(std::vector<vk::DescriptorSetLayoutBinding> bindings, vk::DescriptorSetLayoutCreateFlags flags = vk::DescriptorSetLayoutCreateFlags());
+		//nullptr for layouts not created by the cache, the bindings live as long as the cache
+		const std::vector<vk::DescriptorSetLayoutBinding>* getBindings(vk::DescriptorSetLayout layout);
+		vk::PipelineLayout getPipelineLayout(const std::vector<vk::DescriptorSetLayout>& setLayouts, const std::vector<vk::PushConstantRange>& pushConstants);
+		//Layout derived from the merged reflection of the shaders, sets missing between used ones are empty
+		//Sets in setLayouts use the given layout instead of the reflected bindings, e.g. runtime sized bindless arrays
+		vk::PipelineLayout getPipelineLayout(const vw::ShaderReflection& reflection, const std::map<uint32_t, vk::DescriptorSetLayout>& setLayouts = {});
+		vk::PipelineLayout getPipelineLayout(std::vector<std::reference_wrapper<vw::Shader>> shaders);
+		//nullptr for layouts not created by the cache
+		const std::vector<vk::PushConstantRange>* getPushConstantRanges(vk::PipelineLayout layout);
+	private:
+		vk::Device deviceHandle;
+		std::map<std::vector<uint64_t>, vk::DescriptorSetLayout> setLayouts;
+		std::map<std::vector<uint64_t>, vk::PipelineLayout> pipelineLayouts;
+		std::map<vk::DescriptorSetLayout, std::vector<vk::DescriptorSetLayoutBinding>> setLayoutBindings;
+		std::map<vk::PipelineLayout, std::vector<vk::PushConstantRange>> pushConstantRanges;
+		std::mutex cacheMutex;
+	};
+}
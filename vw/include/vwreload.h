@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <string>
+#include <chrono>
+#include <filesystem>
+#include "vwrender.h"
+
+namespace vw
+{
+	class ComputePipeline;
+
+	//Recompiles watched shaders when their source or a file it included changes and rebuilds the pipelines of dependent render passes and compute pipelines
+	//Uses inotify on Linux and polls modification times elsewhere, files are known to be included once the shader has compiled
+	//framesInFlight updates after pipelines were swapped, pipelines nobody retains are evicted from the device pipeline cache
+	//down to the retainedPipelines most recently requested ones, replaced compute pipelines are destroyed
+	class ShaderWatcher
+	{
+	public:
+		ShaderWatcher(vw::Device& device, uint32_t framesInFlight, size_t retainedPipelines = 64, std::chrono::milliseconds pollInterval = std::chrono::milliseconds(500));
+		~ShaderWatcher();
+		void watch(vw::Shader& shader);
+		void unwatch(vw::Shader& shader);
+		void addDependent(vw::RenderPass& renderPass);
+		void removeDependent(vw::RenderPass& renderPass);
+		void addDependent(vw::ComputePipeline& computePipeline);
+		void removeDependent(vw::ComputePipeline& computePipeline);
+		//Call at a frame boundary, never waits for compilation or pipeline creation
+		void update();
+	private:
+		struct WatchedFile
+		{
+			std::filesystem::path path;
+			std::filesystem::file_time_type lastWrite;
+		};
+
+		struct WatchedShader
+		{
+			vw::Shader* shader;
+			//The source followed by the files it included when it was last compiled
+			std::vector<WatchedFile> files;
+			bool includesKnown = false;
+		};
+
+		void watchFile(WatchedShader& watched, const std::filesystem::path& path);
+		void updateIncludes(WatchedShader& watched);
+		std::vector<std::filesystem::path> findChangedFiles();
+
+		std::vector<WatchedShader> shaders;
+		std::vector<vw::Shader*> reloadingShaders;
+		std::vector<vw::RenderPass*> dependents;
+		std::vector<vw::ComputePipeline*> computeDependents;
+		std::chrono::milliseconds interval;
+		std::chrono::steady_clock::time_point lastPoll;
+		vw::Device& deviceRef;
+		uint32_t evictionDelay;
+		size_t retainedLimit;
+		//Updates left until replaced pipelines are no longer in flight, 0 if nothing waits for eviction
+		uint32_t updatesUntilEviction = 0;
+		int notifyHandle = -1;
+		std::map<int, std::filesystem::path> watchedDirectories;
+	};
+}
@@ -2,10 +2,16 @@
 #include<vulkan\vulkan.hpp>
 #include <map>
 #include <memory>
+#include <future>
+#include <unordered_map>
 #include "vwshader.h"
+#include "vwutils.h"
 
 namespace vw
 {
+	class Device;
+	class RenderPass;
+
 	static std::map<vk::AccessFlagBits, vk::PipelineStageFlagBits> mapAccessStage =
 	{
 		{vk::AccessFlagBits::eColorAttachmentWrite, vk::PipelineStageFlagBits::eColorAttachmentOutput},
@@ -30,7 +36,7 @@ namespace vw
 	public:
 		Framebuffer(vk::Device device, vk::RenderPass renderPass, vk::Extent2D dimensions, std::vector<vk::ImageView> attachments);
 		~Framebuffer();
-		void beginRenderPass(vk::CommandBuffer commandBuffer, std::vector<vk::ClearValue> clearValues, bool firstSubpassInline);
+		void beginRenderPass(vk::CommandBuffer commandBuffer, vk::ArrayProxy<const vk::ClearValue> clearValues, bool firstSubpassInline);
 	private:
 		vk::Framebuffer framebuffer;
 		vk::RenderPass renderPassHandle;
@@ -38,6 +44,12 @@ namespace vw
 		vk::Device deviceHandle;
 	};
 
+	struct SpecializationData
+	{
+		std::vector<vk::SpecializationMapEntry> entries;
+		std::vector<uint8_t> data;
+	};
+
 	struct GraphicsPipelineSettings
 	{
 	public:
@@ -47,6 +59,20 @@ namespace vw
 		void addShaderStages(std::vector<std::reference_wrapper<vw::Shader>> shaders);
 		void setBlendModes(std::vector<vw::BlendMode> blendModes);
 		void setLayout(vk::PipelineLayout pipelineLayout);
+		//Setting a constant id again replaces its value
+		void setSpecializationConstant(vk::ShaderStageFlagBits stage, uint32_t constantId, const void* value, size_t size);
+		template<typename T>
+		void setSpecializationConstant(vk::ShaderStageFlagBits stage, uint32_t constantId, T value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Specialization constants must be trivially copyable");
+			setSpecializationConstant(stage, constantId, &value, sizeof(T));
+		}
+		//SPIR-V booleans are 32 bit
+		void setSpecializationConstant(vk::ShaderStageFlagBits stage, uint32_t constantId, bool value);
+		//Used for the set instead of its reflected bindings when the layout is derived from the shaders
+		void setDescriptorSetLayout(uint32_t setIndex, vk::DescriptorSetLayout setLayout);
+		//Covers every state that affects the created pipeline, blocks until the shaders are compiled
+		std::vector<uint8_t> getKey();
 
 		vk::GraphicsPipelineCreateInfo pipelineCreateInfo;
 		std::vector<std::reference_wrapper<vw::Shader>> shaderStages;
@@ -71,17 +97,53 @@ namespace vw
 		vk::PipelineDynamicStateCreateInfo dynamicStateInfo;
 
 		std::vector<vk::DynamicState> dynamicStates;
+
+		std::map<vk::ShaderStageFlagBits, vw::SpecializationData> specializations;
+		std::map<uint32_t, vk::DescriptorSetLayout> descriptorSetLayouts;
 	};
 
+	//Throws unless every byte of the update is covered by ranges of exactly the given stages, as vkCmdPushConstants requires
+	void validatePushConstants(const std::vector<vk::PushConstantRange>& ranges, vk::ShaderStageFlags stages, uint32_t offset, uint32_t size);
+
 	class PipelineLayout
 	{
 	public:
 		PipelineLayout(vk::Device device, std::vector<vk::DescriptorSetLayout> setLayouts, std::vector<vk::PushConstantRange> pushConstants);
 		~PipelineLayout();
 		operator vk::PipelineLayout();
+		vk::DescriptorSetLayout getSetLayout(uint32_t setIndex) { return descriptorSetLayouts.at(setIndex); };
+		const std::vector<vk::PushConstantRange>& getPushConstantRanges() { return pushConstantRanges; };
+		//Validated against the ranges of the layout before recording
+		void pushConstants(vk::CommandBuffer cmdBuffer, vk::ShaderStageFlags stages, uint32_t offset, uint32_t size, const void* data);
 	private:
 		vk::Device deviceHandle;
 		vk::PipelineLayout layout;
+		std::vector<vk::DescriptorSetLayout> descriptorSetLayouts;
+		std::vector<vk::PushConstantRange> pushConstantRanges;
+	};
+
+	//Push constants of type T at a fixed offset, validated against the layout once so recording only copies the data
+	template<typename T>
+	class PushConstantBlock
+	{
+	public:
+		PushConstantBlock(vw::PipelineLayout& layout, vk::ShaderStageFlags stages, uint32_t offset = 0) : PushConstantBlock(layout, layout.getPushConstantRanges(), stages, offset) {}
+		//For layouts from the layout cache or created elsewhere
+		PushConstantBlock(vk::PipelineLayout layout, const std::vector<vk::PushConstantRange>& ranges, vk::ShaderStageFlags stages, uint32_t offset = 0) : pipelineLayout(layout), stageFlags(stages), blockOffset(offset)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Push constants must be trivially copyable");
+			static_assert(sizeof(T) % 4 == 0, "Push constant blocks must be a multiple of 4 bytes");
+			vw::validatePushConstants(ranges, stages, offset, sizeof(T));
+		}
+		void push(vk::CommandBuffer cmdBuffer, const T& data)
+		{
+			cmdBuffer.pushConstants(pipelineLayout, stageFlags, blockOffset, sizeof(T), &data);
+		}
+		vk::PipelineLayout getLayout() { return pipelineLayout; };
+	private:
+		vk::PipelineLayout pipelineLayout;
+		vk::ShaderStageFlags stageFlags;
+		uint32_t blockOffset;
 	};
 
 	
@@ -109,17 +171,90 @@ namespace vw
 	class RenderPass
 	{
 	public:
-		RenderPass(vk::Device device, std::vector<vk::Format> attachmentFormats, std::vector<vk::ImageLayout> attachmentOutputLayouts, std::vector<vw::SubpassDescription> subpasses);
+		RenderPass(vw::Device& device, std::vector<vk::Format> attachmentFormats, std::vector<vk::ImageLayout> attachmentOutputLayouts, std::vector<vw::SubpassDescription> subpasses);
 		~RenderPass();
 		operator vk::RenderPass() { return renderPass; };
+		//Blocks until the pipeline of the subpass has been created
 		vk::Pipeline getSubpassPipeline(uint32_t subpassIndex);
+		std::shared_future<vk::Pipeline> getSubpassPipelineFuture(uint32_t subpassIndex);
+		//Layout the pipeline was created with, derived from shader reflection unless the settings provided one
+		vk::PipelineLayout getSubpassLayout(uint32_t subpassIndex);
+		//Pipeline of the subpass for different settings, e.g. other specialization constants
+		//Created once per distinct state as a derivative of the subpass pipeline, not retained so PipelineCache::evictUnused may destroy it
+		vk::Pipeline getPipelineVariant(uint32_t subpassIndex, vw::GraphicsPipelineSettings& settings);
+		void waitForPipelines();
+		//Equal for render passes whose pipelines are interchangeable
+		uint64_t getCompatibilityHash() { return compatibilityHash; };
+		const std::vector<uint8_t>& getCompatibilityKey() { return compatibilityKey; };
+		//Recreates the subpass pipelines using the shader in the background, returns whether any subpass uses it
+		bool rebuildPipelines(vw::Shader& shader);
+		//Never blocks, replaces subpass pipelines whose rebuild has finished and returns whether it did, call at a frame boundary
+		bool swapPipelines();
 	private:
+		//Pipeline creation task of a subpass, the layout is only written by that task
+		struct PipelineTask
+		{
+			std::shared_future<vk::Pipeline> pipeline;
+			std::shared_ptr<vk::PipelineLayout> layout;
+		};
+
 		void createPipelines(std::vector<vw::GraphicsPipelineSettings*>& pipelineSettings);
+		PipelineTask startPipelineTask(uint32_t subpassIndex);
+		vk::Pipeline retainPipeline(vw::GraphicsPipelineSettings& settings, uint32_t subpassIndex, vk::PipelineLayout* layout);
+		void releasePipeline(std::shared_future<vk::Pipeline>& pipeline);
 		vk::RenderPass renderPass; 
 		uint32_t subpassCount;
-		std::vector<vk::Pipeline> pipelines;
-		vk::PipelineLayout emptyLayout;
+		uint64_t compatibilityHash;
+		std::vector<uint8_t> compatibilityKey;
+		std::vector<std::shared_ptr<vw::GraphicsPipelineSettings>> subpassSettings;
+		std::vector<std::shared_future<vk::Pipeline>> pipelines;
+		std::vector<std::shared_ptr<vk::PipelineLayout>> subpassLayouts;
+		//Latest rebuild per subpass, only its result is ever swapped in
+		std::vector<PipelineTask> rebuilds;
+		//Superseded rebuilds still refer to the render pass until they finish, their pipelines are released unused
+		std::vector<std::shared_future<vk::Pipeline>> supersededRebuilds;
 		vk::Device deviceHandle;
+		vw::Device& deviceRef;
+	};
+
+	//Pipelines of a device keyed by the full settings key, render pass compatibility key and subpass
+	//Requesting a state that is being created by another thread waits for it instead of creating it twice
+	class PipelineCache
+	{
+	public:
+		PipelineCache(vw::Device& device);
+		~PipelineCache();
+		vk::Pipeline getPipeline(vw::GraphicsPipelineSettings& settings, vw::RenderPass& renderPass, uint32_t subpassIndex, vk::Pipeline basePipeline = nullptr, vk::PipelineLayout* layout = nullptr);
+		//Retained pipelines are never evicted, every retain must be matched by a release
+		void retain(vk::Pipeline pipeline);
+		void release(vk::Pipeline pipeline);
+		//Destroys pipelines nobody retains, least recently requested first, until at most retainedLimit of them are left
+		//The device must not use any of the destroyed pipelines anymore, they are created again on the next request
+		void evictUnused(size_t retainedLimit = 0);
+		size_t getPipelineCount();
+		//The device must not use any of the pipelines anymore, waits for pipelines still in creation
+		void clear();
+	private:
+		struct CachedPipeline
+		{
+			vk::Pipeline pipeline;
+			vk::PipelineLayout layout;
+		};
+
+		struct CacheEntry
+		{
+			std::shared_future<CachedPipeline> pipeline;
+			uint32_t references = 0;
+			uint64_t lastUse = 0;
+		};
+
+		CachedPipeline createPipeline(vw::GraphicsPipelineSettings& settings, vk::RenderPass renderPass, uint32_t subpassIndex, vk::Pipeline basePipeline);
+
+		std::map<std::vector<uint8_t>, CacheEntry> cachedPipelines;
+		std::map<vk::Pipeline, std::vector<uint8_t>> pipelineKeys;
+		uint64_t nextUse = 0;
+		std::mutex cacheMutex;
+		vw::Device& deviceRef;
 	};
 }
 
@@ -1,44 +1,181 @@
 #pragma once
 #include <string>
-#include <thread>
+#include <mutex>
+#include <atomic>
+#include <future>
 #include <fstream>
 #include <map>
 #include <iostream>
+#include <functional>
 #include <vulkan\vulkan.hpp>
 #include <shaderc\shaderc.hpp>
+#include "vwjobs.h"
+#include "vwreflect.h"
 
 namespace vw
 {
-	
+	class Device;
+
 	static std::map<vk::ShaderStageFlagBits, shaderc_shader_kind >mapShaderStage =
 	{
 		{vk::ShaderStageFlagBits::eVertex, shaderc_shader_kind::shaderc_glsl_vertex_shader},
-		{vk::ShaderStageFlagBits::eFragment, shaderc_shader_kind::shaderc_glsl_fragment_shader}
+		{vk::ShaderStageFlagBits::eFragment, shaderc_shader_kind::shaderc_glsl_fragment_shader},
+		{vk::ShaderStageFlagBits::eCompute, shaderc_shader_kind::shaderc_glsl_compute_shader}
+	};
+
+	struct SpirvCacheEvent
+	{
+		std::string sourcePath;
+		bool hit;
+		//Milliseconds spent compiling, on a hit the time recorded when the entry was stored
+		double compileTime;
+		//Milliseconds spent reading the entry on a hit
+		double loadTime;
+	};
+
+	//Everything passed to shaderc for GLSL, the cache key is derived from it
+	struct GlslOptions
+	{
+		shaderc_optimization_level optimization = shaderc_optimization_level::shaderc_optimization_level_size;
+		bool debugInfo = false;
+		std::map<std::string, std::string> macros;
+		//Searched for #include <...>, #include "..." is looked up next to the including file first
+		std::vector<std::string> includeDirectories;
 	};
 
+	struct SpirvCacheStatistics
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		double compileTime = 0.0;
+		double savedTime = 0.0;
+	};
+
+	//On-disk SPIR-V store keyed by a hash of the preprocessed source, included files, shader kind, compile options and compiler version
+	class SpirvCache
+	{
+	public:
+		static vw::SpirvCache& getDefault();
+		//An empty directory disables the cache
+		void setDirectory(std::string directory);
+		//Called once per GLSL shader from the compiling thread
+		void setInstrumentationHook(std::function<void(const vw::SpirvCacheEvent&)> hook);
+		//includedFiles receives the resolved path of every file included by the source, once each
+		std::vector<uint32_t> compileGlsl(shaderc::Compiler& compiler, const std::vector<char>& source, shaderc_shader_kind shaderKind, const std::string& sourcePath, const vw::GlslOptions& glslOptions = vw::GlslOptions(), std::vector<std::string>* includedFiles = nullptr);
+		vw::SpirvCacheStatistics getStatistics();
+	private:
+		SpirvCache() = default;
+		std::vector<uint32_t> loadOrCompile(shaderc::Compiler& compiler, const std::string& preprocessedSource, shaderc_shader_kind shaderKind, const std::string& sourcePath, const shaderc::CompileOptions& options, const std::string& entryPath);
+		bool load(const std::string& entryPath, std::vector<uint32_t>& spirv, uint32_t& compileMicroseconds);
+		void store(const std::string& entryPath, const std::vector<uint32_t>& spirv, uint32_t compileMicroseconds);
+		void report(const vw::SpirvCacheEvent& cacheEvent);
+		uint64_t getCompilerKey(shaderc::Compiler& compiler);
+
+		std::string cacheDirectory = "vw_spirv_cache";
+		std::function<void(const vw::SpirvCacheEvent&)> instrumentationHook;
+		vw::SpirvCacheStatistics statistics;
+		//Compilations in progress by key, concurrent requests for the same key wait for them instead of compiling again
+		std::map<uint64_t, std::shared_future<std::vector<uint32_t>>> compilations;
+		std::once_flag compilerKeyComputed;
+		uint64_t compilerKey = 0;
+		std::mutex cacheMutex;
+	};
+
+	//Shares one shader module between all users of identical SPIR-V on the device, a hash hit is confirmed by comparing the code
+	//Unreferenced modules are kept for reuse up to the retained limit, least recently released destroyed first
+	class ShaderModuleRegistry
+	{
+	public:
+		ShaderModuleRegistry(vk::Device device);
+		//Destroys every module, shaders must not outlive the device
+		~ShaderModuleRegistry();
+		//Every acquire must be matched by a release of the returned module
+		vk::ShaderModule acquire(const uint32_t* code, size_t codeSize);
+		void release(vk::ShaderModule module);
+		void setRetainedLimit(size_t moduleCount);
+		size_t getModuleCount();
+	private:
+		typedef std::pair<uint64_t, size_t> ModuleKey;
+		struct ModuleEntry
+		{
+			//Threads acquiring a module still being created wait for it instead of creating it twice
+			std::shared_future<vk::ShaderModule> module;
+			std::vector<uint32_t> code;
+			uint32_t references;
+			uint64_t releaseSerial;
+		};
+		typedef std::multimap<ModuleKey, ModuleEntry> ModuleMap;
+
+		void evictOverLimit();
+
+		vk::Device deviceHandle;
+		//Colliding hashes of different code get entries of their own
+		ModuleMap modules;
+		std::map<vk::ShaderModule, ModuleMap::iterator> moduleKeys;
+		size_t retainedLimit = 64;
+		size_t retainedCount = 0;
+		uint64_t nextReleaseSerial = 0;
+		std::mutex registryMutex;
+	};
+
+	//Compilation job run by the thread pool of the device, or by the first thread waiting on it if no worker has picked it up yet
 	class ShaderCompiler
 	{
 	public:
-		ShaderCompiler(vk::Device device, std::string sourcePath, shaderc_shader_kind shaderKind);
+		ShaderCompiler(vw::Device& device, std::string sourcePath, vk::ShaderStageFlagBits shaderStage);
 		~ShaderCompiler();
+		void run();
+		//A job not started yet never compiles, waiting on it throws
+		void cancel();
+		//Rethrows the error of a failed compilation
+		void waitUntilReady();
+		bool isReady();
 	
 		vk::ShaderModule module;
-		std::thread compileThread;
+		vw::ShaderReflection reflection;
+		//Hash of the SPIR-V the module was created from, identifies the module unlike its handle
+		uint64_t codeHash = 0;
+		std::vector<std::string> includedFiles;
 	private:
-		void compile(std::string sourcePath, shaderc_shader_kind shaderKind);
-		vk::Device deviceHandle;
+		void compile();
+		vw::ShaderModuleRegistry& registryRef;
+		std::string path;
+		vk::ShaderStageFlagBits stage;
+		std::atomic<bool> started{ false };
+		std::promise<void> completion;
+		std::shared_future<void> completed;
 	};
 	
 	class Shader
 	{
 	public:
-		Shader(vk::Device device, vk::ShaderStageFlagBits shaderStage, std::string sourcePath);
-		inline bool isReady() { return compiler->compileThread.joinable(); };
+		//highPriority for shaders needed this frame, lowPriority for prefetching
+		Shader(vw::Device& device, vk::ShaderStageFlagBits shaderStage, std::string sourcePath, vw::JobPriority priority = vw::normalPriority);
+		//Compilations still queued are cancelled
+		~Shader();
+		inline bool isReady() { return std::atomic_load(&compiler)->isReady(); };
 		void waitUntilReady();
 		vk::PipelineShaderStageCreateInfo getShaderStageInfo();
+		//Blocks until the shader is compiled
+		vw::ShaderReflection getReflection();
+		//Blocks until the shader is compiled, equal for shaders with identical SPIR-V
+		uint64_t getCodeHash();
+		//Blocks until the shader is compiled, files included by the GLSL source of the current module
+		std::vector<std::string> getIncludedFiles();
+		//Compiles the source again in the background, the current module stays in use until the reload is applied
+		void reload(vw::JobPriority priority = vw::highPriority);
+		//Never blocks, swaps in the reloaded module once it is compiled and returns whether it did
+		//A failed compilation is rethrown and the current module is kept
+		bool applyReload();
+		const std::string& getSourcePath() { return path; };
 	private:
+		void startCompile(vw::JobPriority priority, std::shared_ptr<ShaderCompiler>& target);
+
 		std::shared_ptr<ShaderCompiler> compiler;
+		std::shared_ptr<ShaderCompiler> reloadCompiler;
 		vk::PipelineShaderStageCreateInfo stageCreateInfo;
+		vw::Device& deviceRef;
+		std::string path;
 	};
 	
 	/*
@@ -0,0 +1,60 @@
+#pragma once
+#include "vwmemory.h"
+
+namespace vw
+{
+	//Accumulates copies and layout transitions and submits them as a single command buffer with a single fence
+	//Work is recorded on the transfer family, written resources are released to dstQueueFamily
+	class UploadBatch
+	{
+	public:
+		UploadBatch(vw::Device& device, uint32_t dstQueueFamily);
+		~UploadBatch();
+		void copyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::BufferCopy region);
+		void copyBufferToImage(vk::Buffer srcBuffer, vk::Image dstImage, vk::BufferImageCopy region);
+		void transitionLayout(vw::ImageBase& image, vk::ImageLayout newLayout);
+		//Stages data through the device staging ring
+		void loadBuffer(vk::Buffer dstBuffer, vk::DeviceSize dstOffset, void* data, vk::DeviceSize size);
+		void loadImage(vw::ImageBase& image, uint32_t width, uint32_t height, void* data, vk::DeviceSize size);
+		//The written resources are acquired by the next command buffer begun on the destination family
+		//Transitions ahead of the first copy of their image share one barrier before all copies, the others one barrier after them
+		vw::GpuFuture flush();
+		void wait();
+		bool isComplete();
+		inline bool empty() { return commands.empty(); };
+	private:
+		enum CommandType
+		{
+			BufferCopy,
+			ImageCopy,
+			LayoutBarrier
+		};
+
+		struct Command
+		{
+			CommandType type;
+			vk::Buffer srcBuffer;
+			vk::Buffer dstBuffer;
+			vk::Image dstImage;
+			size_t first;
+			uint32_t count;
+			vk::PipelineStageFlags srcStages;
+			vk::PipelineStageFlags dstStages;
+		};
+
+		bool recordHoisted();
+		void recordInOrder();
+		void releaseOwnership(uint32_t transferFamily);
+
+		std::vector<Command> commands;
+		std::vector<vk::BufferCopy> bufferCopies;
+		std::vector<vk::BufferImageCopy> imageCopies;
+		std::vector<vk::ImageMemoryBarrier> imageBarriers;
+
+		std::unique_ptr<vw::CommandBuffer> cmdBuffer;
+		//Staging ring segment of the loads since the last flush, released with the command buffer of the flush
+		uint64_t stagingSegment = 0;
+		uint32_t dstFamily;
+		vw::Device& deviceRef;
+	};
+}
@@ -1,4 +1,9 @@
 #pragma once
+#include <new>
+#include <type_traits>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
 
 
 template<typename T>
@@ -30,3 +35,103 @@ std::vector<T> VwiEnumerate(std::function <VkResult(R, S, uint32_t*, T*)> enumer
 	enumerationFunction(firstArg, secondArg, &count, result.data());
 	return result;
 }
+
+namespace vw
+{
+	//FNV-1a, pass the previous hash to continue over several buffers
+	inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	//Only for types without padding or pointers
+	template<typename T>
+	inline uint64_t hashValue(const T& value, uint64_t hash)
+	{
+		return vw::hashBytes(&value, sizeof(T), hash);
+	}
+
+	//Appends the bytes of value to a cache key compared byte by byte, only for types without padding or pointers
+	template<typename T>
+	inline void appendKey(std::vector<uint8_t>& key, const T& value)
+	{
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+		key.insert(key.end(), bytes, bytes + sizeof(T));
+	}
+
+	//The size is appended first so consecutive arrays of a key can not be confused
+	inline void appendKeyBytes(std::vector<uint8_t>& key, const void* data, size_t size)
+	{
+		vw::appendKey(key, (uint64_t)size);
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		key.insert(key.end(), bytes, bytes + size);
+	}
+
+	//Vector with fixed inline capacity for hot paths, never allocates and throws once the capacity is exceeded
+	template<typename T, size_t Capacity>
+	class InlineVector
+	{
+	public:
+		InlineVector() = default;
+		InlineVector(const InlineVector& other)
+		{
+			assign(other.begin(), other.end());
+		}
+		InlineVector& operator=(const InlineVector& other)
+		{
+			if (this != &other)
+				assign(other.begin(), other.end());
+			return *this;
+		}
+		~InlineVector()
+		{
+			clear();
+		}
+
+		template<typename... Args>
+		T& emplace_back(Args&&... args)
+		{
+			if (count == Capacity)
+				throw std::runtime_error("VwInlineVector: Capacity exceeded!");
+			T* element = new (&storage[count]) T(std::forward<Args>(args)...);
+			++count;
+			return *element;
+		}
+		void push_back(const T& value)
+		{
+			emplace_back(value);
+		}
+		template<typename Iterator>
+		void assign(Iterator first, Iterator last)
+		{
+			clear();
+			for (; first != last; ++first)
+				emplace_back(*first);
+		}
+		void clear()
+		{
+			while (count)
+				data()[--count].~T();
+		}
+
+		T* data() { return reinterpret_cast<T*>(storage); };
+		const T* data() const { return reinterpret_cast<const T*>(storage); };
+		size_t size() const { return count; };
+		bool empty() const { return count == 0; };
+		T& operator[](size_t index) { return data()[index]; };
+		T& back() { return data()[count - 1]; };
+		T* begin() { return data(); };
+		T* end() { return data() + count; };
+		const T* begin() const { return data(); };
+		const T* end() const { return data() + count; };
+	private:
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage[Capacity];
+		size_t count = 0;
+	};
+}
@@ -1,4 +1,10 @@
 #include "vkcore.h"
+#include "vwmemory.h"
+#include "vwjobs.h"
+#include "vwreflect.h"
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objType, uint64_t obj, size_t location, int32_t code, const char* layerPrefix, const char* msg, void* userData)
 {
@@ -23,6 +29,64 @@ void DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT
 	}
 }
 
+//Prefix written in front of the driver's cache data, the data is only handed to the driver if everything matches
+struct PipelineCacheFileHeader
+{
+	uint32_t magic;
+	uint32_t driverVersion;
+	uint64_t dataSize;
+	uint64_t dataHash;
+};
+static const uint32_t PipelineCacheMagic = 0x43505756;
+
+//Returns an empty vector unless the file holds intact cache data of this device and driver
+static std::vector<char> loadPipelineCacheData(const std::string& path, const vk::PhysicalDeviceProperties& properties)
+{
+	std::ifstream cacheFile(path, std::ios::binary | std::ios::ate);
+	if (!cacheFile.is_open())
+		return {};
+	uint64_t fileSize = (uint64_t)cacheFile.tellg();
+	cacheFile.seekg(0);
+
+	PipelineCacheFileHeader fileHeader;
+	if (!cacheFile.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader)))
+		return {};
+	if (fileHeader.magic != PipelineCacheMagic || fileHeader.driverVersion != properties.driverVersion)
+		return {};
+	//A truncated or corrupted size must not drive the allocation, the file starts over with an empty cache
+	if (fileHeader.dataSize != fileSize - sizeof(fileHeader))
+		return {};
+
+	std::vector<char> cacheData(fileHeader.dataSize);
+	if (!cacheFile.read(cacheData.data(), cacheData.size()) || vw::hashBytes(cacheData.data(), cacheData.size()) != fileHeader.dataHash)
+		return {};
+
+	//Header the driver puts in front of its data (VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+	uint32_t headerSize, headerVersion, vendorID, deviceID;
+	const size_t uuidOffset = 4 * sizeof(uint32_t);
+	if (cacheData.size() < uuidOffset + VK_UUID_SIZE)
+		return {};
+	memcpy(&headerSize, &cacheData[0], sizeof(uint32_t));
+	memcpy(&headerVersion, &cacheData[4], sizeof(uint32_t));
+	memcpy(&vendorID, &cacheData[8], sizeof(uint32_t));
+	memcpy(&deviceID, &cacheData[12], sizeof(uint32_t));
+	if (headerSize < uuidOffset + VK_UUID_SIZE || headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || vendorID != properties.vendorID || deviceID != properties.deviceID)
+		return {};
+	if (memcmp(&cacheData[uuidOffset], properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+		return {};
+	return cacheData;
+}
+
+//Vulkan 1.2 is requested whenever headers and loader support it, timeline semaphores depend on it
+static uint32_t selectApiVersion()
+{
+#ifdef VK_VERSION_1_2
+	if (vk::enumerateInstanceVersion() >= VK_API_VERSION_1_2)
+		return VK_API_VERSION_1_2;
+#endif
+	return VK_API_VERSION_1_0;
+}
+
 vw::Instance::Instance(std::string appName, uint32_t version, vw::ValidationMode validationMode, std::vector<const char*> platformExtensions) : activeValidationMode(validationMode)
 {
 	if (!checkValidationLayerSupport(validationMode))
@@ -35,7 +99,7 @@ vw::Instance::Instance(std::string appName, uint32_t version, vw::ValidationMode
 	appInfo.applicationVersion = version;
 	appInfo.pEngineName = appName.append(" Engine").c_str();
 	appInfo.engineVersion = version;
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = selectApiVersion();
 
 	vk::InstanceCreateInfo createInfo;
 	createInfo.pApplicationInfo = &appInfo;
@@ -76,7 +140,7 @@ vw::Instance::~Instance()
 	instance.destroy();
 }
 
-vw::Device vw::Instance::createDevice(vk::QueueFlags requiredQueueFlags, VkSurfaceKHR requiredSurfaceSupport, std::vector<const char*> requiredExtensions)
+vw::Device vw::Instance::createDevice(vk::QueueFlags requiredQueueFlags, VkSurfaceKHR requiredSurfaceSupport, std::vector<const char*> requiredExtensions, std::vector<float> queuePriorities, vw::QueueSchedulingMode schedulingMode, std::string pipelineCachePath)
 {
 	auto physicalDevices = instance.enumeratePhysicalDevices();
 	std::vector<vk::PhysicalDevice> capableDevices;
@@ -146,7 +210,7 @@ vw::Device vw::Instance::createDevice(vk::QueueFlags requiredQueueFlags, VkSurfa
 		}
 	}
 
-	return vw::Device(instance, selectedDevice, (requiredSurfaceSupport != 0), (activeValidationMode != release), requiredExtensions);
+	return vw::Device(instance, selectedDevice, (requiredSurfaceSupport != 0), (activeValidationMode != release), requiredExtensions, queuePriorities, schedulingMode, pipelineCachePath);
 }
 
 bool vw::Instance::checkValidationLayerSupport(vw::ValidationMode mode)
@@ -184,7 +248,7 @@ bool vw::Instance::checkExtensionSupport(std::vector<const char*> extensions)
 	return requiredExtensionCount == 0;
 }
 
-vw::Device::Device(vk::Instance instance, vk::PhysicalDevice physicalDevice, bool presentationSupport, bool enableValidation, std::vector<const char*> extensions) : physicalDeviceHandle(physicalDevice)
+vw::Device::Device(vk::Instance instance, vk::PhysicalDevice physicalDevice, bool presentationSupport, bool enableValidation, std::vector<const char*> extensions, std::vector<float> queuePriorities, vw::QueueSchedulingMode schedulingMode, std::string pipelineCachePath) : physicalDeviceHandle(physicalDevice), pipelineCacheFile(pipelineCachePath)
 {
 	vk::DeviceCreateInfo logicalDeviceCreateInfo;
 
@@ -193,23 +257,57 @@ vw::Device::Device(vk::Instance instance, vk::PhysicalDevice physicalDevice, boo
 	uint32_t queueFamilyCount = queueFamilies.size();
 	std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos(queueFamilyCount);
 	
-	float queuePriorities[30];
-	std::fill(queuePriorities, queuePriorities + 30, 1.0f);
+	uint32_t maxQueueCount = 0;
+	for (auto& queueFamily : queueFamilies)
+		maxQueueCount = std::max(maxQueueCount, queueFamily.queueCount);
+	queuePriorities.resize(std::max((uint32_t)queuePriorities.size(), maxQueueCount), 1.0f);
+
 	for (size_t i = 0; i < queueFamilyCount; ++i)
 	{
 		queueCreateInfos[i].queueFamilyIndex = i;
-		queueCreateInfos[i].queueCount = 1;
-		queueCreateInfos[i].pQueuePriorities = queuePriorities;
+		queueCreateInfos[i].queueCount = queueFamilies[i].queueCount;
+		queueCreateInfos[i].pQueuePriorities = queuePriorities.data();
 	}
 	logicalDeviceCreateInfo.queueCreateInfoCount = queueFamilyCount;
 	logicalDeviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 
+	apiVersion = std::min(selectApiVersion(), physicalDevice.getProperties().apiVersion);
+
 	//Enable all available features
 	deviceFeatures = physicalDevice.getFeatures();
 	logicalDeviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
+#ifdef VK_VERSION_1_2
+	//Submissions are tracked with timeline semaphores when instance and device both run Vulkan 1.2
+	//Descriptor indexing is core there as well, bindless heaps need update after bind and partially bound arrays
+	vk::PhysicalDeviceVulkan12Features vulkan12Features;
+	if (selectApiVersion() >= VK_API_VERSION_1_2 && physicalDevice.getProperties().apiVersion >= VK_API_VERSION_1_2)
+	{
+		vk::PhysicalDeviceFeatures2 features2;
+		features2.pNext = &vulkan12Features;
+		physicalDevice.getFeatures2(&features2);
+		timelineSemaphores = vulkan12Features.timelineSemaphore;
+		descriptorIndexing = vulkan12Features.runtimeDescriptorArray && vulkan12Features.descriptorBindingPartiallyBound && vulkan12Features.descriptorBindingUpdateUnusedWhilePending
+			&& vulkan12Features.descriptorBindingSampledImageUpdateAfterBind && vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind
+			&& vulkan12Features.shaderSampledImageArrayNonUniformIndexing && vulkan12Features.shaderStorageBufferArrayNonUniformIndexing;
+
+		vulkan12Features = vk::PhysicalDeviceVulkan12Features();
+		vulkan12Features.timelineSemaphore = timelineSemaphores;
+		vulkan12Features.runtimeDescriptorArray = descriptorIndexing;
+		vulkan12Features.descriptorBindingPartiallyBound = descriptorIndexing;
+		vulkan12Features.descriptorBindingUpdateUnusedWhilePending = descriptorIndexing;
+		vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = descriptorIndexing;
+		vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = descriptorIndexing;
+		vulkan12Features.shaderSampledImageArrayNonUniformIndexing = descriptorIndexing;
+		vulkan12Features.shaderStorageBufferArrayNonUniformIndexing = descriptorIndexing;
+		if (timelineSemaphores || descriptorIndexing)
+			logicalDeviceCreateInfo.pNext = &vulkan12Features;
+	}
+#endif
+
 	logicalDeviceCreateInfo.enabledExtensionCount = (uint32_t)extensions.size();
 	logicalDeviceCreateInfo.ppEnabledExtensionNames = extensions.data();
+	enabledExtensions.assign(extensions.begin(), extensions.end());
 
 	//Device layers are depreciated
 	logicalDeviceCreateInfo.enabledLayerCount = 0;
@@ -217,20 +315,60 @@ vw::Device::Device(vk::Instance instance, vk::PhysicalDevice physicalDevice, boo
 	vk::Device::operator = (physicalDevice.createDevice(logicalDeviceCreateInfo));
  
 	//Get queue handles
-	queues.resize(queueFamilyCount);
-	for (size_t i = 0; i < queueFamilyCount; ++i)
-		queues[i] = getQueue(i, 0);
-
-	//Create command pools
-	vk::CommandPoolCreateInfo poolCreateInfo;
-	commandPools.resize(queueFamilyCount);
-	for (size_t i = 0; i < queueFamilyCount; ++i)
+	for (uint32_t i = 0; i < queueFamilyCount; ++i)
 	{
-		poolCreateInfo.queueFamilyIndex = i;
-		commandPools[i] = createCommandPool(poolCreateInfo);
+		std::vector<vk::Queue> familyQueues(queueFamilies[i].queueCount);
+		for (uint32_t j = 0; j < queueFamilies[i].queueCount; ++j)
+			familyQueues[j] = getQueue(i, j);
+		queueSchedulers.push_back(std::make_unique<vw::QueueScheduler>(*this, familyQueues, schedulingMode, timelineSemaphores));
 	}
+
+	//Command pools are created per recording thread on first use
+	commandPools = std::make_unique<vw::ThreadCommandPools>(*this, queueFamilyCount);
+
+	allocator = std::make_unique<vw::MemoryAllocator>(*this, physicalDeviceHandle);
+
+	//Start from the cache of the previous run if it was written by the same device and driver
+	std::vector<char> cacheData;
+	if (!pipelineCacheFile.empty())
+		cacheData = loadPipelineCacheData(pipelineCacheFile, physicalDevice.getProperties());
+	vk::PipelineCacheCreateInfo cacheCreateInfo;
+	cacheCreateInfo.initialDataSize = cacheData.size();
+	cacheCreateInfo.pInitialData = cacheData.data();
+	pipelineCache = createPipelineCache(cacheCreateInfo);
+
+	layoutCache = std::make_unique<vw::LayoutCache>(*this);
+	pipelines = std::make_unique<vw::PipelineCache>(*this);
+	shaderModules = std::make_unique<vw::ShaderModuleRegistry>(*this);
+	threadPool = std::make_unique<vw::ThreadPool>();
 }
  
+uint64_t vw::Device::addDestructionListener(std::function<void(vk::DebugReportObjectTypeEXT, uint64_t)> listener)
+{
+	std::lock_guard<std::mutex> lock(listenerMutex);
+	destructionListeners.emplace(++nextListenerId, listener);
+	return nextListenerId;
+}
+
+void vw::Device::removeDestructionListener(uint64_t listenerId)
+{
+	std::lock_guard<std::mutex> lock(listenerMutex);
+	destructionListeners.erase(listenerId);
+}
+
+//Listeners are called with the lock held, so a listener being removed is never called afterwards
+void vw::Device::notifyDestruction(vk::DebugReportObjectTypeEXT objectType, uint64_t handle)
+{
+	std::lock_guard<std::mutex> lock(listenerMutex);
+	for (auto& listener : destructionListeners)
+		listener.second(objectType, handle);
+}
+
+bool vw::Device::isExtensionEnabled(const char* extensionName)
+{
+	return std::find(enabledExtensions.begin(), enabledExtensions.end(), extensionName) != enabledExtensions.end();
+}
+
 std::vector<uint32_t> vw::Device::getQueueFamilyIndices(vk::QueueFlags flagMask)
 {
 	std::vector<uint32_t> indices;
@@ -244,19 +382,131 @@ std::vector<uint32_t> vw::Device::getQueueFamilyIndices(vk::QueueFlags flagMask)
 
 vw::CommandBuffer vw::Device::createCommandBuffer(vk::QueueFlags flags, vk::CommandBufferLevel level)
 {
-	uint32_t queueFamily = findQueueFamily(flags);
-	return vw::CommandBuffer(*this, commandPools[queueFamily], level, createQueueRequest(queueFamily));
+	return createCommandBuffer(findQueueFamily(flags), level);
+}
+
+vw::CommandBuffer vw::Device::createCommandBuffer(uint32_t queueFamilyIndex, vk::CommandBufferLevel level)
+{
+	return vw::CommandBuffer(*this, commandPools->get(queueFamilyIndex), level, *queueSchedulers[queueFamilyIndex]);
 }
 
 vw::CommandBufferSet vw::Device::createCommandBufferSet(uint32_t count, vk::QueueFlags flags, vk::CommandBufferLevel level)
 {
 	uint32_t queueFamily = findQueueFamily(flags);
-	return vw::CommandBufferSet(count, *this, commandPools[queueFamily], level, createQueueRequest(queueFamily));
+	return vw::CommandBufferSet(count, *this, commandPools->get(queueFamily), level, *queueSchedulers[queueFamily]);
 }
 
-std::function<vk::Queue()> vw::Device::createQueueRequest(uint32_t queueFamilyIndex)
+uint32_t vw::Device::getGraphicsQueueFamily()
 {
-	return [queueFamilyIndex, this]() {return queues[queueFamilyIndex]; };
+	return findQueueFamily(vk::QueueFlagBits::eGraphics);
+}
+
+uint32_t vw::Device::getComputeQueueFamily()
+{
+	return findQueueFamily(vk::QueueFlagBits::eCompute);
+}
+
+//Prefers a transfer-only family so uploads can overlap with rendering
+uint32_t vw::Device::getTransferQueueFamily()
+{
+	for (uint32_t i = 0; i < queueFamilies.size(); ++i)
+	{
+		if ((queueFamilies[i].queueFlags & vk::QueueFlagBits::eTransfer) && !(queueFamilies[i].queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))
+			return i;
+	}
+	return getGraphicsQueueFamily();
+}
+
+void vw::Device::transferOwnership(vw::CommandBuffer& cmdBuffer, uint32_t srcQueueFamily, uint32_t dstQueueFamily, std::vector<vk::BufferMemoryBarrier> bufferBarriers, std::vector<vk::ImageMemoryBarrier> imageBarriers)
+{
+	if (bufferBarriers.empty() && imageBarriers.empty())
+		return;
+
+	vw::QueueScheduler* dstScheduler = queueSchedulers[dstQueueFamily].get();
+	if (srcQueueFamily == dstQueueFamily)
+	{
+		cmdBuffer.addSubmitCallback([dstScheduler](vw::GpuFuture future)
+		{
+			if (future.isValid())
+				dstScheduler->queueWriteWait(future);
+		});
+		return;
+	}
+
+	for (auto& barrier : bufferBarriers)
+	{
+		barrier.srcQueueFamilyIndex = srcQueueFamily;
+		barrier.dstQueueFamilyIndex = dstQueueFamily;
+	}
+	for (auto& barrier : imageBarriers)
+	{
+		barrier.srcQueueFamilyIndex = srcQueueFamily;
+		barrier.dstQueueFamilyIndex = dstQueueFamily;
+	}
+	cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), {}, bufferBarriers, imageBarriers);
+
+	//Destination access masks are ignored by the release, source access masks by the acquire
+	vw::OwnershipTransfer transfer;
+	transfer.dstQueueFamily = dstQueueFamily;
+	transfer.semaphore = std::make_shared<vw::Semaphore>(*this);
+	for (auto& barrier : bufferBarriers)
+	{
+		barrier.srcAccessMask = vk::AccessFlags();
+		barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite;
+	}
+	for (auto& barrier : imageBarriers)
+	{
+		barrier.srcAccessMask = vk::AccessFlags();
+		barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite;
+	}
+	transfer.bufferBarriers = bufferBarriers;
+	transfer.imageBarriers = imageBarriers;
+	cmdBuffer.addSubmitSignal(transfer.semaphore);
+
+	//Waiting on the semaphore before its signal was submitted is invalid, so the acquire only becomes visible to the family once the release is submitted
+	cmdBuffer.addSubmitCallback([dstScheduler, transfer](vw::GpuFuture future)
+	{
+		if (future.isValid())
+			dstScheduler->queueAcquire(transfer);
+	});
+}
+
+bool vw::Device::savePipelineCache()
+{
+	if (pipelineCacheFile.empty())
+		return false;
+
+	std::vector<uint8_t> cacheData = getPipelineCacheData(pipelineCache);
+	PipelineCacheFileHeader fileHeader;
+	fileHeader.magic = PipelineCacheMagic;
+	fileHeader.driverVersion = physicalDeviceHandle.getProperties().driverVersion;
+	fileHeader.dataSize = cacheData.size();
+	fileHeader.dataHash = vw::hashBytes(cacheData.data(), cacheData.size());
+
+	std::string tempFile = pipelineCacheFile + ".tmp";
+	{
+		std::ofstream cacheFile(tempFile, std::ios::binary | std::ios::trunc);
+		cacheFile.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+		cacheFile.write(reinterpret_cast<const char*>(cacheData.data()), cacheData.size());
+		if (!cacheFile.good())
+			return false;
+	}
+
+	//Readers see either the old or the new file, never a partially written one
+	std::error_code error;
+	std::filesystem::rename(tempFile, pipelineCacheFile, error);
+	return !error;
+}
+
+vw::StagingRing& vw::Device::getStagingRing()
+{
+	std::call_once(stagingRingCreated, [this]() { stagingRing = std::make_unique<vw::StagingRing>(*this, 32 * 1024 * 1024); });
+	return *stagingRing;
+}
+
+vw::QueueLease vw::Device::acquireQueue(uint32_t queueFamilyIndex)
+{
+	return queueSchedulers[queueFamilyIndex]->acquire();
 }
 
 //Finds queue family with matching flags, otherwise return largest queue family with compatible flags
@@ -280,112 +530,540 @@ uint32_t vw::Device::findQueueFamily(vk::QueueFlags flags)
 
 void vw::Device::waitIdle()
 {
-	for (auto queue : queues)
-		queue.waitIdle();
+	for (auto& scheduler : queueSchedulers)
+		scheduler->waitIdle();
 }
 
 vw::Device::~Device()
 {
-	for (auto& pool : commandPools)
-		destroyCommandPool(pool);
+	//Jobs use the device, queued ones are dropped and running ones finish before anything is destroyed
+	threadPool->cancelPending();
+	threadPool.reset();
+	stagingRing.reset();
+	allocator.reset();
+	commandPools.reset();
+	queueSchedulers.clear();
+	pipelines.reset();
+	shaderModules.reset();
+	layoutCache.reset();
+	savePipelineCache();
+	destroyPipelineCache(pipelineCache);
 	destroy();
 }
 
-vw::CommandBuffer::CommandBuffer(vk::Device device, vk::CommandPool commandPool, vk::CommandBufferLevel level, std::function<vk::Queue()> queueRequestFunc) : deviceHandle(device), poolHandle(commandPool), requestQueue(queueRequestFunc), vw::Semaphore(device)
+vw::QueueScheduler::QueueScheduler(vk::Device device, std::vector<vk::Queue> familyQueues, vw::QueueSchedulingMode mode, bool timelineSemaphores) : queues(familyQueues), queueMutexes(familyQueues.size()), nextQueue(0), schedulingMode(mode), pendingAcquireCount(0), writeWaitCount(0)
 {
-	vk::CommandBufferAllocateInfo allocateInfo;
-	allocateInfo.commandPool = poolHandle;
-	allocateInfo.commandBufferCount = 1;
-	allocateInfo.level = level;
-	device.allocateCommandBuffers(&allocateInfo, dynamic_cast<vk::CommandBuffer*>(this));
+	//Each queue executes its submissions in order, so each gets a timeline of its own
+	for (size_t i = 0; i < queues.size(); ++i)
+		timelines.push_back(std::make_unique<vw::Timeline>(device, timelineSemaphores));
+}
+
+vw::QueueScheduler::~QueueScheduler()
+{
+	for (auto& deferred : deferredReleases)
+		deferred.future.wait();
+	deferredReleases.clear();
+}
+
+void vw::QueueScheduler::queueAcquire(vw::OwnershipTransfer transfer)
+{
+	std::lock_guard<std::mutex> lock(acquireMutex);
+	pendingAcquires.push_back(std::move(transfer));
+	pendingAcquireCount.store((uint32_t)pendingAcquires.size(), std::memory_order_release);
+}
+
+void vw::QueueScheduler::takeAcquires(std::vector<vw::OwnershipTransfer>& transfers)
+{
+	if (pendingAcquireCount.load(std::memory_order_acquire) == 0)
+		return;
+	std::lock_guard<std::mutex> lock(acquireMutex);
+	for (auto& transfer : pendingAcquires)
+		transfers.push_back(std::move(transfer));
+	pendingAcquires.clear();
+	pendingAcquireCount.store(0, std::memory_order_release);
+}
+
+void vw::QueueScheduler::queueWriteWait(vw::GpuFuture future)
+{
+	if (future.isReady())
+		return;
+	std::lock_guard<std::mutex> lock(acquireMutex);
+	for (auto& writeWait : writeWaits)
+	{
+		if (writeWait.timeline == future.timeline)
+		{
+			writeWait.value = std::max(writeWait.value, future.value);
+			return;
+		}
+	}
+	writeWaits.push_back(future);
+	writeWaitCount.store((uint32_t)writeWaits.size(), std::memory_order_release);
 }
 
-vw::CommandBuffer::CommandBuffer(vk::Device device, vk::CommandBuffer bufferHandle, std::function<vk::Queue()> queueRequestFunc) : deviceHandle(device), vk::CommandBuffer(bufferHandle), requestQueue(queueRequestFunc), vw::Semaphore(device)
+void vw::QueueScheduler::getWriteWaits(std::vector<vw::GpuFuture>& futures)
 {
+	if (writeWaitCount.load(std::memory_order_acquire) == 0)
+		return;
+	std::lock_guard<std::mutex> lock(acquireMutex);
+	size_t kept = 0;
+	for (auto& writeWait : writeWaits)
+	{
+		if (!writeWait.isReady())
+		{
+			futures.push_back(writeWait);
+			writeWaits[kept++] = writeWait;
+		}
+	}
+	writeWaits.resize(kept);
+	writeWaitCount.store((uint32_t)kept, std::memory_order_release);
+}
+
+void vw::QueueScheduler::releaseAfter(std::shared_ptr<void> object, vw::GpuFuture future)
+{
+	if (future.isReady())
+		return;
+	std::lock_guard<std::mutex> lock(releaseMutex);
+	releaseCompleted();
+	deferredReleases.push_back({ std::move(object), future });
+}
+
+//Must be called with the release mutex locked
+void vw::QueueScheduler::releaseCompleted()
+{
+	size_t kept = 0;
+	for (auto& deferred : deferredReleases)
+		if (!deferred.future.isReady())
+			deferredReleases[kept++] = std::move(deferred);
+	deferredReleases.erase(deferredReleases.begin() + kept, deferredReleases.end());
+}
+
+vw::QueueLease vw::QueueScheduler::acquire()
+{
+	uint32_t selectedQueue = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+	//Ties go to the round-robin pick so equally loaded queues still alternate
+	if (schedulingMode == leastLoaded)
+	{
+		uint64_t lowestLoad = timelines[selectedQueue]->getPendingCount();
+		for (uint32_t i = 1; i < queues.size() && lowestLoad; ++i)
+		{
+			uint32_t queueIndex = (selectedQueue + i) % queues.size();
+			uint64_t load = timelines[queueIndex]->getPendingCount();
+			if (load < lowestLoad)
+			{
+				lowestLoad = load;
+				selectedQueue = queueIndex;
+			}
+		}
+	}
+
+	return { queues[selectedQueue], std::unique_lock<std::mutex>(queueMutexes[selectedQueue]), timelines[selectedQueue].get() };
+}
+
+void vw::QueueScheduler::waitIdle()
+{
+	for (uint32_t i = 0; i < queues.size(); ++i)
+	{
+		std::lock_guard<std::mutex> lock(queueMutexes[i]);
+		queues[i].waitIdle();
+	}
+	std::lock_guard<std::mutex> lock(releaseMutex);
+	releaseCompleted();
+}
+
+bool vw::GpuFuture::isReady()
+{
+	return !timeline || timeline->getCompletedValue() >= value;
+}
+
+void vw::GpuFuture::wait()
+{
+	if (timeline)
+		timeline->wait(value);
+}
+
+void vw::waitForFutures(std::vector<vw::GpuFuture> futures)
+{
+	//Only the latest value of each timeline has to be waited on
+	std::map<vw::Timeline*, uint64_t> timelineValues;
+	for (auto& future : futures)
+		if (future.isValid())
+			timelineValues[future.timeline] = std::max(timelineValues[future.timeline], future.value);
+	if (timelineValues.empty())
+		return;
+
+#ifdef VK_VERSION_1_2
+	std::vector<vk::Semaphore> semaphores;
+	std::vector<uint64_t> values;
+	for (auto& timelineValue : timelineValues)
+	{
+		if (!timelineValue.first->isTimelineSemaphore())
+			break;
+		semaphores.push_back(timelineValue.first->getSemaphore());
+		values.push_back(timelineValue.second);
+	}
+	if (semaphores.size() == timelineValues.size())
+	{
+		vk::SemaphoreWaitInfo waitInfo;
+		waitInfo.semaphoreCount = (uint32_t)semaphores.size();
+		waitInfo.pSemaphores = semaphores.data();
+		waitInfo.pValues = values.data();
+		timelineValues.begin()->first->getDevice().waitSemaphores(waitInfo, UINT64_MAX);
+		return;
+	}
+#endif
+	for (auto& timelineValue : timelineValues)
+		timelineValue.first->wait(timelineValue.second);
+}
+
+vw::Timeline::Timeline(vk::Device device, bool useTimelineSemaphore) : deviceHandle(device), timelineSemaphore(useTimelineSemaphore)
+{
+#ifdef VK_VERSION_1_2
+	if (timelineSemaphore)
+	{
+		vk::SemaphoreTypeCreateInfo typeInfo(vk::SemaphoreType::eTimeline, 0);
+		vk::SemaphoreCreateInfo semaphoreInfo;
+		semaphoreInfo.pNext = &typeInfo;
+		semaphore = deviceHandle.createSemaphore(semaphoreInfo);
+	}
+#else
+	timelineSemaphore = false;
+#endif
+}
+
+vw::Timeline::~Timeline()
+{
+	if (semaphore)
+		deviceHandle.destroySemaphore(semaphore);
+	for (auto& pending : pendingFences)
+		deviceHandle.destroyFence(pending.fence);
+	for (auto fence : freeFences)
+		deviceHandle.destroyFence(fence);
+}
+
+uint64_t vw::Timeline::reserveValue(vk::Fence& submitFence)
+{
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	++lastValue;
+	if (timelineSemaphore)
+	{
+		submitFence = nullptr;
+		return lastValue;
+	}
+
+	//Fences of completed submissions are reused before creating new ones
+	retireFences(false, 0);
+	if (freeFences.empty())
+		freeFences.push_back(deviceHandle.createFence(vk::FenceCreateInfo()));
+	submitFence = freeFences.back();
+	freeFences.pop_back();
+	pendingFences.push_back({ lastValue, submitFence });
+	return lastValue;
+}
+
+uint64_t vw::Timeline::getCompletedValue()
+{
+#ifdef VK_VERSION_1_2
+	if (timelineSemaphore)
+		return deviceHandle.getSemaphoreCounterValue(semaphore);
+#endif
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	retireFences(false, 0);
+	return completedValue;
+}
+
+uint64_t vw::Timeline::getPendingCount()
+{
+	uint64_t reservedValue;
+	{
+		std::lock_guard<std::mutex> lock(timelineMutex);
+		reservedValue = lastValue;
+	}
+	uint64_t completed = getCompletedValue();
+	return reservedValue > completed ? reservedValue - completed : 0;
 }
 
-vw::CommandBuffer::CommandBuffer(vw::CommandBuffer && other) : vw::Semaphore(other.deviceHandle)
+void vw::Timeline::wait(uint64_t value)
+{
+#ifdef VK_VERSION_1_2
+	if (timelineSemaphore)
+	{
+		vk::SemaphoreWaitInfo waitInfo;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &semaphore;
+		waitInfo.pValues = &value;
+		deviceHandle.waitSemaphores(waitInfo, UINT64_MAX);
+		return;
+	}
+#endif
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	retireFences(true, value);
+}
+
+//Retires signaled fences in submission order, blocking until value is reached if requested
+void vw::Timeline::retireFences(bool block, uint64_t value)
+{
+	size_t retired = 0;
+	while (retired < pendingFences.size())
+	{
+		PendingFence& pending = pendingFences[retired];
+		if (block && pending.value <= value)
+			deviceHandle.waitForFences({ pending.fence }, true, UINT64_MAX);
+		else if (deviceHandle.getFenceStatus(pending.fence) != vk::Result::eSuccess)
+			break;
+
+		deviceHandle.resetFences({ pending.fence });
+		freeFences.push_back(pending.fence);
+		completedValue = pending.value;
+		++retired;
+	}
+	pendingFences.erase(pendingFences.begin(), pendingFences.begin() + retired);
+}
+
+vw::CommandBuffer::CommandBuffer(vk::Device device, vw::CommandPool& commandPool, vk::CommandBufferLevel level, vw::QueueScheduler& queueScheduler) : deviceHandle(device), poolRef(&commandPool), bufferLevel(level), scheduler(&queueScheduler)
+{
+	pooledBuffer = commandPool.allocate(level);
+	vk::CommandBuffer::operator=(pooledBuffer->buffer);
+}
+
+vw::CommandBuffer::CommandBuffer(vk::Device device, vk::CommandBuffer bufferHandle, vw::QueueScheduler& queueScheduler) : deviceHandle(device), vk::CommandBuffer(bufferHandle), scheduler(&queueScheduler)
+{
+}
+
+vw::CommandBuffer::CommandBuffer(vw::CommandBuffer && other) : vk::CommandBuffer(other)
 {
 	deviceHandle = other.deviceHandle;
-	poolHandle = other.poolHandle;
-	requestQueue = other.requestQueue;
+	poolRef = other.poolRef;
+	pooledBuffer = other.pooledBuffer;
+	bufferLevel = other.bufferLevel;
+	scheduler = other.scheduler;
 	wSemaphores = other.wSemaphores;
 	wStages = other.wStages;
-	other.poolHandle = nullptr;
+	completionFence = other.completionFence;
+	submitWaits = std::move(other.submitWaits);
+	submitWaitStages = std::move(other.submitWaitStages);
+	submitSignals = std::move(other.submitSignals);
+	futureWaits = std::move(other.futureWaits);
+	futureWaitStages = std::move(other.futureWaitStages);
+	submitCallbacks = std::move(other.submitCallbacks);
+	signalSemaphore = std::move(other.signalSemaphore);
+	lastFuture = other.lastFuture;
+	other.poolRef = nullptr;
+	other.pooledBuffer = nullptr;
+	other.completionFence = nullptr;
 }
 
 void vw::CommandBuffer::begin(vk::CommandBufferUsageFlags usageFlags)
 {
 	vk::CommandBufferBeginInfo beginInfo(usageFlags);
     vk::CommandBuffer::begin(beginInfo);
+	if (bufferLevel == vk::CommandBufferLevel::ePrimary)
+		recordAcquires();
 }
 
-void vw::CommandBuffer::setWaitConditions(std::vector<vk::Semaphore> waitSemaphores, std::vector<vk::PipelineStageFlags> waitStages)
+//Acquires taken by a buffer that is never submitted are queued again for the next buffer of the family
+void vw::CommandBuffer::recordAcquires()
 {
-	wSemaphores = waitSemaphores;
-	wStages = waitStages;
+	static thread_local std::vector<vw::OwnershipTransfer> transfers;
+	static thread_local std::vector<vw::GpuFuture> writeWaits;
+	scheduler->getWriteWaits(writeWaits);
+	if (!writeWaits.empty())
+	{
+		//Submissions to a single queue are ordered already, the barrier still makes their writes visible
+		if (scheduler->getQueueCount() > 1)
+			for (auto& future : writeWaits)
+				addSubmitWait(future, vk::PipelineStageFlagBits::eAllCommands);
+		vk::MemoryBarrier memoryBarrier(vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite);
+		pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), { memoryBarrier }, {}, {});
+		writeWaits.clear();
+	}
+
+	scheduler->takeAcquires(transfers);
+	if (transfers.empty())
+		return;
+
+	for (auto& transfer : transfers)
+	{
+		pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), {}, transfer.bufferBarriers, transfer.imageBarriers);
+		addSubmitWait(transfer.semaphore, vk::PipelineStageFlagBits::eAllCommands);
+	}
+	vw::QueueScheduler* familyScheduler = scheduler;
+	addSubmitCallback([familyScheduler, acquired = transfers](vw::GpuFuture future)
+	{
+		//The acquired resources may be used by a later command buffer submitted to another queue of the family
+		if (future.isValid())
+			familyScheduler->queueWriteWait(future);
+		else
+			for (auto& transfer : acquired)
+				familyScheduler->queueAcquire(transfer);
+	});
+	transfers.clear();
 }
 
-void vw::CommandBuffer::submit()
+void vw::CommandBuffer::setWaitConditions(vk::ArrayProxy<const vk::Semaphore> waitSemaphores, vk::ArrayProxy<const vk::PipelineStageFlags> waitStages)
 {
-	vk::SubmitInfo submitInfo;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = this;
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = static_cast<vk::Semaphore*>(this);
-	submitInfo.waitSemaphoreCount = wSemaphores.size();
-	submitInfo.pWaitSemaphores = wSemaphores.data();
-	submitInfo.pWaitDstStageMask = wStages.data();
-	requestQueue().submit( submitInfo, vk::Fence());
+	wSemaphores.assign(waitSemaphores.begin(), waitSemaphores.end());
+	wStages.assign(waitStages.begin(), waitStages.end());
 }
 
-void vw::CommandBuffer::submit(vk::Semaphore triggerSemaphore)
+//The fence is signaled by the next submission only, staging memory is recycled once it signals
+void vw::CommandBuffer::setCompletionFence(vk::Fence fence)
 {
-	std::vector<vk::Semaphore> tSemaphores = { static_cast<vk::Semaphore>(*this) };
-	if (triggerSemaphore)
-		tSemaphores.push_back(triggerSemaphore);
+	completionFence = fence;
+}
+
+void vw::CommandBuffer::addSubmitWait(std::shared_ptr<vw::Semaphore> semaphore, vk::PipelineStageFlags waitStage)
+{
+	submitWaits.push_back(semaphore);
+	submitWaitStages.push_back(waitStage);
+}
+
+void vw::CommandBuffer::addSubmitSignal(std::shared_ptr<vw::Semaphore> semaphore)
+{
+	submitSignals.push_back(semaphore);
+}
+
+void vw::CommandBuffer::addSubmitWait(const vw::GpuFuture& future, vk::PipelineStageFlags waitStage)
+{
+	futureWaits.push_back(future);
+	futureWaitStages.push_back(waitStage);
+}
+
+vk::Semaphore vw::CommandBuffer::getSemaphore()
+{
+	if (!signalSemaphore)
+		signalSemaphore = std::make_unique<vw::Semaphore>(deviceHandle);
+	return *signalSemaphore;
+}
 
-	vk::SubmitInfo submitInfo;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = this;
-	submitInfo.signalSemaphoreCount = tSemaphores.size();
-	submitInfo.pSignalSemaphores = tSemaphores.data();
-	submitInfo.waitSemaphoreCount = wSemaphores.size();
-	submitInfo.pWaitSemaphores = wSemaphores.data();
-	submitInfo.pWaitDstStageMask = wStages.data();
-	requestQueue().submit({ submitInfo }, vk::Fence());
+vw::GpuFuture vw::CommandBuffer::submit()
+{
+	return queueSubmit(nullptr, false);
+}
+
+vw::GpuFuture vw::CommandBuffer::submit(vk::Semaphore triggerSemaphore)
+{
+	return queueSubmit(triggerSemaphore, false);
 }
 
 void vw::CommandBuffer::submitAndSync()
 {
-	vk::SubmitInfo submitInfo;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = this;
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = static_cast<vk::Semaphore*>(this);
-	submitInfo.waitSemaphoreCount = wSemaphores.size();
-	submitInfo.pWaitSemaphores = wSemaphores.data();
-	submitInfo.pWaitDstStageMask = wStages.data();
+	queueSubmit(nullptr, true);
+}
+
+vw::GpuFuture vw::CommandBuffer::queueSubmit(vk::Semaphore triggerSemaphore, bool sync)
+{
+	//Storage of the batch is reused by every submit of the thread
+	static thread_local vw::SubmitBatch batch;
+	try
+	{
+		batch.add(*this, triggerSemaphore);
+		batch.flush();
+	}
+	catch (...)
+	{
+		//The batch would otherwise keep pointing at this command buffer for the next submit of the thread
+		batch.clear();
+		throw;
+	}
+	if (sync)
+		lastFuture.wait();
+	return lastFuture;
+}
+
+void vw::CommandBuffer::completeSubmit(vw::GpuFuture future)
+{
+	completionFence = nullptr;
+	//The scheduler keeps the semaphores of the submission alive even if this command buffer is destroyed before it completes
+	for (auto& semaphore : submitWaits)
+		scheduler->releaseAfter(semaphore, future);
+	for (auto& semaphore : submitSignals)
+		scheduler->releaseAfter(semaphore, future);
+	submitWaits.clear();
+	submitWaitStages.clear();
+	submitSignals.clear();
+	futureWaits.clear();
+	futureWaitStages.clear();
+	lastFuture = future;
+	runSubmitCallbacks(future);
+}
+
+void vw::CommandBuffer::addSubmitCallback(std::function<void(vw::GpuFuture)> callback)
+{
+	submitCallbacks.push_back(std::move(callback));
+}
+
+//The last submission may still signal the semaphore, it is destroyed by the scheduler once that submission has completed
+void vw::CommandBuffer::releaseSignalSemaphore()
+{
+	if (signalSemaphore)
+		scheduler->releaseAfter(std::shared_ptr<vw::Semaphore>(std::move(signalSemaphore)), lastFuture);
+}
+
+void vw::CommandBuffer::runSubmitCallbacks(vw::GpuFuture future)
+{
+	for (auto& callback : submitCallbacks)
+		callback(future);
+	submitCallbacks.clear();
+}
+
+void vw::CommandBuffer::reallocate(vw::CommandPool& commandPool, vk::CommandBufferLevel level)
+{
+	runSubmitCallbacks(vw::GpuFuture());
+	if (poolRef)
+		poolRef->recycle(pooledBuffer, lastFuture);
+	poolRef = &commandPool;
+	bufferLevel = level;
+	pooledBuffer = commandPool.allocate(level);
+	vk::CommandBuffer::operator=(pooledBuffer->buffer);
 
-	vk::Queue queue = requestQueue();
-	queue.submit({ submitInfo }, vk::Fence());
-	queue.waitIdle();
+	//Clearing keeps the capacity, a reused buffer records and submits without allocating
+	wSemaphores.clear();
+	wStages.clear();
+	completionFence = nullptr;
+	submitWaits.clear();
+	submitWaitStages.clear();
+	submitSignals.clear();
+	futureWaits.clear();
+	futureWaitStages.clear();
+	lastFuture = vw::GpuFuture();
 }
 
+//A pending buffer is only handed out again once its last submission has finished, secondary buffers are not tracked through their primary
 vw::CommandBuffer::~CommandBuffer()
 {
-	if (poolHandle)
-		deviceHandle.freeCommandBuffers(poolHandle, { *this });
+	runSubmitCallbacks(vw::GpuFuture());
+	if (poolRef)
+		poolRef->recycle(pooledBuffer, lastFuture);
+	releaseSignalSemaphore();
 }
 
 vw::CommandBuffer & vw::CommandBuffer::operator=(vw::CommandBuffer && other)
 {
+	runSubmitCallbacks(vw::GpuFuture());
+	if (poolRef)
+		poolRef->recycle(pooledBuffer, lastFuture);
+	releaseSignalSemaphore();
+	vk::CommandBuffer::operator=(other);
 	deviceHandle = other.deviceHandle;
-	poolHandle = other.poolHandle;
-	requestQueue = other.requestQueue;
+	poolRef = other.poolRef;
+	pooledBuffer = other.pooledBuffer;
+	bufferLevel = other.bufferLevel;
+	scheduler = other.scheduler;
 	wSemaphores = other.wSemaphores;
 	wStages = other.wStages;
-	other.poolHandle = nullptr;
+	completionFence = other.completionFence;
+	submitWaits = std::move(other.submitWaits);
+	submitWaitStages = std::move(other.submitWaitStages);
+	submitSignals = std::move(other.submitSignals);
+	futureWaits = std::move(other.futureWaits);
+	futureWaitStages = std::move(other.futureWaitStages);
+	submitCallbacks = std::move(other.submitCallbacks);
+	signalSemaphore = std::move(other.signalSemaphore);
+	lastFuture = other.lastFuture;
+	other.poolRef = nullptr;
+	other.pooledBuffer = nullptr;
+	other.completionFence = nullptr;
 	return *this;
 }
 
@@ -400,24 +1078,300 @@ vw::Fence::~Fence()
 	deviceHandle.destroyFence(*this);
 }
 
-vw::CommandBufferSet::CommandBufferSet(size_t count, vk::Device device, vk::CommandPool commandPool, vk::CommandBufferLevel level, std::function<vk::Queue()> queueRequestFunc) : deviceHandle(device), poolHandle(commandPool)
+vw::CommandBufferSet::CommandBufferSet(size_t count, vk::Device device, vw::CommandPool& commandPool, vk::CommandBufferLevel level, vw::QueueScheduler& queueScheduler)
 {
 	this->resize(count);
-	buffers.resize(count);
+	for (auto& ptr : *this)
+		ptr = std::make_unique<vw::CommandBuffer>(device, commandPool, level, queueScheduler);
+}
+
+void vw::SubmitBatch::add(vw::CommandBuffer& cmdBuffer, vk::Semaphore triggerSemaphore)
+{
+	//flush submits everything to a queue of the first command buffer's family
+	if (!entries.empty() && entries.front().cmdBuffer->scheduler != cmdBuffer.scheduler)
+		throw std::runtime_error("VwSubmitBatch: Command buffers of a batch have to belong to the same queue family!");
+
+	//Futures on fence timelines cannot be waited on by the GPU, they are resolved before anything is recorded
+	for (auto& future : cmdBuffer.futureWaits)
+		if (future.isValid() && !future.timeline->isTimelineSemaphore())
+			future.wait();
+
+	Entry entry;
+	entry.cmdBuffer = &cmdBuffer;
+
+	entry.waitOffset = (uint32_t)waitSemaphores.size();
+	waitSemaphores.insert(waitSemaphores.end(), cmdBuffer.wSemaphores.begin(), cmdBuffer.wSemaphores.end());
+	waitStages.insert(waitStages.end(), cmdBuffer.wStages.begin(), cmdBuffer.wStages.end());
+	for (size_t i = 0; i < cmdBuffer.submitWaits.size(); ++i)
+	{
+		waitSemaphores.push_back(*cmdBuffer.submitWaits[i]);
+		waitStages.push_back(cmdBuffer.submitWaitStages[i]);
+	}
+	waitValues.resize(waitSemaphores.size(), 0);
+
+	for (size_t i = 0; i < cmdBuffer.futureWaits.size(); ++i)
+	{
+		vw::GpuFuture& future = cmdBuffer.futureWaits[i];
+		if (future.isValid() && future.timeline->isTimelineSemaphore())
+		{
+			waitSemaphores.push_back(future.timeline->getSemaphore());
+			waitStages.push_back(cmdBuffer.futureWaitStages[i]);
+			waitValues.push_back(future.value);
+		}
+	}
+	entry.waitCount = (uint32_t)waitSemaphores.size() - entry.waitOffset;
+
+	entry.signalOffset = (uint32_t)signalSemaphores.size();
+	if (cmdBuffer.signalSemaphore)
+		signalSemaphores.push_back(*cmdBuffer.signalSemaphore);
+	if (triggerSemaphore)
+		signalSemaphores.push_back(triggerSemaphore);
+	for (auto& semaphore : cmdBuffer.submitSignals)
+		signalSemaphores.push_back(*semaphore);
+	signalValues.resize(signalSemaphores.size(), 0);
+	entry.signalCount = (uint32_t)signalSemaphores.size() - entry.signalOffset;
+
+	if (cmdBuffer.completionFence)
+		fences.push_back(cmdBuffer.completionFence);
+	entries.push_back(entry);
+}
+
+vw::GpuFuture vw::SubmitBatch::flush()
+{
+	if (entries.empty())
+		return vw::GpuFuture();
+
+	vw::QueueLease queueLease = entries.front().cmdBuffer->scheduler->acquire();
+	vk::Fence timelineFence;
+	uint64_t signalValue = queueLease.timeline->reserveValue(timelineFence);
+	bool timelineSemaphore = queueLease.timeline->isTimelineSemaphore();
+
+	//Semaphore signals cover all earlier commands of the queue, so the last batch signals the timeline for all of them
+	if (timelineSemaphore)
+	{
+		signalSemaphores.push_back(queueLease.timeline->getSemaphore());
+		signalValues.push_back(signalValue);
+		entries.back().signalCount++;
+	}
+	if (timelineFence)
+		fences.push_back(timelineFence);
+
+	submitInfos.resize(entries.size());
+#ifdef VK_VERSION_1_2
+	timelineInfos.resize(entries.size());
+#endif
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		Entry& entry = entries[i];
+		vk::SubmitInfo& submitInfo = submitInfos[i];
+		submitInfo.pNext = nullptr;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = entry.cmdBuffer;
+		submitInfo.waitSemaphoreCount = entry.waitCount;
+		submitInfo.pWaitSemaphores = waitSemaphores.data() + entry.waitOffset;
+		submitInfo.pWaitDstStageMask = waitStages.data() + entry.waitOffset;
+		submitInfo.signalSemaphoreCount = entry.signalCount;
+		submitInfo.pSignalSemaphores = signalSemaphores.data() + entry.signalOffset;
+
+#ifdef VK_VERSION_1_2
+		if (timelineSemaphore)
+		{
+			vk::TimelineSemaphoreSubmitInfo& timelineInfo = timelineInfos[i];
+			timelineInfo.waitSemaphoreValueCount = entry.waitCount;
+			timelineInfo.pWaitSemaphoreValues = waitValues.data() + entry.waitOffset;
+			timelineInfo.signalSemaphoreValueCount = entry.signalCount;
+			timelineInfo.pSignalSemaphoreValues = signalValues.data() + entry.signalOffset;
+			submitInfo.pNext = &timelineInfo;
+		}
+#endif
+	}
+
+	//A submission signals one fence, further fences are signaled by empty batches behind it
+	queueLease.queue.submit(submitInfos, fences.empty() ? vk::Fence() : fences.front());
+	for (size_t i = 1; i < fences.size(); ++i)
+		queueLease.queue.submit(nullptr, fences[i]);
+	queueLease.lock.unlock();
+
+	vw::GpuFuture future;
+	future.timeline = queueLease.timeline;
+	future.value = signalValue;
+	for (auto& entry : entries)
+		entry.cmdBuffer->completeSubmit(future);
+
+	clear();
+	return future;
+}
+
+void vw::SubmitBatch::clear()
+{
+	entries.clear();
+	waitSemaphores.clear();
+	waitStages.clear();
+	waitValues.clear();
+	signalSemaphores.clear();
+	signalValues.clear();
+	fences.clear();
+}
+
+vw::CommandPool::CommandPool(vk::Device device, uint32_t queueFamilyIndex) : deviceHandle(device), familyIndex(queueFamilyIndex), recycled(nullptr)
+{
+	vk::CommandPoolCreateInfo poolCreateInfo;
+	poolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient;
+	poolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+	pool = deviceHandle.createCommandPool(poolCreateInfo);
+}
+
+vw::CommandPool::~CommandPool()
+{
+	deviceHandle.destroyCommandPool(pool);
+}
+
+vw::CommandPool::PooledBuffer* vw::CommandPool::allocate(vk::CommandBufferLevel level)
+{
+	size_t levelIndex = (level == vk::CommandBufferLevel::ePrimary) ? 0 : 1;
+	if (availableBuffers[levelIndex].empty())
+		collectRecycled(false);
+
+	if (!availableBuffers[levelIndex].empty())
+	{
+		PooledBuffer* node = availableBuffers[levelIndex].back();
+		availableBuffers[levelIndex].pop_back();
+		return node;
+	}
 
 	vk::CommandBufferAllocateInfo allocateInfo;
-	allocateInfo.commandBufferCount = count;
+	allocateInfo.commandPool = pool;
+	allocateInfo.commandBufferCount = 1;
 	allocateInfo.level = level;
-	allocateInfo.commandPool = poolHandle;
+	vk::CommandBuffer commandBuffer;
+	deviceHandle.allocateCommandBuffers(&allocateInfo, &commandBuffer);
 
-	deviceHandle.allocateCommandBuffers(&allocateInfo, buffers.data());
-	
-	size_t i = 0;
-	for (auto& ptr : *this)
-		ptr = std::make_unique<vw::CommandBuffer>(deviceHandle, buffers[i++], queueRequestFunc);
+	PooledBuffer& node = bufferNodes.emplace_back();
+	node.buffer = commandBuffer;
+	node.level = level;
+	allocatedBuffers[levelIndex].push_back(&node);
+	//Every node fits into the available and pending lists, collectRecycled never grows them
+	availableBuffers[levelIndex].reserve(allocatedBuffers[levelIndex].size());
+	pendingBuffers.reserve(bufferNodes.size());
+	return &node;
+}
+
+//Lock-free push of a node the pool already owns, only the owning thread takes buffers back out in collectRecycled
+void vw::CommandPool::recycle(vw::CommandPool::PooledBuffer* pooledBuffer, vw::GpuFuture future)
+{
+	pooledBuffer->future = future;
+	pooledBuffer->next = recycled.load(std::memory_order_relaxed);
+	while (!recycled.compare_exchange_weak(pooledBuffer->next, pooledBuffer, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void vw::CommandPool::reset()
+{
+	deviceHandle.resetCommandPool(pool, vk::CommandPoolResetFlags());
+	collectRecycled(true);
+}
+
+//Moves recycled buffers whose last submission has finished to the available lists, every buffer is finished when the pool is idle
+void vw::CommandPool::collectRecycled(bool poolIdle)
+{
+	PooledBuffer* node = recycled.exchange(nullptr, std::memory_order_acquire);
+	while (node)
+	{
+		pendingBuffers.push_back(node);
+		node = node->next;
+	}
+
+	size_t kept = 0;
+	for (auto pendingBuffer : pendingBuffers)
+	{
+		if (poolIdle || pendingBuffer->future.isReady())
+			availableBuffers[(pendingBuffer->level == vk::CommandBufferLevel::ePrimary) ? 0 : 1].push_back(pendingBuffer);
+		else
+			pendingBuffers[kept++] = pendingBuffer;
+	}
+	pendingBuffers.resize(kept);
+}
+
+static std::atomic<uint64_t> threadCommandPoolsCounter(0);
+
+struct ThreadPoolCacheEntry
+{
+	uint64_t ownerId;
+	void* pools;
+};
+
+//Recently used pool lists of the calling thread, keeps the lookup off the mutex
+static thread_local ThreadPoolCacheEntry threadPoolCache[4] = {};
+static thread_local uint32_t threadPoolCacheNext = 0;
+
+vw::ThreadCommandPools::ThreadCommandPools(vk::Device device, uint32_t queueFamilyCount, uint32_t slotCount) : deviceHandle(device), familyCount(queueFamilyCount), slots(slotCount)
+{
+	ownerId = ++threadCommandPoolsCounter;
+	slotResets = std::make_unique<std::atomic<uint64_t>[]>(slots);
+	for (uint32_t i = 0; i < slots; ++i)
+		slotResets[i].store(0, std::memory_order_relaxed);
+}
+
+vw::CommandPool& vw::ThreadCommandPools::get(uint32_t queueFamilyIndex, uint32_t slot)
+{
+	PoolList& poolList = getThreadPools();
+	uint64_t resetCount = slotResets[slot].load(std::memory_order_acquire);
+	if (poolList.appliedResets[slot] != resetCount)
+		resetSlot(poolList, slot, resetCount);
+	return *poolList.pools[slot * familyCount + queueFamilyIndex];
+}
+
+//A pool is only ever reset by the thread recording into it, vkResetCommandPool needs the same external synchronization as recording
+void vw::ThreadCommandPools::reset(uint32_t slot)
+{
+	uint64_t resetCount = slotResets[slot].fetch_add(1, std::memory_order_acq_rel) + 1;
+	resetSlot(getThreadPools(), slot, resetCount);
+}
+
+void vw::ThreadCommandPools::resetSlot(PoolList& poolList, uint32_t slot, uint64_t resetCount)
+{
+	for (uint32_t i = 0; i < familyCount; ++i)
+		poolList.pools[slot * familyCount + i]->reset();
+	poolList.appliedResets[slot] = resetCount;
+}
+
+vw::ThreadCommandPools::PoolList& vw::ThreadCommandPools::getThreadPools()
+{
+	for (auto& entry : threadPoolCache)
+		if (entry.ownerId == ownerId)
+			return *static_cast<PoolList*>(entry.pools);
+
+	std::lock_guard<std::mutex> lock(poolMutex);
+	PoolList& poolList = threadPools[std::this_thread::get_id()];
+	if (poolList.pools.empty())
+	{
+		for (uint32_t i = 0; i < slots * familyCount; ++i)
+			poolList.pools.push_back(std::make_unique<vw::CommandPool>(deviceHandle, i % familyCount));
+		//New pools start out reset
+		for (uint32_t i = 0; i < slots; ++i)
+			poolList.appliedResets.push_back(slotResets[i].load(std::memory_order_acquire));
+	}
+
+	threadPoolCache[threadPoolCacheNext] = { ownerId, &poolList };
+	threadPoolCacheNext = (threadPoolCacheNext + 1) % 4;
+	return poolList;
+}
+
+vw::CommandBufferRecycler::CommandBufferRecycler(vw::Device& device, uint32_t frameCount) : deviceRef(device), framePools(device, device.getQueueFamilyCount(), frameCount), frames(frameCount)
+{
+}
+
+void vw::CommandBufferRecycler::nextFrame()
+{
+	frameIndex = (frameIndex + 1) % frames;
+	framePools.reset(frameIndex);
+}
+
+vw::CommandBuffer vw::CommandBufferRecycler::createCommandBuffer(uint32_t queueFamilyIndex, vk::CommandBufferLevel level)
+{
+	return vw::CommandBuffer(deviceRef, framePools.get(queueFamilyIndex, frameIndex), level, deviceRef.getQueueScheduler(queueFamilyIndex));
 }
 
-vw::CommandBufferSet::~CommandBufferSet()
+void vw::CommandBufferRecycler::reallocateCommandBuffer(vw::CommandBuffer& cmdBuffer, vk::CommandBufferLevel level)
 {
-	deviceHandle.freeCommandBuffers(poolHandle, this->size(), buffers.data());
+	cmdBuffer.reallocate(framePools.get(cmdBuffer.getQueueFamilyIndex(), frameIndex), level);
 }
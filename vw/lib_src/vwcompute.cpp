@@ -0,0 +1,137 @@
+#include "vwcompute.h"
+#include "vwjobs.h"
+#include <cstring>
+
+vw::ComputePipeline::ComputePipeline(vw::Device& device, vw::Shader& shader, vk::PipelineLayout layout, const vw::SpecializationData* specialization) : shaderRef(shader), givenLayout(layout), deviceRef(device)
+{
+	if (specialization)
+		specializationData = *specialization;
+	current = createPipeline();
+}
+
+vw::ComputePipeline::~ComputePipeline()
+{
+	//Rebuilds refer to the pipeline, they have to finish before anything is destroyed
+	if (rebuild.valid())
+		supersededRebuilds.push_back(rebuild);
+	for (auto& superseded : supersededRebuilds)
+	{
+		try
+		{
+			deviceRef.destroyPipeline(superseded.get().pipeline);
+		}
+		catch (const std::exception&)
+		{
+		}
+	}
+	destroyRetiredPipelines();
+	deviceRef.destroyPipeline(current.pipeline);
+}
+
+vw::ComputePipeline::PipelineState vw::ComputePipeline::createPipeline()
+{
+	PipelineState state;
+	const vw::ShaderReflection& reflection = shaderRef.getReflection();
+	std::copy(reflection.localSize, reflection.localSize + 3, state.localSize);
+	//Workgroup sizes given by spec constants take the specialized value
+	for (uint32_t i = 0; i < 3; ++i)
+		for (auto& entry : specializationData.entries)
+			if (reflection.localSizeSpecIds[i] != ~0u && entry.constantID == reflection.localSizeSpecIds[i])
+			{
+				if (entry.size != sizeof(uint32_t) || entry.offset + entry.size > specializationData.data.size())
+					throw std::runtime_error("VwComputePipeline: Workgroup size specialization has to be a 32 bit integer!");
+				memcpy(&state.localSize[i], specializationData.data.data() + entry.offset, sizeof(uint32_t));
+			}
+	state.layout = givenLayout ? givenLayout : deviceRef.getLayoutCache().getPipelineLayout(reflection);
+
+	vk::ComputePipelineCreateInfo pipelineCreateInfo;
+	pipelineCreateInfo.stage = shaderRef.getShaderStageInfo();
+	vk::SpecializationInfo specializationInfo;
+	if (!specializationData.entries.empty())
+	{
+		specializationInfo = vk::SpecializationInfo((uint32_t)specializationData.entries.size(), specializationData.entries.data(), specializationData.data.size(), specializationData.data.data());
+		pipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+	}
+	pipelineCreateInfo.layout = state.layout;
+	state.pipeline = deviceRef.createComputePipelines(deviceRef.getPipelineCache(), { pipelineCreateInfo })[0];
+	return state;
+}
+
+bool vw::ComputePipeline::rebuildPipeline(vw::Shader& shader)
+{
+	if (&shader != &shaderRef)
+		return false;
+	//A rebuild still in flight keeps running, its result is dropped in favor of this one
+	if (rebuild.valid())
+		supersededRebuilds.push_back(rebuild);
+	rebuild = deviceRef.getThreadPool().submit([this]() { return createPipeline(); }).share();
+	return true;
+}
+
+bool vw::ComputePipeline::swapPipeline()
+{
+	auto finished = [](std::shared_future<PipelineState>& state) { return state.wait_for(std::chrono::seconds(0)) == std::future_status::ready; };
+	for (auto superseded = supersededRebuilds.begin(); superseded != supersededRebuilds.end();)
+	{
+		if (!finished(*superseded))
+		{
+			++superseded;
+			continue;
+		}
+		try
+		{
+			deviceRef.destroyPipeline(superseded->get().pipeline);
+		}
+		catch (const std::exception&)
+		{
+		}
+		superseded = supersededRebuilds.erase(superseded);
+	}
+
+	if (!rebuild.valid() || !finished(rebuild))
+		return false;
+	std::shared_future<PipelineState> rebuilt = rebuild;
+	rebuild = std::shared_future<PipelineState>();
+	try
+	{
+		rebuilt.get();
+	}
+	catch (const std::exception& error)
+	{
+		//The previous pipeline stays in use until the shader is fixed
+		std::cerr << error.what() << std::endl;
+		return false;
+	}
+	//Frames in flight may still use the replaced pipeline
+	retiredPipelines.push_back(current.pipeline);
+	current = rebuilt.get();
+	return true;
+}
+
+void vw::ComputePipeline::destroyRetiredPipelines()
+{
+	for (auto pipeline : retiredPipelines)
+		deviceRef.destroyPipeline(pipeline);
+	retiredPipelines.clear();
+}
+
+vw::CommandBuffer vw::ComputePipeline::createCommandBuffer(vk::CommandBufferLevel level)
+{
+	return deviceRef.createCommandBuffer(deviceRef.getComputeQueueFamily(), level);
+}
+
+void vw::ComputePipeline::bind(vk::CommandBuffer cmdBuffer)
+{
+	cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, current.pipeline);
+}
+
+void vw::ComputePipeline::dispatchInvocations(vk::CommandBuffer cmdBuffer, uint32_t x, uint32_t y, uint32_t z)
+{
+	cmdBuffer.dispatch((x + current.localSize[0] - 1) / current.localSize[0], (y + current.localSize[1] - 1) / current.localSize[1], (z + current.localSize[2] - 1) / current.localSize[2]);
+}
+
+void vw::computeBarrier(vk::CommandBuffer cmdBuffer)
+{
+	vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+	cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), { barrier }, {}, {});
+}
@@ -0,0 +1,846 @@
+#include "vwdescriptor.h"
+#include "vwreflect.h"
+#include "vwmemory.h"
+#include <algorithm>
+#include <cstring>
+
+//Descriptors per set of each type for pools whose layouts are unknown
+static const std::pair<vk::DescriptorType, uint32_t> DefaultDescriptorRatios[] =
+{
+	{ vk::DescriptorType::eSampler, 1 },
+	{ vk::DescriptorType::eCombinedImageSampler, 4 },
+	{ vk::DescriptorType::eSampledImage, 2 },
+	{ vk::DescriptorType::eStorageImage, 1 },
+	{ vk::DescriptorType::eUniformTexelBuffer, 1 },
+	{ vk::DescriptorType::eStorageTexelBuffer, 1 },
+	{ vk::DescriptorType::eUniformBuffer, 2 },
+	{ vk::DescriptorType::eStorageBuffer, 2 },
+	{ vk::DescriptorType::eUniformBufferDynamic, 1 },
+	{ vk::DescriptorType::eStorageBufferDynamic, 1 },
+	{ vk::DescriptorType::eInputAttachment, 1 }
+};
+
+//Descriptors of each type in one set of the layout
+static std::map<vk::DescriptorType, uint32_t> countDescriptors(const std::vector<vk::DescriptorSetLayoutBinding>& bindings)
+{
+	std::map<vk::DescriptorType, uint32_t> descriptorCounts;
+	for (auto& binding : bindings)
+		descriptorCounts[binding.descriptorType] += binding.descriptorCount;
+	return descriptorCounts;
+}
+
+static std::atomic<uint64_t> descriptorAllocatorCounter(0);
+
+struct ArenaCacheEntry
+{
+	uint64_t ownerId;
+	void* arenas;
+};
+
+//Recently used arena lists of the calling thread, keeps the lookup off the mutex
+static thread_local ArenaCacheEntry arenaCache[4] = {};
+static thread_local uint32_t arenaCacheNext = 0;
+
+vw::DescriptorAllocator::DescriptorAllocator(vw::Device& device, uint32_t frameCount, uint32_t initialSetCount) : deviceRef(device), frames(frameCount), initialSets(initialSetCount), setsAllocated(0), poolGrowths(0), poolCount(0)
+{
+	ownerId = ++descriptorAllocatorCounter;
+}
+
+vw::DescriptorAllocator::~DescriptorAllocator()
+{
+	for (auto& arenas : threadArenas)
+		for (auto& arena : arenas.second)
+			for (auto pool : arena.pools)
+				deviceRef.destroyDescriptorPool(pool);
+}
+
+vk::DescriptorSet vw::DescriptorAllocator::allocate(vk::DescriptorSetLayout layout)
+{
+	Arena& arena = getThreadArenas()[frameIndex];
+	auto knownLayout = arena.layoutBindings.find(layout);
+	if (knownLayout == arena.layoutBindings.end())
+		knownLayout = arena.layoutBindings.emplace(layout, deviceRef.getLayoutCache().getBindings(layout)).first;
+
+	VkDescriptorSetLayout setLayout = layout;
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &setLayout;
+
+	//Running out of a pool is expected, so the result is checked instead of letting vulkan.hpp throw
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	allocateInfo.descriptorPool = arena.pools.back();
+	if (vkAllocateDescriptorSets(deviceRef, &allocateInfo, &descriptorSet) != VK_SUCCESS)
+	{
+		growArena(arena, knownLayout->second);
+		poolGrowths++;
+		allocateInfo.descriptorPool = arena.pools.back();
+		if (vkAllocateDescriptorSets(deviceRef, &allocateInfo, &descriptorSet) != VK_SUCCESS)
+			throw std::runtime_error("VwDescriptorAllocator: Set does not fit into a new pool!");
+	}
+
+	if (knownLayout->second)
+		for (auto& binding : *knownLayout->second)
+			arena.usage.descriptorCounts[binding.descriptorType] += binding.descriptorCount;
+	arena.usage.setCount++;
+	setsAllocated++;
+	return descriptorSet;
+}
+
+void vw::DescriptorAllocator::nextFrame()
+{
+	frameIndex = (frameIndex + 1) % frames;
+	std::lock_guard<std::mutex> lock(arenaMutex);
+	for (auto& arenas : threadArenas)
+		resetArena(arenas.second[frameIndex]);
+}
+
+vw::DescriptorAllocatorStatistics vw::DescriptorAllocator::getStatistics()
+{
+	vw::DescriptorAllocatorStatistics statistics;
+	statistics.setsAllocated = setsAllocated;
+	statistics.poolGrowths = poolGrowths;
+	statistics.poolCount = poolCount;
+	return statistics;
+}
+
+vw::DescriptorAllocator::ArenaList& vw::DescriptorAllocator::getThreadArenas()
+{
+	for (auto& entry : arenaCache)
+		if (entry.ownerId == ownerId)
+			return *static_cast<ArenaList*>(entry.arenas);
+
+	std::lock_guard<std::mutex> lock(arenaMutex);
+	ArenaList& arenas = threadArenas[std::this_thread::get_id()];
+	if (arenas.empty())
+	{
+		arenas.resize(frames);
+		for (auto& arena : arenas)
+		{
+			arena.nextSetCount = initialSets;
+			growArena(arena);
+		}
+	}
+
+	arenaCache[arenaCacheNext] = { ownerId, &arenas };
+	arenaCacheNext = (arenaCacheNext + 1) % 4;
+	return arenas;
+}
+
+//Default ratios per set, raised to what the arena used of each type plus headroom and to the required set
+vw::DescriptorAllocator::PoolSizing vw::DescriptorAllocator::sizePool(uint32_t setCount, const PoolSizing& usage, uint32_t headroomDivisor, const std::vector<vk::DescriptorSetLayoutBinding>* requiredBindings)
+{
+	PoolSizing sizing;
+	sizing.setCount = setCount;
+	for (auto& ratio : DefaultDescriptorRatios)
+		sizing.descriptorCounts[ratio.first] = ratio.second * setCount;
+	for (auto& descriptorCount : usage.descriptorCounts)
+		sizing.descriptorCounts[descriptorCount.first] = std::max(sizing.descriptorCounts[descriptorCount.first], descriptorCount.second + descriptorCount.second / headroomDivisor);
+	//Large arrays or types without a default ratio would otherwise never fit
+	if (requiredBindings)
+		for (auto& descriptorCount : countDescriptors(*requiredBindings))
+			sizing.descriptorCounts[descriptorCount.first] = std::max(sizing.descriptorCounts[descriptorCount.first], descriptorCount.second);
+	return sizing;
+}
+
+vk::DescriptorPool vw::DescriptorAllocator::createPool(const PoolSizing& sizing)
+{
+	std::vector<vk::DescriptorPoolSize> poolSizes;
+	for (auto& descriptorCount : sizing.descriptorCounts)
+		if (descriptorCount.second)
+			poolSizes.push_back(vk::DescriptorPoolSize(descriptorCount.first, descriptorCount.second));
+
+	vk::DescriptorPoolCreateInfo poolCreateInfo;
+	poolCreateInfo.maxSets = sizing.setCount;
+	poolCreateInfo.poolSizeCount = (uint32_t)poolSizes.size();
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+	return deviceRef.createDescriptorPool(poolCreateInfo);
+}
+
+//Each chained pool is twice as large as the previous one
+void vw::DescriptorAllocator::growArena(Arena& arena, const std::vector<vk::DescriptorSetLayoutBinding>* requiredBindings)
+{
+	arena.pools.push_back(createPool(sizePool(arena.nextSetCount, arena.usage, 1, requiredBindings)));
+	poolCount++;
+	arena.nextSetCount *= 2;
+}
+
+void vw::DescriptorAllocator::resetArena(Arena& arena)
+{
+	if (arena.pools.size() == 1)
+		deviceRef.resetDescriptorPool(arena.pools[0]);
+	else
+	{
+		//The chain is replaced by one pool covering the usage of the last frame with a quarter of headroom
+		for (auto pool : arena.pools)
+			deviceRef.destroyDescriptorPool(pool);
+		uint32_t setCount = std::max(initialSets, arena.usage.setCount + arena.usage.setCount / 4);
+		poolCount -= (uint32_t)arena.pools.size() - 1;
+		arena.pools = { createPool(sizePool(setCount, arena.usage, 4)) };
+		arena.nextSetCount = setCount * 2;
+	}
+	arena.usage = PoolSizing();
+}
+
+vw::DescriptorData& vw::DescriptorSetBindings::set(uint32_t binding, uint32_t arrayElement)
+{
+	Entry* entry = nullptr;
+	for (auto& existing : entries)
+		if (existing.binding == binding && existing.arrayElement == arrayElement)
+			entry = &existing;
+	if (!entry)
+	{
+		entries.push_back(Entry());
+		entry = &entries.back();
+		entry->binding = binding;
+		entry->arrayElement = arrayElement;
+	}
+	memset(&entry->data, 0, sizeof(vw::DescriptorData));
+	return entry->data;
+}
+
+void vw::DescriptorSetBindings::setBuffer(uint32_t binding, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range, uint32_t arrayElement)
+{
+	vw::DescriptorData& data = set(binding, arrayElement);
+	data.buffer.buffer = buffer;
+	data.buffer.offset = offset;
+	data.buffer.range = range;
+}
+
+void vw::DescriptorSetBindings::setImage(uint32_t binding, vk::ImageView imageView, vk::ImageLayout imageLayout, vk::Sampler sampler, uint32_t arrayElement)
+{
+	vw::DescriptorData& data = set(binding, arrayElement);
+	data.image.sampler = sampler;
+	data.image.imageView = imageView;
+	data.image.imageLayout = static_cast<VkImageLayout>(imageLayout);
+}
+
+void vw::DescriptorSetBindings::setSampler(uint32_t binding, vk::Sampler sampler, uint32_t arrayElement)
+{
+	set(binding, arrayElement).image.sampler = sampler;
+}
+
+void vw::DescriptorSetBindings::setTexelBuffer(uint32_t binding, vk::BufferView bufferView, uint32_t arrayElement)
+{
+	set(binding, arrayElement).texelBufferView = bufferView;
+}
+
+vw::DescriptorSetCache::DescriptorSetCache(vw::Device& device, uint32_t maxAge, uint32_t poolSetCount) : deviceRef(device), maximumAge(maxAge), setsPerPool(poolSetCount)
+{
+	//Update templates are core in Vulkan 1.1, older devices write each descriptor with vkUpdateDescriptorSets
+#ifdef VK_VERSION_1_1
+	updateTemplates = deviceRef.getApiVersion() >= VK_API_VERSION_1_1;
+#else
+	updateTemplates = false;
+#endif
+	destructionListener = deviceRef.addDestructionListener([this](vk::DebugReportObjectTypeEXT objectType, uint64_t handle)
+	{
+		if (objectType == vk::DebugReportObjectTypeEXT::eBuffer)
+			invalidate(vk::Buffer(reinterpret_cast<VkBuffer>(handle)));
+		else if (objectType == vk::DebugReportObjectTypeEXT::eImageView)
+			invalidate(vk::ImageView(reinterpret_cast<VkImageView>(handle)));
+	});
+}
+
+vw::DescriptorSetCache::~DescriptorSetCache()
+{
+	deviceRef.removeDestructionListener(destructionListener);
+#ifdef VK_VERSION_1_1
+	for (auto& writer : layoutWriters)
+		if (writer.second.updateTemplate)
+			vkDestroyDescriptorUpdateTemplate(deviceRef, writer.second.updateTemplate, nullptr);
+#endif
+	for (auto pool : pools)
+		deviceRef.destroyDescriptorPool(pool);
+}
+
+void vw::DescriptorSetCache::addLayout(vk::DescriptorSetLayout layout, std::vector<vk::DescriptorSetLayoutBinding> bindings)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	if (!layoutWriters.count(layout))
+		createLayoutWriter(layout, bindings);
+}
+
+vk::DescriptorSet vw::DescriptorSetCache::getSet(vw::PipelineLayout& pipelineLayout, uint32_t setIndex, const vw::DescriptorSetBindings& bindings)
+{
+	return getSet(pipelineLayout.getSetLayout(setIndex), bindings);
+}
+
+vk::DescriptorSet vw::DescriptorSetCache::getSet(vk::DescriptorSetLayout layout, const vw::DescriptorSetBindings& bindings)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	LayoutWriter& writer = getLayoutWriter(layout);
+
+	std::vector<vw::DescriptorData> data(writer.slotCount);
+	std::vector<bool> written(writer.slotCount, false);
+	memset(data.data(), 0, data.size() * sizeof(vw::DescriptorData));
+	for (auto& entry : bindings.entries)
+	{
+		auto firstSlot = writer.firstSlots.find(entry.binding);
+		if (firstSlot == writer.firstSlots.end())
+			throw std::runtime_error("VwDescriptorSetCache: Binding is not part of the layout!");
+		if (entry.arrayElement >= writer.descriptorCounts[entry.binding])
+			throw std::runtime_error("VwDescriptorSetCache: Array element is outside of the binding!");
+		uint32_t slot = firstSlot->second + entry.arrayElement;
+		data[slot] = entry.data;
+		written[slot] = true;
+	}
+	if (std::find(written.begin(), written.end(), false) != written.end())
+		throw std::runtime_error("VwDescriptorSetCache: Every descriptor of the layout has to be bound!");
+
+	uint64_t key = vw::hashValue(static_cast<VkDescriptorSetLayout>(layout), vw::hashBytes(data.data(), data.size() * sizeof(vw::DescriptorData)));
+	auto range = cachedSets.equal_range(key);
+	for (auto cached = range.first; cached != range.second; ++cached)
+		if (cached->second.layout == layout && memcmp(cached->second.data.data(), data.data(), data.size() * sizeof(vw::DescriptorData)) == 0)
+		{
+			cached->second.lastUsedFrame = frame;
+			statistics.hits++;
+			return cached->second.set;
+		}
+
+	CachedSet cachedSet;
+	cachedSet.set = allocateSet(layout, writer, cachedSet.pool);
+	writeSet(writer, cachedSet.set, data);
+	cachedSet.layout = layout;
+	cachedSet.data = std::move(data);
+	cachedSet.lastUsedFrame = frame;
+	cachedSets.emplace(key, cachedSet);
+	statistics.misses++;
+	return cachedSet.set;
+}
+
+void vw::DescriptorSetCache::nextFrame()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	frame++;
+	for (auto cached = cachedSets.begin(); cached != cachedSets.end();)
+	{
+		if (frame - cached->second.lastUsedFrame > maximumAge)
+		{
+			deviceRef.freeDescriptorSets(cached->second.pool, { cached->second.set });
+			cached = cachedSets.erase(cached);
+			statistics.evictions++;
+		}
+		else
+			++cached;
+	}
+}
+
+void vw::DescriptorSetCache::invalidate(vk::Buffer buffer)
+{
+	VkBuffer handle = buffer;
+	invalidateWhere([handle](vk::DescriptorType type, const vw::DescriptorData& data)
+	{
+		return (type == vk::DescriptorType::eUniformBuffer || type == vk::DescriptorType::eStorageBuffer || type == vk::DescriptorType::eUniformBufferDynamic || type == vk::DescriptorType::eStorageBufferDynamic) && data.buffer.buffer == handle;
+	});
+}
+
+void vw::DescriptorSetCache::invalidate(vk::ImageView imageView)
+{
+	VkImageView handle = imageView;
+	invalidateWhere([handle](vk::DescriptorType type, const vw::DescriptorData& data)
+	{
+		return (type == vk::DescriptorType::eCombinedImageSampler || type == vk::DescriptorType::eSampledImage || type == vk::DescriptorType::eStorageImage || type == vk::DescriptorType::eInputAttachment) && data.image.imageView == handle;
+	});
+}
+
+void vw::DescriptorSetCache::invalidate(vk::Sampler sampler)
+{
+	VkSampler handle = sampler;
+	invalidateWhere([handle](vk::DescriptorType type, const vw::DescriptorData& data)
+	{
+		return (type == vk::DescriptorType::eSampler || type == vk::DescriptorType::eCombinedImageSampler) && data.image.sampler == handle;
+	});
+}
+
+void vw::DescriptorSetCache::invalidate(vk::BufferView bufferView)
+{
+	VkBufferView handle = bufferView;
+	invalidateWhere([handle](vk::DescriptorType type, const vw::DescriptorData& data)
+	{
+		return (type == vk::DescriptorType::eUniformTexelBuffer || type == vk::DescriptorType::eStorageTexelBuffer) && data.texelBufferView == handle;
+	});
+}
+
+//A handle value may be reused by a new resource, so sets must not outlive the resources they were written with
+void vw::DescriptorSetCache::invalidateWhere(std::function<bool(vk::DescriptorType, const vw::DescriptorData&)> usesResource)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	for (auto cached = cachedSets.begin(); cached != cachedSets.end();)
+	{
+		LayoutWriter& writer = layoutWriters.at(cached->second.layout);
+		bool used = false;
+		for (auto& binding : writer.bindings)
+			for (uint32_t i = 0; i < binding.descriptorCount && !used; ++i)
+				used = usesResource(binding.descriptorType, cached->second.data[writer.firstSlots[binding.binding] + i]);
+
+		if (used)
+		{
+			deviceRef.freeDescriptorSets(cached->second.pool, { cached->second.set });
+			cached = cachedSets.erase(cached);
+			statistics.evictions++;
+		}
+		else
+			++cached;
+	}
+}
+
+vw::DescriptorSetCacheStatistics vw::DescriptorSetCache::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	vw::DescriptorSetCacheStatistics current = statistics;
+	current.liveSets = cachedSets.size();
+	return current;
+}
+
+vw::DescriptorSetCache::LayoutWriter& vw::DescriptorSetCache::getLayoutWriter(vk::DescriptorSetLayout layout)
+{
+	auto found = layoutWriters.find(layout);
+	if (found != layoutWriters.end())
+		return found->second;
+
+	auto bindings = deviceRef.getLayoutCache().getBindings(layout);
+	if (!bindings)
+		throw std::runtime_error("VwDescriptorSetCache: Layout was neither created by the device layout cache nor added!");
+	return createLayoutWriter(layout, *bindings);
+}
+
+vw::DescriptorSetCache::LayoutWriter& vw::DescriptorSetCache::createLayoutWriter(vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorSetLayoutBinding>& bindings)
+{
+	LayoutWriter& writer = layoutWriters[layout];
+	writer.bindings = bindings;
+	for (auto& binding : writer.bindings)
+	{
+		writer.firstSlots[binding.binding] = writer.slotCount;
+		writer.descriptorCounts[binding.binding] = binding.descriptorCount;
+		writer.slotCount += binding.descriptorCount;
+	}
+
+#ifdef VK_VERSION_1_1
+	if (updateTemplates)
+	{
+		std::vector<VkDescriptorUpdateTemplateEntry> templateEntries;
+		for (auto& binding : writer.bindings)
+		{
+			VkDescriptorUpdateTemplateEntry templateEntry = {};
+			templateEntry.dstBinding = binding.binding;
+			templateEntry.descriptorCount = binding.descriptorCount;
+			templateEntry.descriptorType = static_cast<VkDescriptorType>(binding.descriptorType);
+			templateEntry.offset = writer.firstSlots[binding.binding] * sizeof(vw::DescriptorData);
+			templateEntry.stride = sizeof(vw::DescriptorData);
+			templateEntries.push_back(templateEntry);
+		}
+
+		VkDescriptorUpdateTemplateCreateInfo templateCreateInfo = {};
+		templateCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+		templateCreateInfo.descriptorUpdateEntryCount = (uint32_t)templateEntries.size();
+		templateCreateInfo.pDescriptorUpdateEntries = templateEntries.data();
+		templateCreateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+		templateCreateInfo.descriptorSetLayout = layout;
+		if (vkCreateDescriptorUpdateTemplate(deviceRef, &templateCreateInfo, nullptr, &writer.updateTemplate) != VK_SUCCESS)
+			writer.updateTemplate = VK_NULL_HANDLE;
+	}
+#endif
+	return writer;
+}
+
+//Pools allow freeing single sets so aged sets can be returned
+vk::DescriptorSet vw::DescriptorSetCache::allocateSet(vk::DescriptorSetLayout layout, const LayoutWriter& writer, vk::DescriptorPool& pool)
+{
+	VkDescriptorSetLayout setLayout = layout;
+	VkDescriptorSetAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &setLayout;
+
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	for (auto candidate = pools.rbegin(); candidate != pools.rend(); ++candidate)
+	{
+		allocateInfo.descriptorPool = *candidate;
+		if (vkAllocateDescriptorSets(deviceRef, &allocateInfo, &descriptorSet) == VK_SUCCESS)
+		{
+			pool = *candidate;
+			return descriptorSet;
+		}
+	}
+
+	//A new pool holds setsPerPool sets of the requested layout, the default ratios leave room for other layouts
+	std::map<vk::DescriptorType, uint32_t> descriptorCounts = countDescriptors(writer.bindings);
+	for (auto& ratio : DefaultDescriptorRatios)
+		descriptorCounts[ratio.first] = std::max(descriptorCounts[ratio.first], ratio.second);
+	std::vector<vk::DescriptorPoolSize> poolSizes;
+	for (auto& descriptorCount : descriptorCounts)
+		poolSizes.push_back(vk::DescriptorPoolSize(descriptorCount.first, descriptorCount.second * setsPerPool));
+	vk::DescriptorPoolCreateInfo poolCreateInfo;
+	poolCreateInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+	poolCreateInfo.maxSets = setsPerPool;
+	poolCreateInfo.poolSizeCount = (uint32_t)poolSizes.size();
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+	pools.push_back(deviceRef.createDescriptorPool(poolCreateInfo));
+
+	allocateInfo.descriptorPool = pools.back();
+	if (vkAllocateDescriptorSets(deviceRef, &allocateInfo, &descriptorSet) != VK_SUCCESS)
+		throw std::runtime_error("VwDescriptorSetCache: Set does not fit into a new pool!");
+	pool = pools.back();
+	return descriptorSet;
+}
+
+void vw::DescriptorSetCache::writeSet(LayoutWriter& writer, vk::DescriptorSet set, const std::vector<vw::DescriptorData>& data)
+{
+#ifdef VK_VERSION_1_1
+	if (writer.updateTemplate)
+	{
+		vkUpdateDescriptorSetWithTemplate(deviceRef, set, writer.updateTemplate, data.data());
+		return;
+	}
+#endif
+
+	std::vector<VkWriteDescriptorSet> writes;
+	for (auto& binding : writer.bindings)
+		for (uint32_t i = 0; i < binding.descriptorCount; ++i)
+		{
+			const vw::DescriptorData& descriptor = data[writer.firstSlots[binding.binding] + i];
+			VkWriteDescriptorSet write = {};
+			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write.dstSet = set;
+			write.dstBinding = binding.binding;
+			write.dstArrayElement = i;
+			write.descriptorCount = 1;
+			write.descriptorType = static_cast<VkDescriptorType>(binding.descriptorType);
+			write.pImageInfo = &descriptor.image;
+			write.pBufferInfo = &descriptor.buffer;
+			write.pTexelBufferView = &descriptor.texelBufferView;
+			writes.push_back(write);
+		}
+	vkUpdateDescriptorSets(deviceRef, (uint32_t)writes.size(), writes.data(), 0, nullptr);
+}
+
+vw::BindlessHeap::BindlessHeap(vw::Device& device, uint32_t imageCapacity, uint32_t bufferCapacity, uint32_t frameCount) : deviceRef(device), descriptorIndexing(device.supportsDescriptorIndexing()), frames(frameCount)
+{
+	//Combined image samplers count as sampled images and as samplers, the set is visible to every stage
+	vk::PhysicalDeviceLimits limits = deviceRef.getPhysicalDevice().getProperties().limits;
+	uint32_t maxImages = std::min({ limits.maxPerStageDescriptorSampledImages, limits.maxPerStageDescriptorSamplers, limits.maxDescriptorSetSampledImages, limits.maxDescriptorSetSamplers });
+	uint32_t maxBuffers = std::min(limits.maxPerStageDescriptorStorageBuffers, limits.maxDescriptorSetStorageBuffers);
+	uint32_t maxResources = limits.maxPerStageResources;
+#ifdef VK_VERSION_1_2
+	if (descriptorIndexing)
+	{
+		vk::PhysicalDeviceVulkan12Properties vulkan12Properties;
+		vk::PhysicalDeviceProperties2 properties2;
+		properties2.pNext = &vulkan12Properties;
+		deviceRef.getPhysicalDevice().getProperties2(&properties2);
+		maxImages = std::min({ vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages, vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSamplers, vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages, vulkan12Properties.maxDescriptorSetUpdateAfterBindSamplers });
+		maxBuffers = std::min(vulkan12Properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers, vulkan12Properties.maxDescriptorSetUpdateAfterBindStorageBuffers);
+		maxResources = vulkan12Properties.maxPerStageUpdateAfterBindResources;
+	}
+#endif
+
+	images.binding = imageBinding;
+	images.type = vk::DescriptorType::eCombinedImageSampler;
+	images.capacity = std::max(1u, std::min(imageCapacity, maxImages));
+	buffers.binding = bufferBinding;
+	buffers.type = vk::DescriptorType::eStorageBuffer;
+	buffers.capacity = std::max(1u, std::min(bufferCapacity, maxBuffers));
+
+	//Images and buffers share the per stage resource limit, both arrays give up capacity in proportion to their size
+	if ((uint64_t)images.capacity + buffers.capacity > maxResources)
+	{
+		uint32_t imageShare = (uint32_t)((uint64_t)maxResources * images.capacity / ((uint64_t)images.capacity + buffers.capacity));
+		images.capacity = std::max(1u, imageShare);
+		buffers.capacity = std::max(1u, maxResources - images.capacity);
+	}
+	for (SlotArray* slots : { &images, &buffers })
+	{
+		slots->descriptors.resize(slots->capacity);
+		memset(slots->descriptors.data(), 0, slots->capacity * sizeof(vw::DescriptorData));
+		slots->used.resize(slots->capacity, false);
+		slots->retiredSlots.resize(frames);
+	}
+
+	std::vector<vk::DescriptorSetLayoutBinding> bindings =
+	{
+		vk::DescriptorSetLayoutBinding(imageBinding, images.type, images.capacity, vk::ShaderStageFlagBits::eAll),
+		vk::DescriptorSetLayoutBinding(bufferBinding, buffers.type, buffers.capacity, vk::ShaderStageFlagBits::eAll)
+	};
+	vk::DescriptorSetLayoutCreateInfo layoutCreateInfo;
+	layoutCreateInfo.bindingCount = (uint32_t)bindings.size();
+	layoutCreateInfo.pBindings = bindings.data();
+
+	uint32_t setCount = descriptorIndexing ? 1 : frames;
+	vk::DescriptorPoolCreateInfo poolCreateInfo;
+	poolCreateInfo.maxSets = setCount;
+
+#ifdef VK_VERSION_1_2
+	std::vector<vk::DescriptorBindingFlags> bindingFlags(bindings.size(), vk::DescriptorBindingFlagBits::eUpdateAfterBind | vk::DescriptorBindingFlagBits::ePartiallyBound | vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending);
+	vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo;
+	bindingFlagsInfo.bindingCount = (uint32_t)bindingFlags.size();
+	bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+	if (descriptorIndexing)
+	{
+		layoutCreateInfo.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool;
+		layoutCreateInfo.pNext = &bindingFlagsInfo;
+		poolCreateInfo.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind;
+	}
+#endif
+	setLayout = deviceRef.createDescriptorSetLayout(layoutCreateInfo);
+
+	std::vector<vk::DescriptorPoolSize> poolSizes =
+	{
+		vk::DescriptorPoolSize(images.type, images.capacity * setCount),
+		vk::DescriptorPoolSize(buffers.type, buffers.capacity * setCount)
+	};
+	poolCreateInfo.poolSizeCount = (uint32_t)poolSizes.size();
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+	pool = deviceRef.createDescriptorPool(poolCreateInfo);
+
+	std::vector<vk::DescriptorSetLayout> setLayouts(setCount, setLayout);
+	vk::DescriptorSetAllocateInfo allocateInfo;
+	allocateInfo.descriptorPool = pool;
+	allocateInfo.descriptorSetCount = setCount;
+	allocateInfo.pSetLayouts = setLayouts.data();
+	for (auto set : deviceRef.allocateDescriptorSets(allocateInfo))
+	{
+		SetState setState;
+		setState.set = set;
+		for (uint32_t binding : { imageBinding, bufferBinding })
+			memset(&setState.writtenFiller[binding], 0, sizeof(vw::DescriptorData));
+		sets.push_back(setState);
+	}
+}
+
+vw::BindlessHeap::~BindlessHeap()
+{
+	deviceRef.destroyDescriptorPool(pool);
+	deviceRef.destroyDescriptorSetLayout(setLayout);
+}
+
+uint32_t vw::BindlessHeap::addImage(vk::ImageView imageView, vk::Sampler sampler, vk::ImageLayout imageLayout)
+{
+	vw::DescriptorData data;
+	memset(&data, 0, sizeof(vw::DescriptorData));
+	data.image.sampler = sampler;
+	data.image.imageView = imageView;
+	data.image.imageLayout = static_cast<VkImageLayout>(imageLayout);
+	std::lock_guard<std::mutex> lock(heapMutex);
+	return addSlot(images, data);
+}
+
+uint32_t vw::BindlessHeap::addImage(vw::ImageBase& image, vk::Sampler sampler, vk::ImageAspectFlags aspectFlags, vk::ImageLayout imageLayout)
+{
+	return addImage(image.createView(aspectFlags), sampler, imageLayout);
+}
+
+uint32_t vw::BindlessHeap::addBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range)
+{
+	vw::DescriptorData data;
+	memset(&data, 0, sizeof(vw::DescriptorData));
+	data.buffer.buffer = buffer;
+	data.buffer.offset = offset;
+	data.buffer.range = range;
+	std::lock_guard<std::mutex> lock(heapMutex);
+	return addSlot(buffers, data);
+}
+
+void vw::BindlessHeap::removeImage(uint32_t slot)
+{
+	std::lock_guard<std::mutex> lock(heapMutex);
+	removeSlot(images, slot);
+}
+
+void vw::BindlessHeap::removeBuffer(uint32_t slot)
+{
+	std::lock_guard<std::mutex> lock(heapMutex);
+	removeSlot(buffers, slot);
+}
+
+void vw::BindlessHeap::nextFrame()
+{
+	std::lock_guard<std::mutex> lock(heapMutex);
+	frameIndex = (frameIndex + 1) % frames;
+	for (SlotArray* slots : { &images, &buffers })
+	{
+		auto& retired = slots->retiredSlots[frameIndex];
+		slots->freeSlots.insert(slots->freeSlots.end(), retired.begin(), retired.end());
+		retired.clear();
+	}
+	sets[descriptorIndexing ? 0 : frameIndex].handedOut = false;
+}
+
+vk::DescriptorSet vw::BindlessHeap::getSet()
+{
+	std::lock_guard<std::mutex> lock(heapMutex);
+	SetState& setState = sets[descriptorIndexing ? 0 : frameIndex];
+	//Without update after bind the copy may only be written before it is first bound in its frame
+	if (!setState.handedOut)
+		writeSet(setState);
+	setState.handedOut = true;
+	return setState.set;
+}
+
+void vw::BindlessHeap::bind(vk::CommandBuffer cmdBuffer, vk::PipelineLayout pipelineLayout, uint32_t setIndex, vk::PipelineBindPoint bindPoint)
+{
+	cmdBuffer.bindDescriptorSets(bindPoint, pipelineLayout, setIndex, { getSet() }, {});
+}
+
+uint32_t vw::BindlessHeap::addSlot(SlotArray& slots, const vw::DescriptorData& data)
+{
+	uint32_t slot;
+	if (!slots.freeSlots.empty())
+	{
+		slot = slots.freeSlots.back();
+		slots.freeSlots.pop_back();
+	}
+	else if (slots.nextSlot < slots.capacity)
+		slot = slots.nextSlot++;
+	else
+		throw std::runtime_error("VwBindlessHeap: No free slot left!");
+
+	slots.descriptors[slot] = data;
+	slots.used[slot] = true;
+	markPending(slots, slot);
+	//Recycled slots are no longer read by pending command buffers, so they can be written while the set is bound
+	if (descriptorIndexing)
+		writeSlots(sets[0], slots);
+	return slot;
+}
+
+void vw::BindlessHeap::removeSlot(SlotArray& slots, uint32_t slot)
+{
+	if (slot >= slots.capacity || !slots.used[slot])
+		throw std::runtime_error("VwBindlessHeap: Slot is not in use!");
+	slots.used[slot] = false;
+	memset(&slots.descriptors[slot], 0, sizeof(vw::DescriptorData));
+	slots.retiredSlots[frameIndex].push_back(slot);
+	//Partially bound arrays may keep the stale descriptor since nothing reads it anymore
+	if (!descriptorIndexing)
+		markPending(slots, slot);
+}
+
+void vw::BindlessHeap::markPending(SlotArray& slots, uint32_t slot)
+{
+	for (auto& setState : sets)
+		setState.pendingSlots[slots.binding].insert(slot);
+}
+
+void vw::BindlessHeap::writeSet(SetState& setState)
+{
+	writeSlots(setState, images);
+	writeSlots(setState, buffers);
+}
+
+void vw::BindlessHeap::writeSlots(SetState& setState, SlotArray& slots)
+{
+	std::set<uint32_t>& pending = setState.pendingSlots[slots.binding];
+	vw::DescriptorData filler;
+	memset(&filler, 0, sizeof(vw::DescriptorData));
+	bool hasFiller = false;
+
+	//Empty slots of a fully bound array repeat the lowest live descriptor and are all rewritten when it changes
+	if (!descriptorIndexing)
+	{
+		auto firstUsed = std::find(slots.used.begin(), slots.used.end(), true);
+		hasFiller = firstUsed != slots.used.end();
+		if (hasFiller)
+			filler = slots.descriptors[firstUsed - slots.used.begin()];
+		if (memcmp(&filler, &setState.writtenFiller[slots.binding], sizeof(vw::DescriptorData)) != 0)
+		{
+			for (uint32_t slot = 0; slot < slots.capacity; ++slot)
+				if (!slots.used[slot])
+					pending.insert(slot);
+			setState.writtenFiller[slots.binding] = filler;
+		}
+	}
+	if (pending.empty())
+		return;
+
+	//Consecutive slots are written as one array range
+	std::vector<VkDescriptorImageInfo> imageInfos;
+	std::vector<VkDescriptorBufferInfo> bufferInfos;
+	imageInfos.reserve(pending.size());
+	bufferInfos.reserve(pending.size());
+	std::vector<VkWriteDescriptorSet> writes;
+	uint32_t previousSlot = 0;
+	for (uint32_t slot : pending)
+	{
+		if (!slots.used[slot] && !hasFiller)
+			continue;
+		const vw::DescriptorData& data = slots.used[slot] ? slots.descriptors[slot] : filler;
+		if (writes.empty() || slot != previousSlot + 1)
+		{
+			VkWriteDescriptorSet write = {};
+			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write.dstSet = setState.set;
+			write.dstBinding = slots.binding;
+			write.dstArrayElement = slot;
+			write.descriptorType = static_cast<VkDescriptorType>(slots.type);
+			write.pImageInfo = imageInfos.data() + imageInfos.size();
+			write.pBufferInfo = bufferInfos.data() + bufferInfos.size();
+			writes.push_back(write);
+		}
+		writes.back().descriptorCount++;
+		if (slots.type == vk::DescriptorType::eCombinedImageSampler)
+			imageInfos.push_back(data.image);
+		else
+			bufferInfos.push_back(data.buffer);
+		previousSlot = slot;
+	}
+	pending.clear();
+	if (!writes.empty())
+		vkUpdateDescriptorSets(deviceRef, (uint32_t)writes.size(), writes.data(), 0, nullptr);
+}
+
+//Lower bound of maxPushDescriptors, larger layouts take the allocator path
+static const uint32_t GuaranteedPushDescriptors = 32;
+
+vw::PushDescriptorSet::PushDescriptorSet(vw::Device& device, std::vector<vk::DescriptorSetLayoutBinding> bindings) : deviceRef(device), layoutBindings(bindings)
+{
+	uint32_t descriptorCount = 0;
+	for (auto& binding : layoutBindings)
+		descriptorCount += binding.descriptorCount;
+
+	vk::DescriptorSetLayoutCreateFlags layoutFlags;
+#ifdef VK_KHR_push_descriptor
+	if (deviceRef.isExtensionEnabled(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME) && descriptorCount <= GuaranteedPushDescriptors)
+	{
+		pushDescriptorSet = (PFN_vkCmdPushDescriptorSetKHR)vkGetDeviceProcAddr(deviceRef, "vkCmdPushDescriptorSetKHR");
+		if (pushDescriptorSet)
+			layoutFlags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR;
+	}
+#endif
+	setLayout = deviceRef.getLayoutCache().getSetLayout(layoutBindings, layoutFlags);
+}
+
+void vw::PushDescriptorSet::push(vk::CommandBuffer cmdBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipelineLayout, uint32_t setIndex, const vw::DescriptorSetBindings& bindings, vw::DescriptorAllocator& allocator)
+{
+	vk::DescriptorSet set;
+	if (!pushDescriptorSet)
+		set = allocator.allocate(setLayout);
+
+	//Write infos point into the bindings, which outlive the call
+	std::vector<VkWriteDescriptorSet> writes;
+	for (auto& entry : bindings.entries)
+	{
+		auto layoutBinding = std::find_if(layoutBindings.begin(), layoutBindings.end(), [&](const vk::DescriptorSetLayoutBinding& binding) { return binding.binding == entry.binding; });
+		if (layoutBinding == layoutBindings.end() || entry.arrayElement >= layoutBinding->descriptorCount)
+			throw std::runtime_error("VwPushDescriptorSet: Binding is not part of the layout!");
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = entry.binding;
+		write.dstArrayElement = entry.arrayElement;
+		write.descriptorCount = 1;
+		write.descriptorType = static_cast<VkDescriptorType>(layoutBinding->descriptorType);
+		write.pImageInfo = &entry.data.image;
+		write.pBufferInfo = &entry.data.buffer;
+		write.pTexelBufferView = &entry.data.texelBufferView;
+		writes.push_back(write);
+	}
+
+	if (pushDescriptorSet)
+	{
+		pushDescriptorSet(cmdBuffer, static_cast<VkPipelineBindPoint>(bindPoint), pipelineLayout, setIndex, (uint32_t)writes.size(), writes.data());
+		return;
+	}
+	vkUpdateDescriptorSets(deviceRef, (uint32_t)writes.size(), writes.data(), 0, nullptr);
+	cmdBuffer.bindDescriptorSets(bindPoint, pipelineLayout, setIndex, { set }, {});
+}
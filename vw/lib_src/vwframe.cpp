@@ -0,0 +1,85 @@
+#include "vwframe.h"
+
+vw::FrameContext::FrameContext(vw::Device& device, vw::FrameRing& ring, uint32_t index) : imageAcquired(device), renderFinished(device), ringRef(ring), frameIndex(index), fence(device)
+{
+}
+
+vw::CommandBuffer& vw::FrameContext::createCommandBuffer(uint32_t queueFamilyIndex, vk::CommandBufferLevel level)
+{
+	//Reusing the objects of the last use of the slot keeps their storage, recording a frame does not allocate once warmed up
+	if (usedCommandBuffers == commandBuffers.size())
+		commandBuffers.emplace_back(ringRef.recycler.createCommandBuffer(queueFamilyIndex, level));
+	else if (commandBuffers[usedCommandBuffers].getQueueFamilyIndex() == queueFamilyIndex)
+		ringRef.recycler.reallocateCommandBuffer(commandBuffers[usedCommandBuffers], level);
+	else
+		commandBuffers[usedCommandBuffers] = ringRef.recycler.createCommandBuffer(queueFamilyIndex, level);
+	return commandBuffers[usedCommandBuffers++];
+}
+
+vw::StagingRegion vw::FrameContext::allocateTransient(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+	return ringRef.transientBuffer.allocate(frameIndex, size, alignment);
+}
+
+vk::DescriptorSet vw::FrameContext::allocateDescriptorSet(vk::DescriptorSetLayout layout)
+{
+	return ringRef.descriptorAllocator.allocate(layout);
+}
+
+vk::Fence vw::FrameContext::getFence()
+{
+	fencePending = true;
+	return fence;
+}
+
+vw::FrameRing::FrameRing(vw::Device& device, uint32_t frameCount, vk::DeviceSize transientSize) : deviceRef(device), recycler(device, frameCount),
+	transientBuffer(device, transientSize, frameCount, vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eUniformBuffer),
+	descriptorAllocator(device, frameCount)
+{
+	for (uint32_t i = 0; i < frameCount; ++i)
+		frames.push_back(std::make_unique<vw::FrameContext>(device, *this, i));
+}
+
+vw::FrameRing::~FrameRing()
+{
+	waitIdle();
+}
+
+vw::FrameContext& vw::FrameRing::beginFrame()
+{
+	uint32_t nextIndex = (recycler.getFrameIndex() + 1) % frames.size();
+	vw::FrameContext& frame = *frames[nextIndex];
+
+	auto stallStart = std::chrono::steady_clock::now();
+	waitForFrame(frame);
+	frame.stallTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stallStart).count();
+	totalStallTime += frame.stallTime;
+
+	frame.usedCommandBuffers = 0;
+	recycler.nextFrame();
+	descriptorAllocator.nextFrame();
+	transientBuffer.reset(nextIndex);
+	return frame;
+}
+
+vw::FrameContext& vw::FrameRing::getCurrentFrame()
+{
+	return *frames[recycler.getFrameIndex()];
+}
+
+void vw::FrameRing::waitIdle()
+{
+	for (auto& frame : frames)
+		waitForFrame(*frame);
+}
+
+void vw::FrameRing::waitForFrame(vw::FrameContext& frame)
+{
+	if (!frame.fencePending)
+		return;
+
+	vk::Fence fence = frame.fence;
+	deviceRef.waitForFences({ fence }, true, UINT64_MAX);
+	deviceRef.resetFences({ fence });
+	frame.fencePending = false;
+}
@@ -0,0 +1,468 @@
+#include "vwgraph.h"
+#include <algorithm>
+#include <sstream>
+
+static const char* ResourceUsageNames[] =
+{
+	"colorAttachment",
+	"depthStencilAttachment",
+	"sampledImage",
+	"storageResource",
+	"transferResource",
+	"uniformBuffer",
+	"vertexBuffer",
+	"indexBuffer",
+	"indirectBuffer"
+};
+
+//Only writes have to be made available, reads in a source access mask have no effect
+static const vk::AccessFlags WriteAccessMask = vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite
+	| vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eHostWrite | vk::AccessFlagBits::eMemoryWrite;
+
+static vk::PipelineStageFlags getShaderStages(vw::PassType type)
+{
+	switch (type)
+	{
+	case vw::graphicsPass:
+		return vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader;
+	case vw::computePass:
+		return vk::PipelineStageFlagBits::eComputeShader;
+	default:
+		throw std::runtime_error("VwRenderGraph: Transfer passes cannot access resources from shaders!");
+	}
+}
+
+uint32_t vw::RenderGraph::importImage(vw::ImageBase& image, std::string name)
+{
+	uint32_t resource = importImage(image, image.getAspectFlags(), image.getLayout(), name);
+	resources[resource].trackedImage = &image;
+	return resource;
+}
+
+uint32_t vw::RenderGraph::importImage(vk::Image image, vk::ImageAspectFlags aspectFlags, vk::ImageLayout currentLayout, std::string name)
+{
+	Resource resource;
+	resource.name = name;
+	resource.image = image;
+	resource.aspectFlags = aspectFlags;
+	resource.initialLayout = currentLayout;
+	resources.push_back(resource);
+	compiled = false;
+	return (uint32_t)resources.size() - 1;
+}
+
+uint32_t vw::RenderGraph::importBuffer(vk::Buffer buffer, std::string name, vk::DeviceSize offset, vk::DeviceSize size)
+{
+	Resource resource;
+	resource.name = name;
+	resource.buffer = buffer;
+	resource.offset = offset;
+	resource.size = size;
+	resources.push_back(resource);
+	compiled = false;
+	return (uint32_t)resources.size() - 1;
+}
+
+void vw::RenderGraph::rebindImage(uint32_t resource, vw::ImageBase& image)
+{
+	rebindImage(resource, image, image.getLayout());
+	resources[resource].trackedImage = &image;
+}
+
+void vw::RenderGraph::rebindImage(uint32_t resource, vk::Image image, vk::ImageLayout currentLayout)
+{
+	Resource& target = resources.at(resource);
+	if (!target.image)
+		throw std::runtime_error("VwRenderGraph: Only images can be rebound!");
+	target.image = image;
+	target.initialLayout = currentLayout;
+	target.trackedImage = nullptr;
+}
+
+void vw::RenderGraph::setOutput(uint32_t resource, vk::ImageLayout finalLayout)
+{
+	resources.at(resource).output = true;
+	resources.at(resource).finalLayout = finalLayout;
+	compiled = false;
+}
+
+uint32_t vw::RenderGraph::addPass(std::string name, vw::PassType type, vw::RenderGraph::RecordFunction record)
+{
+	Pass pass;
+	pass.name = name;
+	pass.type = type;
+	pass.record = record;
+	passes.push_back(pass);
+	compiled = false;
+	return (uint32_t)passes.size() - 1;
+}
+
+void vw::RenderGraph::read(uint32_t pass, uint32_t resource, vw::ResourceUsage usage)
+{
+	addAccess(pass, resource, usage, false);
+}
+
+void vw::RenderGraph::write(uint32_t pass, uint32_t resource, vw::ResourceUsage usage)
+{
+	addAccess(pass, resource, usage, true);
+}
+
+void vw::RenderGraph::setSideEffect(uint32_t pass)
+{
+	passes.at(pass).sideEffect = true;
+	compiled = false;
+}
+
+void vw::RenderGraph::reset()
+{
+	resources.clear();
+	passes.clear();
+	executionOrder.clear();
+	compiled = false;
+}
+
+void vw::RenderGraph::addAccess(uint32_t passIndex, uint32_t resource, vw::ResourceUsage usage, bool write)
+{
+	if (passIndex >= passes.size() || resource >= resources.size())
+		throw std::runtime_error("VwRenderGraph: Unknown pass or resource!");
+	Pass& pass = passes[passIndex];
+	bool image = static_cast<bool>(resources[resource].image);
+
+	Access access;
+	access.resource = resource;
+	access.usage = usage;
+	access.read = !write;
+	access.write = write;
+	access.layout = vk::ImageLayout::eUndefined;
+	bool imageUsage = true;
+	bool writable = true;
+	switch (usage)
+	{
+	case vw::colorAttachment:
+		access.stages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+		access.access = write ? vk::AccessFlagBits::eColorAttachmentWrite : vk::AccessFlagBits::eColorAttachmentRead;
+		access.layout = vk::ImageLayout::eColorAttachmentOptimal;
+		break;
+	case vw::depthStencilAttachment:
+		//Depth tests read the attachment even when the pass only declares a write
+		access.stages = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+		access.access = write ? vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite : vk::AccessFlags(vk::AccessFlagBits::eDepthStencilAttachmentRead);
+		access.layout = write ? vk::ImageLayout::eDepthStencilAttachmentOptimal : vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+		break;
+	case vw::sampledImage:
+		access.stages = getShaderStages(pass.type);
+		access.access = vk::AccessFlagBits::eShaderRead;
+		access.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+		writable = false;
+		break;
+	case vw::storageResource:
+		access.stages = getShaderStages(pass.type);
+		access.access = write ? vk::AccessFlagBits::eShaderWrite : vk::AccessFlagBits::eShaderRead;
+		access.layout = image ? vk::ImageLayout::eGeneral : vk::ImageLayout::eUndefined;
+		imageUsage = image;
+		break;
+	case vw::transferResource:
+		access.stages = vk::PipelineStageFlagBits::eTransfer;
+		access.access = write ? vk::AccessFlagBits::eTransferWrite : vk::AccessFlagBits::eTransferRead;
+		access.layout = image ? (write ? vk::ImageLayout::eTransferDstOptimal : vk::ImageLayout::eTransferSrcOptimal) : vk::ImageLayout::eUndefined;
+		imageUsage = image;
+		break;
+	case vw::uniformBuffer:
+		access.stages = getShaderStages(pass.type);
+		access.access = vk::AccessFlagBits::eUniformRead;
+		imageUsage = false;
+		writable = false;
+		break;
+	case vw::vertexBuffer:
+		access.stages = vk::PipelineStageFlagBits::eVertexInput;
+		access.access = vk::AccessFlagBits::eVertexAttributeRead;
+		imageUsage = false;
+		writable = false;
+		break;
+	case vw::indexBuffer:
+		access.stages = vk::PipelineStageFlagBits::eVertexInput;
+		access.access = vk::AccessFlagBits::eIndexRead;
+		imageUsage = false;
+		writable = false;
+		break;
+	case vw::indirectBuffer:
+		access.stages = vk::PipelineStageFlagBits::eDrawIndirect;
+		access.access = vk::AccessFlagBits::eIndirectCommandRead;
+		imageUsage = false;
+		writable = false;
+		break;
+	}
+	if (write && !writable)
+		throw std::runtime_error("VwRenderGraph: Usage is read only!");
+	if (imageUsage != image)
+		throw std::runtime_error("VwRenderGraph: Usage does not match the resource type!");
+
+	//A resource read and written by one pass is a single access, e.g. blending or read-modify-write storage
+	for (auto& existing : pass.accesses)
+	{
+		if (existing.resource != resource)
+			continue;
+		if (existing.layout != access.layout)
+			throw std::runtime_error("VwRenderGraph: Pass uses a resource in two layouts!");
+		existing.read = existing.read || access.read;
+		existing.write = existing.write || access.write;
+		existing.stages |= access.stages;
+		existing.access |= access.access;
+		compiled = false;
+		return;
+	}
+	pass.accesses.push_back(access);
+	compiled = false;
+}
+
+void vw::RenderGraph::compile()
+{
+	if (compiled)
+		return;
+
+	//Walking backwards, a pass is kept if it writes a resource still needed by an output or by a kept pass
+	std::vector<bool> needed(resources.size());
+	for (size_t i = 0; i < resources.size(); ++i)
+		needed[i] = resources[i].output;
+	for (size_t i = passes.size(); i-- > 0;)
+	{
+		Pass& pass = passes[i];
+		pass.culled = !pass.sideEffect;
+		for (auto& access : pass.accesses)
+			if (access.write && needed[access.resource])
+				pass.culled = false;
+		if (pass.culled)
+			continue;
+		//Earlier contents are overwritten unless the pass reads them
+		for (auto& access : pass.accesses)
+			if (access.write)
+				needed[access.resource] = false;
+		for (auto& access : pass.accesses)
+			if (access.read)
+				needed[access.resource] = true;
+	}
+
+	//A pass runs one level after the passes it depends on, passes of a level share no hazards and one barrier batch
+	struct Tracker
+	{
+		int64_t lastWriter = -1;
+		std::vector<uint32_t> readers;
+		vk::ImageLayout readLayout;
+	};
+	std::vector<Tracker> trackers(resources.size());
+	executionOrder.clear();
+	for (uint32_t i = 0; i < passes.size(); ++i)
+	{
+		Pass& pass = passes[i];
+		if (pass.culled)
+			continue;
+
+		pass.level = 0;
+		std::vector<bool> claimsResource(pass.accesses.size());
+		for (size_t j = 0; j < pass.accesses.size(); ++j)
+		{
+			Access& access = pass.accesses[j];
+			Tracker& tracker = trackers[access.resource];
+			//Reading in another layout than the current readers transitions the image, which orders it like a write
+			claimsResource[j] = access.write || (!tracker.readers.empty() && tracker.readLayout != access.layout);
+			if (tracker.lastWriter >= 0)
+				pass.level = std::max(pass.level, passes[tracker.lastWriter].level + 1);
+			if (claimsResource[j])
+				for (auto reader : tracker.readers)
+					pass.level = std::max(pass.level, passes[reader].level + 1);
+		}
+		for (size_t j = 0; j < pass.accesses.size(); ++j)
+		{
+			Tracker& tracker = trackers[pass.accesses[j].resource];
+			if (claimsResource[j])
+			{
+				tracker.lastWriter = i;
+				tracker.readers.clear();
+			}
+			else
+			{
+				tracker.readers.push_back(i);
+				tracker.readLayout = pass.accesses[j].layout;
+			}
+		}
+		executionOrder.push_back(i);
+	}
+	std::stable_sort(executionOrder.begin(), executionOrder.end(), [&](uint32_t a, uint32_t b) { return passes[a].level < passes[b].level; });
+	compiled = true;
+}
+
+void vw::RenderGraph::execute(vk::CommandBuffer cmdBuffer)
+{
+	compile();
+	statistics = vw::RenderGraphStatistics();
+
+	states.assign(resources.size(), ResourceState());
+	for (size_t i = 0; i < resources.size(); ++i)
+	{
+		if (resources[i].trackedImage)
+			resources[i].initialLayout = resources[i].trackedImage->getLayout();
+		states[i].layout = resources[i].initialLayout;
+		//Imported images may still be used by earlier work in their current layout, undefined contents need no waiting
+		if (resources[i].image && resources[i].initialLayout != vk::ImageLayout::eUndefined)
+		{
+			states[i].writeStages = vw::getLayoutStageFlags(resources[i].initialLayout);
+			states[i].writeAccess = vw::getLayoutAccessFlags(resources[i].initialLayout) & WriteAccessMask;
+		}
+	}
+
+	for (size_t first = 0; first < executionOrder.size();)
+	{
+		size_t last = first;
+		while (last < executionOrder.size() && passes[executionOrder[last]].level == passes[executionOrder[first]].level)
+			++last;
+
+		for (size_t i = first; i < last; ++i)
+			for (auto& access : passes[executionOrder[i]].accesses)
+				synchronize(states[access.resource], access, levelBatch);
+		recordBatch(cmdBuffer, levelBatch);
+
+		//Passes recording through ImageBase helpers read the tracked layout, so it has to match before they run
+		for (size_t i = first; i < last; ++i)
+			for (auto& access : passes[executionOrder[i]].accesses)
+				if (resources[access.resource].trackedImage)
+					resources[access.resource].trackedImage->setLayout(states[access.resource].layout);
+
+		for (size_t i = first; i < last; ++i)
+		{
+			if (passes[executionOrder[i]].record)
+				passes[executionOrder[i]].record(cmdBuffer);
+			statistics.passCount++;
+		}
+		first = last;
+	}
+
+	for (uint32_t i = 0; i < resources.size(); ++i)
+	{
+		Resource& resource = resources[i];
+		ResourceState& state = states[i];
+		if (resource.image && resource.output && resource.finalLayout != vk::ImageLayout::eUndefined && resource.finalLayout != state.layout)
+		{
+			addBarrier(levelBatch, i, state.writeStages | state.readStages, state.writeAccess, vw::getLayoutStageFlags(resource.finalLayout), vw::getLayoutAccessFlags(resource.finalLayout), state.layout, resource.finalLayout);
+			state.layout = resource.finalLayout;
+		}
+		if (resource.trackedImage)
+			resource.trackedImage->setLayout(state.layout);
+	}
+	recordBatch(cmdBuffer, levelBatch);
+
+	statistics.culledPassCount = (uint32_t)passes.size() - statistics.passCount;
+}
+
+void vw::RenderGraph::synchronize(ResourceState& state, const Access& access, BarrierBatch& batch)
+{
+	if (resources[access.resource].image && access.layout != state.layout)
+	{
+		//The transition waits for every earlier access and is itself finished before the access
+		addBarrier(batch, access.resource, state.writeStages | state.readStages, state.writeAccess, access.stages, access.access, state.layout, access.layout);
+		state.layout = access.layout;
+		state.writeStages = access.stages;
+		state.writeAccess = access.write ? access.access & WriteAccessMask : vk::AccessFlags();
+		state.readStages = vk::PipelineStageFlags();
+		state.visibleStages = access.write ? vk::PipelineStageFlags() : access.stages;
+		state.visibleAccess = access.write ? vk::AccessFlags() : access.access;
+	}
+	else if (access.write)
+	{
+		vk::PipelineStageFlags srcStages = state.writeStages | state.readStages;
+		if (srcStages)
+			addBarrier(batch, access.resource, srcStages, state.writeAccess, access.stages, access.access, state.layout, state.layout);
+		state.writeStages = access.stages;
+		state.writeAccess = access.access & WriteAccessMask;
+		state.readStages = vk::PipelineStageFlags();
+		state.visibleStages = vk::PipelineStageFlags();
+		state.visibleAccess = vk::AccessFlags();
+	}
+	else
+	{
+		//Reads only wait for the last write, once per stage and access it is made visible to
+		if (state.writeStages && ((access.stages & ~state.visibleStages) || (access.access & ~state.visibleAccess)))
+		{
+			addBarrier(batch, access.resource, state.writeStages, state.writeAccess, access.stages, access.access, state.layout, state.layout);
+			state.visibleStages |= access.stages;
+			state.visibleAccess |= access.access;
+		}
+		state.readStages |= access.stages;
+	}
+}
+
+void vw::RenderGraph::addBarrier(BarrierBatch& batch, uint32_t resource, vk::PipelineStageFlags srcStages, vk::AccessFlags srcAccess, vk::PipelineStageFlags dstStages, vk::AccessFlags dstAccess, vk::ImageLayout oldLayout, vk::ImageLayout newLayout)
+{
+	//Without earlier accesses the barrier waits on its own stages, chaining it to semaphore waits on them
+	batch.srcStages |= srcStages ? srcStages : dstStages;
+	batch.dstStages |= dstStages;
+	Resource& target = resources[resource];
+
+	//Passes of one level reading a resource share a single barrier for it
+	if (target.image)
+	{
+		for (auto& barrier : batch.imageBarriers)
+			if (barrier.image == target.image)
+			{
+				if (barrier.newLayout != newLayout)
+					throw std::runtime_error("VwRenderGraph: Image needs two layouts in one level!");
+				barrier.srcAccessMask |= srcAccess;
+				barrier.dstAccessMask |= dstAccess;
+				return;
+			}
+		vk::ImageMemoryBarrier barrier(srcAccess, dstAccess, oldLayout, newLayout, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, target.image, vk::ImageSubresourceRange(target.aspectFlags, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS));
+		batch.imageBarriers.push_back(barrier);
+	}
+	else
+	{
+		for (auto& barrier : batch.bufferBarriers)
+			if (barrier.buffer == target.buffer && barrier.offset == target.offset)
+			{
+				barrier.srcAccessMask |= srcAccess;
+				barrier.dstAccessMask |= dstAccess;
+				return;
+			}
+		vk::BufferMemoryBarrier barrier(srcAccess, dstAccess, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, target.buffer, target.offset, target.size);
+		batch.bufferBarriers.push_back(barrier);
+	}
+}
+
+//Empties the batch for the next level, its vectors keep their capacity
+void vw::RenderGraph::recordBatch(vk::CommandBuffer cmdBuffer, BarrierBatch& batch)
+{
+	if (!batch.imageBarriers.empty() || !batch.bufferBarriers.empty())
+	{
+		cmdBuffer.pipelineBarrier(batch.srcStages, batch.dstStages, vk::DependencyFlags(), {}, batch.bufferBarriers, batch.imageBarriers);
+		statistics.barrierBatches++;
+		statistics.imageBarriers += (uint32_t)batch.imageBarriers.size();
+		statistics.bufferBarriers += (uint32_t)batch.bufferBarriers.size();
+	}
+	batch.srcStages = vk::PipelineStageFlags();
+	batch.dstStages = vk::PipelineStageFlags();
+	batch.imageBarriers.clear();
+	batch.bufferBarriers.clear();
+}
+
+std::string vw::RenderGraph::exportDot()
+{
+	compile();
+	std::ostringstream dot;
+	dot << "digraph RenderGraph\n{\n\trankdir=LR;\n";
+	for (size_t i = 0; i < resources.size(); ++i)
+		dot << "\tresource" << i << " [shape=ellipse, label=\"" << resources[i].name << "\"" << (resources[i].output ? ", peripheries=2" : "") << "];\n";
+	for (size_t i = 0; i < passes.size(); ++i)
+	{
+		if (passes[i].culled)
+			dot << "\tpass" << i << " [shape=box, style=dashed, color=gray, label=\"" << passes[i].name << "\\nculled\"];\n";
+		else
+			dot << "\tpass" << i << " [shape=box, label=\"" << passes[i].name << "\\nlevel " << passes[i].level << "\"];\n";
+		for (auto& access : passes[i].accesses)
+		{
+			if (access.read)
+				dot << "\tresource" << access.resource << " -> pass" << i << " [label=\"" << ResourceUsageNames[access.usage] << "\"];\n";
+			if (access.write)
+				dot << "\tpass" << i << " -> resource" << access.resource << " [label=\"" << ResourceUsageNames[access.usage] << "\"];\n";
+		}
+	}
+	dot << "}\n";
+	return dot.str();
+}
@@ -0,0 +1,68 @@
+#include "vwjobs.h"
+
+vw::ThreadPool::ThreadPool(uint32_t threadCount)
+{
+	uint32_t hardwareThreads = std::thread::hardware_concurrency();
+	if (threadCount == 0)
+		threadCount = (hardwareThreads > 1) ? hardwareThreads - 1 : 1;
+	for (uint32_t i = 0; i < threadCount; ++i)
+		workers.push_back(std::thread(&vw::ThreadPool::workerLoop, this));
+}
+
+//Tasks already queued are finished before the workers exit
+vw::ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	queueCondition.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void vw::ThreadPool::cancelPending()
+{
+	std::lock_guard<std::mutex> lock(queueMutex);
+	for (auto& queue : tasks)
+		queue.clear();
+}
+
+void vw::ThreadPool::enqueue(std::function<void()> task, vw::JobPriority priority)
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		tasks[priority].push_back(std::move(task));
+	}
+	queueCondition.notify_one();
+}
+
+void vw::ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueCondition.wait(lock, [this]() { return stopping || hasTasks(); });
+			if (!hasTasks())
+				return;
+			for (auto& queue : tasks)
+				if (!queue.empty())
+				{
+					task = std::move(queue.front());
+					queue.pop_front();
+					break;
+				}
+		}
+		task();
+	}
+}
+
+bool vw::ThreadPool::hasTasks()
+{
+	for (auto& queue : tasks)
+		if (!queue.empty())
+			return true;
+	return false;
+}
@@ -2,49 +2,233 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
  
-uint32_t findMemoryType(vk::PhysicalDevice physicalDevice, vk::MemoryRequirements memoryRequirements, vk::MemoryPropertyFlags requiredProperties)
+static vk::BufferMemoryBarrier createBufferOwnershipBarrier(vk::Buffer buffer)
 {
-	vk::PhysicalDeviceMemoryProperties memProperties = physicalDevice.getMemoryProperties();
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+	vk::BufferMemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	return barrier;
+}
+
+static vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+	return (alignment > 1) ? ((value + alignment - 1) / alignment) * alignment : value;
+}
+
+vw::MemoryAllocator::MemoryAllocator(vk::Device device, vk::PhysicalDevice physicalDevice, vk::DeviceSize preferredBlockSize) : deviceHandle(device), preferredSize(preferredBlockSize)
+{
+	memoryProperties = physicalDevice.getMemoryProperties();
+	bufferImageGranularity = physicalDevice.getProperties().limits.bufferImageGranularity;
+	blockPools.resize(memoryProperties.memoryTypeCount * 2);
+}
+
+vw::MemoryAllocator::~MemoryAllocator()
+{
+	for (auto& pool : blockPools)
+		for (auto& block : pool)
+			destroyBlock(block.get());
+}
+
+vw::Allocation vw::MemoryAllocator::allocate(vk::MemoryRequirements memoryRequirements, vk::MemoryPropertyFlags requiredProperties, bool linearResource)
+{
+	uint32_t memTypeIndex = findMemoryType(memoryRequirements, requiredProperties);
+	uint32_t poolIndex = memTypeIndex * 2 + ((bufferImageGranularity > 1 && linearResource) ? 1 : 0);
+
+	vk::DeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memTypeIndex].heapIndex].size;
+	vk::DeviceSize blockSize = std::min(preferredSize, heapSize / 8);
+
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+
+	vw::Allocation allocation;
+	allocation.poolIndex = poolIndex;
+	auto& pool = blockPools[poolIndex];
+
+	//Large resources get their own block so they don't fragment the shared ones
+	if (memoryRequirements.size > blockSize / 2)
+	{
+		pool.push_back(createBlock(memTypeIndex, memoryRequirements.size, true));
+		allocateFromBlock(pool.back().get(), memoryRequirements, allocation);
+	}
+	else
+	{
+		bool allocated = false;
+		for (auto& block : pool)
+			if (!block->dedicated && allocateFromBlock(block.get(), memoryRequirements, allocation))
+			{
+				allocated = true;
+				break;
+			}
+		if (!allocated)
+		{
+			pool.push_back(createBlock(memTypeIndex, blockSize, false));
+			allocateFromBlock(pool.back().get(), memoryRequirements, allocation);
+		}
+	}
+
+	statistics.allocationCount++;
+	statistics.liveAllocationCount++;
+	statistics.usedBytes += allocation.size;
+	return allocation;
+}
+
+void vw::MemoryAllocator::free(vw::Allocation& allocation)
+{
+	if (!allocation.block)
+		return;
+
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	vw::MemoryBlock* block = allocation.block;
+
+	//Return the range to the free list and merge it with its neighbours
+	auto inserted = block->freeRanges.emplace(allocation.offset, allocation.size).first;
+	auto next = std::next(inserted);
+	if (next != block->freeRanges.end() && inserted->first + inserted->second == next->first)
+	{
+		inserted->second += next->second;
+		block->freeRanges.erase(next);
+	}
+	if (inserted != block->freeRanges.begin())
+	{
+		auto prev = std::prev(inserted);
+		if (prev->first + prev->second == inserted->first)
+		{
+			prev->second += inserted->second;
+			block->freeRanges.erase(inserted);
+		}
+	}
+
+	block->allocationCount--;
+	statistics.liveAllocationCount--;
+	statistics.usedBytes -= allocation.size;
+
+	//Keep one empty shared block per pool around to avoid reallocating it on every create/destroy cycle
+	if (block->allocationCount == 0)
+	{
+		auto& pool = blockPools[allocation.poolIndex];
+		size_t sharedBlockCount = 0;
+		for (auto& poolBlock : pool)
+			sharedBlockCount += poolBlock->dedicated ? 0 : 1;
+
+		if (block->dedicated || sharedBlockCount > 1)
+		{
+			destroyBlock(block);
+			pool.erase(std::find_if(pool.begin(), pool.end(), [block](const std::unique_ptr<vw::MemoryBlock>& poolBlock) { return poolBlock.get() == block; }));
+		}
+	}
+	allocation = vw::Allocation();
+}
+
+vw::MemoryStatistics vw::MemoryAllocator::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	return statistics;
+}
+
+uint32_t vw::MemoryAllocator::findMemoryType(vk::MemoryRequirements memoryRequirements, vk::MemoryPropertyFlags requiredProperties)
+{
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
 	{
-		if ((memoryRequirements.memoryTypeBits >> i & 1) && ((memProperties.memoryTypes[i].propertyFlags & requiredProperties) == requiredProperties))
+		if ((memoryRequirements.memoryTypeBits >> i & 1) && ((memoryProperties.memoryTypes[i].propertyFlags & requiredProperties) == requiredProperties))
 			return i;
 	}
 	throw std::runtime_error("vwMemory: Failed to find memory type with required property flags!");
 }
 
-vw::Buffer::Buffer(vw::Device& device, vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags requiredProperties) : vw::Buffer(device, device.getPhysicalDevice(), size, usage, device.getQueueFamilyIndices(vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eTransfer), requiredProperties)
+std::unique_ptr<vw::MemoryBlock> vw::MemoryAllocator::createBlock(uint32_t memoryTypeIndex, vk::DeviceSize size, bool dedicated)
 {
-	//TODO: Give ownership to queue families based on buffer usage
+	auto block = std::make_unique<vw::MemoryBlock>();
+	block->size = size;
+	block->dedicated = dedicated;
+	block->memory = deviceHandle.allocateMemory({ size, memoryTypeIndex });
+	block->freeRanges.emplace(0, size);
+
+	//Host visible blocks stay mapped for their whole lifetime, sub-allocations can't map the same memory twice
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+	{
+		try
+		{
+			block->mappedData = deviceHandle.mapMemory(block->memory, 0, VK_WHOLE_SIZE);
+		}
+		catch (...)
+		{
+			deviceHandle.freeMemory(block->memory);
+			throw;
+		}
+	}
+
+	statistics.blockCount++;
+	statistics.blockBytes += size;
+	statistics.peakBlockCount = std::max(statistics.peakBlockCount, statistics.blockCount);
+	return block;
+}
+
+void vw::MemoryAllocator::destroyBlock(vw::MemoryBlock* block)
+{
+	if (block->mappedData)
+		deviceHandle.unmapMemory(block->memory);
+	deviceHandle.freeMemory(block->memory);
+	statistics.blockCount--;
+	statistics.blockBytes -= block->size;
+}
+
+//First-fit search through the block's free ranges
+bool vw::MemoryAllocator::allocateFromBlock(vw::MemoryBlock* block, vk::MemoryRequirements memoryRequirements, vw::Allocation& allocation)
+{
+	for (auto range = block->freeRanges.begin(); range != block->freeRanges.end(); ++range)
+	{
+		vk::DeviceSize rangeOffset = range->first, rangeSize = range->second;
+		vk::DeviceSize alignedOffset = alignUp(rangeOffset, memoryRequirements.alignment);
+		if (alignedOffset + memoryRequirements.size > rangeOffset + rangeSize)
+			continue;
+
+		block->freeRanges.erase(range);
+		if (alignedOffset > rangeOffset)
+			block->freeRanges.emplace(rangeOffset, alignedOffset - rangeOffset);
+		vk::DeviceSize allocationEnd = alignedOffset + memoryRequirements.size;
+		if (allocationEnd < rangeOffset + rangeSize)
+			block->freeRanges.emplace(allocationEnd, rangeOffset + rangeSize - allocationEnd);
+
+		allocation.memory = block->memory;
+		allocation.offset = alignedOffset;
+		allocation.size = memoryRequirements.size;
+		allocation.mappedData = block->mappedData ? static_cast<char*>(block->mappedData) + alignedOffset : nullptr;
+		allocation.block = block;
+		block->allocationCount++;
+		return true;
+	}
+	return false;
 }
 
-vw::Buffer::Buffer(vk::Device device, vk::PhysicalDevice physicalDevice, vk::DeviceSize size, vk::BufferUsageFlags usage, std::vector<uint32_t> queueFamilies, vk::MemoryPropertyFlags requiredProperties) : deviceHandle(device), bufferSize(size)
+//Buffers are exclusive, uploads on other queue families hand ownership over through vw::Device::transferOwnership
+vw::Buffer::Buffer(vw::Device& device, vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags requiredProperties) : vw::Buffer(device, size, usage, std::vector<uint32_t>(), requiredProperties)
+{
+}
+
+vw::Buffer::Buffer(vw::Device& device, vk::DeviceSize size, vk::BufferUsageFlags usage, std::vector<uint32_t> queueFamilies, vk::MemoryPropertyFlags requiredProperties) : deviceHandle(device), bufferSize(size), allocatorRef(device.getAllocator()), deviceRef(device)
 {
 	vk::BufferCreateInfo bufferCreateInfo;
 	bufferCreateInfo.size = size;
 	bufferCreateInfo.usage = usage;
-	bufferCreateInfo.sharingMode = (queueFamilies.size() == 1) ? vk::SharingMode::eExclusive : vk::SharingMode::eConcurrent;
+	bufferCreateInfo.sharingMode = (queueFamilies.size() > 1) ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
 	if (queueFamilies.size() > 1)
 	{
 		bufferCreateInfo.queueFamilyIndexCount = queueFamilies.size();
 		bufferCreateInfo.pQueueFamilyIndices = queueFamilies.data();
 	}
-	vk::Buffer::operator=(device.createBuffer(bufferCreateInfo));
+	vk::Buffer::operator=(deviceHandle.createBuffer(bufferCreateInfo));
 
-	vk::MemoryRequirements memRequirements = device.getBufferMemoryRequirements(*this);
-	uint32_t memTypeIndex = findMemoryType(physicalDevice, memRequirements, requiredProperties);
-
-	vk::MemoryAllocateInfo memAllocInfo;
-	memAllocInfo.allocationSize = memRequirements.size;
-	memAllocInfo.memoryTypeIndex = memTypeIndex;
-	bufferMemory = device.allocateMemory(memAllocInfo);
-	device.bindBufferMemory(*this, bufferMemory, 0);
+	vk::MemoryRequirements memRequirements = deviceHandle.getBufferMemoryRequirements(*this);
+	bufferAllocation = allocatorRef.allocate(memRequirements, requiredProperties, true);
+	deviceHandle.bindBufferMemory(*this, bufferAllocation.memory, bufferAllocation.offset);
 }
 
 vw::Buffer::~Buffer()
 {
-	deviceHandle.freeMemory(bufferMemory);
+	deviceRef.notifyDestruction(vk::DebugReportObjectTypeEXT::eBuffer, (uint64_t)static_cast<VkBuffer>(*this));
 	deviceHandle.destroyBuffer(*this);
+	allocatorRef.free(bufferAllocation);
 }
 
 vw::StagingBuffer::StagingBuffer(vw::Device& device, vk::DeviceSize size) : vw::Buffer(device, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent), deviceRef(device)
@@ -53,26 +237,213 @@ vw::StagingBuffer::StagingBuffer(vw::Device& device, vk::DeviceSize size) : vw::
 
 void vw::StagingBuffer::loadData(void* data)
 {
-	void* bufferData;
-	deviceRef.mapMemory(bufferMemory, (vk::DeviceSize)0, bufferSize, vk::MemoryMapFlags(), &bufferData);
-	memcpy(bufferData, data, static_cast<size_t>(bufferSize));
-	deviceRef.unmapMemory(bufferMemory);
+	memcpy(bufferAllocation.mappedData, data, static_cast<size_t>(bufferSize));
+}
+
+vw::StagingRing::StagingRing(vw::Device& device, vk::DeviceSize size) : vw::Buffer(device, size, vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent)
+{
+}
+
+vw::StagingRegion vw::StagingRing::allocate(vk::DeviceSize size, vk::DeviceSize alignment, uint64_t segment)
+{
+	if (size > bufferSize)
+		throw std::runtime_error("VwStagingRing: Allocation is larger than the ring!");
+
+	std::unique_lock<std::mutex> lock(ringMutex);
+	if (segment != 0)
+	{
+		auto openSegment = segments.find(segment);
+		if (openSegment == segments.end() || openSegment->second.released)
+			throw std::runtime_error("VwStagingRing: Allocating from a released segment!");
+	}
+	while (true)
+	{
+		if (usedBytes == 0)
+			head = tail = 0;
+
+		vk::DeviceSize alignedHead = alignUp(head, alignment), offset = 0, consumed = 0;
+		bool fits = false;
+		if (head > tail || usedBytes == 0)
+		{
+			//Free space is [head, end) followed by [0, tail)
+			if (alignedHead + size <= bufferSize)
+			{
+				offset = alignedHead;
+				consumed = alignedHead + size - head;
+				fits = true;
+			}
+			else if (size <= tail)
+			{
+				offset = 0;
+				consumed = bufferSize - head + size;
+				fits = true;
+			}
+		}
+		else if (head < tail && alignedHead + size <= tail)
+		{
+			offset = alignedHead;
+			consumed = alignedHead + size - head;
+			fits = true;
+		}
+
+		if (fits)
+		{
+			if (segment == 0)
+			{
+				segment = ++segmentCounter;
+				segments[segment].owner = std::this_thread::get_id();
+			}
+			segments[segment].allocationCount++;
+			head = offset + size;
+			usedBytes += consumed;
+			allocations.push_back({ head, consumed, segment });
+
+			vw::StagingRegion region;
+			region.buffer = *this;
+			region.offset = offset;
+			region.size = size;
+			region.data = static_cast<char*>(bufferAllocation.mappedData) + offset;
+			region.segment = segment;
+			return region;
+		}
+
+		//The oldest allocation blocks the ring until its segment is released and its submission has finished
+		Segment& oldestSegment = segments[allocations.front().segment];
+		if (!oldestSegment.released)
+		{
+			if (oldestSegment.owner == std::this_thread::get_id())
+				throw std::runtime_error("VwStagingRing: Ring is full, submit or release the pending segments of this thread before allocating more!");
+			releaseCondition.wait(lock);
+			continue;
+		}
+		//Other threads keep allocating and releasing while this one waits, the ring state is checked again afterwards
+		vw::GpuFuture oldestFuture = oldestSegment.future;
+		lock.unlock();
+		oldestFuture.wait();
+		lock.lock();
+		retireCompleted();
+	}
+}
+
+void vw::StagingRing::releaseSegment(uint64_t segment, vw::GpuFuture future)
+{
+	{
+		std::lock_guard<std::mutex> lock(ringMutex);
+		auto releasedSegment = segments.find(segment);
+		if (releasedSegment == segments.end() || releasedSegment->second.released)
+			throw std::runtime_error("VwStagingRing: Segment was already released!");
+		releasedSegment->second.released = true;
+		releasedSegment->second.future = future;
+		if (releasedSegment->second.allocationCount == 0)
+			segments.erase(releasedSegment);
+		retireCompleted();
+	}
+	releaseCondition.notify_all();
+}
+
+void vw::StagingRing::releaseSegment(uint64_t segment, vw::CommandBuffer& cmdBuffer)
+{
+	cmdBuffer.addSubmitCallback([this, segment](vw::GpuFuture future) { releaseSegment(segment, future); });
+}
+
+void vw::StagingRing::waitForSegment(uint64_t segment)
+{
+	std::unique_lock<std::mutex> lock(ringMutex);
+	auto waitedSegment = segments.find(segment);
+	if (waitedSegment == segments.end())
+		return;
+	if (!waitedSegment->second.released)
+		throw std::runtime_error("VwStagingRing: Waiting for a segment that was not released!");
+	vw::GpuFuture future = waitedSegment->second.future;
+	lock.unlock();
+	future.wait();
+}
+
+bool vw::StagingRing::isSegmentRetired(uint64_t segment)
+{
+	std::lock_guard<std::mutex> lock(ringMutex);
+	auto checkedSegment = segments.find(segment);
+	return checkedSegment == segments.end() || (checkedSegment->second.released && checkedSegment->second.future.isReady());
+}
+
+void vw::StagingRing::retireAllocation()
+{
+	RingAllocation& allocation = allocations.front();
+	tail = allocation.end;
+	usedBytes -= allocation.byteCount;
+
+	auto segment = segments.find(allocation.segment);
+	if (--segment->second.allocationCount == 0 && segment->second.released)
+		segments.erase(segment);
+	allocations.pop_front();
+}
+
+//Recycles allocations whose submission already finished without blocking
+void vw::StagingRing::retireCompleted()
+{
+	while (!allocations.empty())
+	{
+		Segment& segment = segments[allocations.front().segment];
+		if (!segment.released || !segment.future.isReady())
+			break;
+		retireAllocation();
+	}
+}
+
+vw::TransientBuffer::TransientBuffer(vw::Device& device, vk::DeviceSize frameSize, uint32_t frameCount, vk::BufferUsageFlags usage) : vw::Buffer(device, frameSize * frameCount, usage, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent), regionSize(frameSize), regionHeads(frameCount, 0)
+{
+}
+
+vw::StagingRegion vw::TransientBuffer::allocate(uint32_t frameIndex, vk::DeviceSize size, vk::DeviceSize alignment)
+{
+	vk::DeviceSize regionStart = frameIndex * regionSize;
+	vk::DeviceSize offset = alignUp(regionStart + regionHeads[frameIndex], alignment);
+	if (offset + size > regionStart + regionSize)
+		throw std::runtime_error("VwTransientBuffer: Frame region is out of memory!");
+	regionHeads[frameIndex] = offset + size - regionStart;
+
+	vw::StagingRegion region;
+	region.buffer = *this;
+	region.offset = offset;
+	region.size = size;
+	region.data = static_cast<char*>(bufferAllocation.mappedData) + region.offset;
+	return region;
 }
 
-vw::CommandBuffer vw::StagingBuffer::copyToBuffer(vk::Buffer dstBuffer, std::vector<vk::BufferCopy> regions)
+void vw::TransientBuffer::reset(uint32_t frameIndex)
 {
-	vw::CommandBuffer cmdBuffer = deviceRef.createCommandBuffer(vk::QueueFlagBits::eTransfer, vk::CommandBufferLevel::ePrimary);
+	regionHeads[frameIndex] = 0;
+}
+
+vw::CommandBuffer vw::StagingBuffer::copyToBuffer(vk::Buffer dstBuffer, std::vector<vk::BufferCopy> regions, uint32_t dstQueueFamily)
+{
+	uint32_t transferFamily = deviceRef.getTransferQueueFamily();
+	vw::CommandBuffer cmdBuffer = deviceRef.createCommandBuffer(transferFamily, vk::CommandBufferLevel::ePrimary);
 	cmdBuffer.begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
 	cmdBuffer.copyBuffer(*this, dstBuffer, regions);
+	deviceRef.transferOwnership(cmdBuffer, transferFamily, dstQueueFamily, { createBufferOwnershipBarrier(dstBuffer) }, {});
 	cmdBuffer.end();
 	return cmdBuffer;
 }
 
-vw::CommandBuffer vw::StagingBuffer::copyToImage(vk::Image dstImage, std::vector<vk::BufferImageCopy> regions)
+vw::CommandBuffer vw::StagingBuffer::copyToImage(vk::Image dstImage, std::vector<vk::BufferImageCopy> regions, uint32_t dstQueueFamily)
 {
-	vw::CommandBuffer cmdBuffer = deviceRef.createCommandBuffer(vk::QueueFlagBits::eTransfer, vk::CommandBufferLevel::ePrimary);
+	vk::ImageAspectFlags aspectFlags;
+	for (auto& region : regions)
+		aspectFlags |= region.imageSubresource.aspectMask;
+
+	vk::ImageMemoryBarrier ownershipBarrier;
+	ownershipBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+	ownershipBarrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+	ownershipBarrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+	ownershipBarrier.image = dstImage;
+	ownershipBarrier.subresourceRange = vk::ImageSubresourceRange(aspectFlags, 0, 1, 0, 1);
+
+	uint32_t transferFamily = deviceRef.getTransferQueueFamily();
+	vw::CommandBuffer cmdBuffer = deviceRef.createCommandBuffer(transferFamily, vk::CommandBufferLevel::ePrimary);
 	cmdBuffer.begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
 	cmdBuffer.copyBufferToImage(*this, dstImage, vk::ImageLayout::eTransferDstOptimal, regions);
+	deviceRef.transferOwnership(cmdBuffer, transferFamily, dstQueueFamily, {}, { ownershipBarrier });
 	cmdBuffer.end();
 	return cmdBuffer;
 }
@@ -82,7 +453,7 @@ vw::TransferSrc::TransferSrc(vw::Device& device) : vw::ImageBase(device)
 	usageFlags |= vk::ImageUsageFlagBits::eTransferSrc;
 }
 
-void vw::TransferSrc::copyToImage(vk::CommandBuffer cmdBuffer, vk::Image dstImage, vk::ImageLayout dstLayout, std::vector<vk::ImageCopy> regions)
+void vw::TransferSrc::copyToImage(vk::CommandBuffer cmdBuffer, vk::Image dstImage, vk::ImageLayout dstLayout, vk::ArrayProxy<const vk::ImageCopy> regions)
 {
 	cmdBuffer.copyImage(*this, currentLayout, dstImage, dstLayout, regions);
 }
@@ -91,6 +462,30 @@ vw::TransferDst::TransferDst(vw::Device& device) : vw::ImageBase(device)
 {
 	usageFlags |= vk::ImageUsageFlagBits::eTransferDst;
 }
+
+vw::CommandBuffer vw::TransferDst::loadData(void* data, vk::DeviceSize size, uint32_t dstQueueFamily)
+{
+	uint32_t transferFamily = deviceRef.getTransferQueueFamily();
+	vw::CommandBuffer cmdBuffer = deviceRef.createCommandBuffer(transferFamily, vk::CommandBufferLevel::ePrimary);
+
+	//The segment is released with the command buffer even if it is never submitted
+	auto& stagingRing = deviceRef.getStagingRing();
+	auto stagingRegion = stagingRing.allocate(size);
+	stagingRing.releaseSegment(stagingRegion.segment, cmdBuffer);
+	memcpy(stagingRegion.data, data, static_cast<size_t>(size));
+
+	vk::BufferImageCopy copyRegion;
+	copyRegion.bufferOffset = stagingRegion.offset;
+	copyRegion.imageSubresource = vk::ImageSubresourceLayers(getAspectFlags(), 0, 0, 1);
+	copyRegion.imageExtent = vk::Extent3D(imgWidth, imgHeight, 1);
+
+	cmdBuffer.begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+	transitionLayout(cmdBuffer, vk::ImageLayout::eTransferDstOptimal);
+	cmdBuffer.copyBufferToImage(stagingRegion.buffer, *this, vk::ImageLayout::eTransferDstOptimal, { copyRegion });
+	deviceRef.transferOwnership(cmdBuffer, transferFamily, dstQueueFamily, {}, { createOwnershipBarrier() });
+	cmdBuffer.end();
+	return cmdBuffer;
+}
  
 vw::ImageBase::ImageBase(vw::Device& device) : deviceRef(device)
 {
@@ -99,11 +494,13 @@ vw::ImageBase::ImageBase(vw::Device& device) : deviceRef(device)
 vw::ImageBase::~ImageBase()
 {
 	for (auto& view : imageViews)
+	{
+		deviceRef.notifyDestruction(vk::DebugReportObjectTypeEXT::eImageView, (uint64_t)static_cast<VkImageView>(view));
 		deviceRef.destroyImageView(view);
-	if (imageMemory)
-		deviceRef.freeMemory(imageMemory);
+	}
 	if(image)
 		deviceRef.destroyImage(image);
+	deviceRef.getAllocator().free(imageAllocation);
 }
 
 vw::ImageBase::operator vk::Image()
@@ -119,46 +516,104 @@ vk::Format vw::ImageBase::getFormat()
 static std::map<vk::ImageLayout, vk::AccessFlags> mapImageLayoutToAccess = 
 {
 	{vk::ImageLayout::eUndefined, vk::AccessFlagBits()},
-	{vk::ImageLayout::eTransferDstOptimal, vk::AccessFlagBits::eTransferWrite}
+	{vk::ImageLayout::eGeneral, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite},
+	{vk::ImageLayout::eColorAttachmentOptimal, vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite},
+	{vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite},
+	{vk::ImageLayout::eDepthStencilReadOnlyOptimal, vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eShaderRead},
+	{vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead},
+	{vk::ImageLayout::eTransferSrcOptimal, vk::AccessFlagBits::eTransferRead},
+	{vk::ImageLayout::eTransferDstOptimal, vk::AccessFlagBits::eTransferWrite},
+	{vk::ImageLayout::ePreinitialized, vk::AccessFlagBits::eHostWrite},
+	{vk::ImageLayout::ePresentSrcKHR, vk::AccessFlagBits()}
 };
 
 static std::map<vk::ImageLayout, vk::PipelineStageFlags> mapImageLayoutToStage =
 {
 	{vk::ImageLayout::eUndefined, vk::PipelineStageFlagBits::eTopOfPipe},
-	{vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer}
+	{vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eAllCommands},
+	{vk::ImageLayout::eColorAttachmentOptimal, vk::PipelineStageFlagBits::eColorAttachmentOutput},
+	{vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests},
+	{vk::ImageLayout::eDepthStencilReadOnlyOptimal, vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests | vk::PipelineStageFlagBits::eFragmentShader},
+	{vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader},
+	{vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer},
+	{vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer},
+	{vk::ImageLayout::ePreinitialized, vk::PipelineStageFlagBits::eHost},
+	{vk::ImageLayout::ePresentSrcKHR, vk::PipelineStageFlagBits::eBottomOfPipe}
 };
 
-vw::CommandBuffer vw::ImageBase::transitionLayout(vk::ImageLayout newLayout)
+//Unknown layouts are synchronized with everything
+vk::AccessFlags vw::getLayoutAccessFlags(vk::ImageLayout layout)
 {
-	vk::ImageMemoryBarrier imageBarrier;
-	imageBarrier.oldLayout = currentLayout;
-	imageBarrier.newLayout = newLayout;
-	imageBarrier.image = image;
-	imageBarrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-	imageBarrier.srcAccessMask = mapImageLayoutToAccess[currentLayout];
-	imageBarrier.dstAccessMask = mapImageLayoutToAccess[newLayout];
+	auto found = mapImageLayoutToAccess.find(layout);
+	return found != mapImageLayoutToAccess.end() ? found->second : vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite;
+}
 
-	auto cmdBuffer = deviceRef.createCommandBuffer(vk::QueueFlagBits::eTransfer, vk::CommandBufferLevel::ePrimary);
+vk::PipelineStageFlags vw::getLayoutStageFlags(vk::ImageLayout layout)
+{
+	auto found = mapImageLayoutToStage.find(layout);
+	return found != mapImageLayoutToStage.end() ? found->second : vk::PipelineStageFlagBits::eAllCommands;
+}
+
+vk::ImageAspectFlags vw::getFormatAspectFlags(vk::Format format)
+{
+	switch (format)
+	{
+	case vk::Format::eD16Unorm:
+	case vk::Format::eX8D24UnormPack32:
+	case vk::Format::eD32Sfloat:
+		return vk::ImageAspectFlagBits::eDepth;
+	case vk::Format::eS8Uint:
+		return vk::ImageAspectFlagBits::eStencil;
+	case vk::Format::eD16UnormS8Uint:
+	case vk::Format::eD24UnormS8Uint:
+	case vk::Format::eD32SfloatS8Uint:
+		return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+	default:
+		return vk::ImageAspectFlagBits::eColor;
+	}
+}
+
+vw::CommandBuffer vw::ImageBase::transitionLayout(vk::ImageLayout newLayout, uint32_t queueFamilyIndex)
+{
+	auto cmdBuffer = deviceRef.createCommandBuffer(queueFamilyIndex, vk::CommandBufferLevel::ePrimary);
 	cmdBuffer.begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-	cmdBuffer.pipelineBarrier(mapImageLayoutToStage[currentLayout], mapImageLayoutToStage[newLayout], vk::DependencyFlags(), {}, {}, { imageBarrier });
+	transitionLayout(cmdBuffer, newLayout);
 	cmdBuffer.end();
-	currentLayout = newLayout;
 	return cmdBuffer;
 }
 
 void vw::ImageBase::transitionLayout(vk::CommandBuffer cmdBuffer, vk::ImageLayout newLayout)
+{
+	vk::PipelineStageFlags srcStages, dstStages;
+	vk::ImageMemoryBarrier imageBarrier = createLayoutBarrier(newLayout, srcStages, dstStages);
+	cmdBuffer.pipelineBarrier(srcStages, dstStages, vk::DependencyFlags(), {}, {}, { imageBarrier });
+}
+
+vk::ImageMemoryBarrier vw::ImageBase::createLayoutBarrier(vk::ImageLayout newLayout, vk::PipelineStageFlags& srcStages, vk::PipelineStageFlags& dstStages)
 {
 	vk::ImageMemoryBarrier imageBarrier;
 	imageBarrier.oldLayout = currentLayout;
 	imageBarrier.newLayout = newLayout;
 	imageBarrier.image = image;
-	imageBarrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-	imageBarrier.srcAccessMask = mapImageLayoutToAccess[currentLayout];
-	imageBarrier.dstAccessMask = mapImageLayoutToAccess[newLayout];
+	imageBarrier.subresourceRange = vk::ImageSubresourceRange(getAspectFlags(), 0, 1, 0, 1);
+	imageBarrier.srcAccessMask = vw::getLayoutAccessFlags(currentLayout);
+	imageBarrier.dstAccessMask = vw::getLayoutAccessFlags(newLayout);
 
-	cmdBuffer.pipelineBarrier(mapImageLayoutToStage[currentLayout], mapImageLayoutToStage[newLayout], vk::DependencyFlags(), {}, {}, { imageBarrier });
- 
+	srcStages = vw::getLayoutStageFlags(currentLayout);
+	dstStages = vw::getLayoutStageFlags(newLayout);
 	currentLayout = newLayout;
+	return imageBarrier;
+}
+
+vk::ImageMemoryBarrier vw::ImageBase::createOwnershipBarrier()
+{
+	vk::ImageMemoryBarrier imageBarrier;
+	imageBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+	imageBarrier.oldLayout = currentLayout;
+	imageBarrier.newLayout = currentLayout;
+	imageBarrier.image = image;
+	imageBarrier.subresourceRange = vk::ImageSubresourceRange(getAspectFlags(), 0, 1, 0, 1);
+	return imageBarrier;
 }
 
 void vw::ImageBase::createImage()
@@ -174,18 +629,18 @@ void vw::ImageBase::createImage()
 	imageCreateInfo.usage = usageFlags;
 	imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
 
-	auto queueFamilies = deviceRef.getQueueFamilyIndices(vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eTransfer);
-	imageCreateInfo.sharingMode = (queueFamilies.size() > 1) ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
-	imageCreateInfo.queueFamilyIndexCount = queueFamilies.size();
-	imageCreateInfo.pQueueFamilyIndices = queueFamilies.data();
+	imageCreateInfo.sharingMode = vk::SharingMode::eExclusive;
 
 	image = deviceRef.createImage(imageCreateInfo);
 
 	auto memRequirements = deviceRef.getImageMemoryRequirements(image);
-	auto memTypeIndex = findMemoryType(deviceRef.getPhysicalDevice(), memRequirements, vk::MemoryPropertyFlagBits::eDeviceLocal);
-	imageMemory = deviceRef.allocateMemory({ memRequirements.size, memTypeIndex });
-	deviceRef.bindImageMemory(image, imageMemory, 0);
+	imageAllocation = deviceRef.getAllocator().allocate(memRequirements, vk::MemoryPropertyFlagBits::eDeviceLocal, imgTiling == vk::ImageTiling::eLinear);
+	deviceRef.bindImageMemory(image, imageAllocation.memory, imageAllocation.offset);
+}
 
+vk::ImageAspectFlags vw::ImageBase::getAspectFlags()
+{
+	return vw::getFormatAspectFlags(imgFormat);
 }
 
 vk::ImageView vw::ImageBase::createView(vk::ImageAspectFlags aspectFlags)
@@ -209,13 +664,74 @@ static std::map<uint32_t, vk::Format> mapNumChannelsToFormat =
 };
 vw::VertexBuffer::VertexBuffer(vw::Device & device, vk::DeviceSize size) : deviceRef(device), vw::Buffer(device, size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal)
 {
-	stagingBuffer = std::make_unique<vw::StagingBuffer>(device, size);
 }
 
-vw::CommandBuffer vw::VertexBuffer::loadData(void* data, std::vector<vk::BufferCopy> regions)
+//Regions are packed into the device staging ring, srcOffsets refer to the data pointer
+vw::CommandBuffer vw::VertexBuffer::loadData(void* data, std::vector<vk::BufferCopy> regions, uint32_t dstQueueFamily)
+{
+	vk::DeviceSize stagingSize = 0;
+	for (auto& region : regions)
+		stagingSize += region.size;
+
+	uint32_t transferFamily = deviceRef.getTransferQueueFamily();
+	vw::CommandBuffer cmdBuffer = deviceRef.createCommandBuffer(transferFamily, vk::CommandBufferLevel::ePrimary);
+
+	auto& stagingRing = deviceRef.getStagingRing();
+	auto stagingRegion = stagingRing.allocate(stagingSize);
+	stagingRing.releaseSegment(stagingRegion.segment, cmdBuffer);
+
+	vk::DeviceSize stagingOffset = 0;
+	for (auto& region : regions)
+	{
+		memcpy(static_cast<char*>(stagingRegion.data) + stagingOffset, static_cast<char*>(data) + region.srcOffset, static_cast<size_t>(region.size));
+		region.srcOffset = stagingRegion.offset + stagingOffset;
+		stagingOffset += region.size;
+	}
+
+	cmdBuffer.begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+	cmdBuffer.copyBuffer(stagingRegion.buffer, *this, regions);
+	deviceRef.transferOwnership(cmdBuffer, transferFamily, dstQueueFamily, { createBufferOwnershipBarrier(*this) }, {});
+	cmdBuffer.end();
+	return cmdBuffer;
+}
+
+vw::StorageBuffer::StorageBuffer(vw::Device& device, vk::DeviceSize size, vk::MemoryPropertyFlags requiredProperties) : vw::Buffer(device, size, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, requiredProperties), deviceRef(device)
+{
+}
+
+vw::CommandBuffer vw::StorageBuffer::loadData(void* data, std::vector<vk::BufferCopy> regions, uint32_t dstQueueFamily)
+{
+	vk::DeviceSize stagingSize = 0;
+	for (auto& region : regions)
+		stagingSize += region.size;
+
+	uint32_t transferFamily = deviceRef.getTransferQueueFamily();
+	vw::CommandBuffer cmdBuffer = deviceRef.createCommandBuffer(transferFamily, vk::CommandBufferLevel::ePrimary);
+
+	auto& stagingRing = deviceRef.getStagingRing();
+	auto stagingRegion = stagingRing.allocate(stagingSize);
+	stagingRing.releaseSegment(stagingRegion.segment, cmdBuffer);
+
+	vk::DeviceSize stagingOffset = 0;
+	for (auto& region : regions)
+	{
+		memcpy(static_cast<char*>(stagingRegion.data) + stagingOffset, static_cast<char*>(data) + region.srcOffset, static_cast<size_t>(region.size));
+		region.srcOffset = stagingRegion.offset + stagingOffset;
+		stagingOffset += region.size;
+	}
+
+	cmdBuffer.begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+	cmdBuffer.copyBuffer(stagingRegion.buffer, *this, regions);
+	deviceRef.transferOwnership(cmdBuffer, transferFamily, dstQueueFamily, { createBufferOwnershipBarrier(*this) }, {});
+	cmdBuffer.end();
+	return cmdBuffer;
+}
+
+void* vw::StorageBuffer::getMappedData()
 {
-	stagingBuffer->loadData(data);
-	return stagingBuffer->copyToBuffer(*this, regions);
+	if (!bufferAllocation.mappedData)
+		throw std::runtime_error("VwStorageBuffer: Buffer is not host visible!");
+	return bufferAllocation.mappedData;
 }
 
 vw::ColorAttachment::ColorAttachment(vw::Device& device) : ImageBase(device)
@@ -58,8 +58,9 @@ vw::Semaphore::~Semaphore()
 	deviceHandle.destroySemaphore(*this);
 }
 
-vw::Swapchain::Swapchain(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface) : deviceHandle(logicalDevice)
+vw::Swapchain::Swapchain(vw::Device& device, vk::SurfaceKHR surface) : deviceHandle(device), deviceRef(device)
 {
+	vk::PhysicalDevice physicalDevice = device.getPhysicalDevice();
 	uint32_t queueFamilyCount = physicalDevice.getQueueFamilyProperties().size();
 	std::vector<uint32_t> presentationQueueIndices;
 	for (uint32_t i = 0; i < queueFamilyCount; ++i)
@@ -70,7 +71,8 @@ vw::Swapchain::Swapchain(vk::Device logicalDevice, vk::PhysicalDevice physicalDe
 			presentationQueueIndices.push_back(i);
 	}
 
-	presentQueue = logicalDevice.getQueue(presentationQueueIndices[0], 0);
+	//Presentation goes through the device queue scheduler so it is synchronized with submissions
+	presentQueueFamily = presentationQueueIndices[0];
 
 	//default surface format was checked earlier
 	selectedFormat = { vk::Format::eB8G8R8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear };
@@ -127,7 +129,7 @@ vw::Swapchain::Swapchain(vk::Device logicalDevice, vk::PhysicalDevice physicalDe
 	}
 }
 
-void vw::Swapchain::present(uint32_t imageIndex, std::vector<vk::Semaphore> waitConditions)
+void vw::Swapchain::present(uint32_t imageIndex, vk::ArrayProxy<const vk::Semaphore> waitConditions)
 {
 	vk::PresentInfoKHR presentInfo;
 	presentInfo.swapchainCount = 1;
@@ -136,13 +138,9 @@ void vw::Swapchain::present(uint32_t imageIndex, std::vector<vk::Semaphore> wait
 
 	presentInfo.waitSemaphoreCount = waitConditions.size();
 	presentInfo.pWaitSemaphores = waitConditions.data();
-	presentQueue.presentKHR(presentInfo);
-}
 
-void vw::Swapchain::presentAndSync(uint32_t imageIndex, std::vector<vk::Semaphore> waitConditions)
-{
-	present(imageIndex, waitConditions);
-	presentQueue.waitIdle();
+	auto queueLease = deviceRef.acquireQueue(presentQueueFamily);
+	queueLease.queue.presentKHR(presentInfo);
 }
 
 vk::Extent2D vw::Swapchain::getExtent()
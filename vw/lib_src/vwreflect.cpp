@@ -0,0 +1,572 @@
+#include "vwreflect.h"
+#include "vwshader.h"
+#include <algorithm>
+
+static const uint32_t SpirvMagic = 0x07230203;
+static const uint32_t ExecutionModeLocalSize = 17;
+static const uint32_t ExecutionModeLocalSizeId = 38;
+static const uint32_t BuiltInWorkgroupSize = 25;
+
+enum SpirvOp
+{
+	OpExecutionMode = 16,
+	OpTypeInt = 21,
+	OpTypeFloat = 22,
+	OpTypeVector = 23,
+	OpTypeMatrix = 24,
+	OpTypeImage = 25,
+	OpTypeSampler = 26,
+	OpTypeSampledImage = 27,
+	OpTypeArray = 28,
+	OpTypeRuntimeArray = 29,
+	OpTypeStruct = 30,
+	OpTypePointer = 32,
+	OpConstant = 43,
+	OpConstantComposite = 44,
+	OpSpecConstant = 50,
+	OpSpecConstantComposite = 51,
+	OpVariable = 59,
+	OpDecorate = 71,
+	OpMemberDecorate = 72,
+	OpExecutionModeId = 331,
+	OpTypeAccelerationStructureKHR = 5341
+};
+
+enum SpirvDecoration
+{
+	DecorationSpecId = 1,
+	DecorationBufferBlock = 3,
+	DecorationArrayStride = 6,
+	DecorationMatrixStride = 7,
+	DecorationBuiltIn = 11,
+	DecorationLocation = 30,
+	DecorationBinding = 33,
+	DecorationDescriptorSet = 34,
+	DecorationOffset = 35
+};
+
+enum SpirvStorageClass
+{
+	StorageUniformConstant = 0,
+	StorageInput = 1,
+	StorageUniform = 2,
+	StoragePushConstant = 9,
+	StorageStorageBuffer = 12
+};
+
+//Structs have at most 16383 members, types nest far less deep than this in practice
+static const uint32_t SpirvMaxMembers = 16383;
+static const uint32_t SpirvMaxTypeDepth = 64;
+static const uint32_t SpirvMaxIdBound = 0x3FFFFF;
+
+//Everything known about one result id, operands are the words following the result id
+struct SpirvId
+{
+	uint32_t opcode = 0;
+	std::vector<uint32_t> operands;
+	uint32_t set = 0;
+	uint32_t binding = 0;
+	uint32_t location = 0;
+	uint32_t arrayStride = 0;
+	uint32_t specId = 0;
+	bool hasSpecId = false;
+	bool builtIn = false;
+	bool bufferBlock = false;
+	std::vector<uint32_t> memberOffsets;
+	std::vector<uint32_t> memberMatrixStrides;
+};
+
+static void checkSpirv(bool valid)
+{
+	if (!valid)
+		throw std::runtime_error("VwReflection: malformed SPIR-V module!");
+}
+
+static SpirvId& spirvId(std::vector<SpirvId>& ids, uint32_t id)
+{
+	checkSpirv(id < ids.size());
+	return ids[id];
+}
+
+static const SpirvId& spirvId(const std::vector<SpirvId>& ids, uint32_t id)
+{
+	checkSpirv(id < ids.size());
+	return ids[id];
+}
+
+static uint32_t spirvOperand(const SpirvId& id, size_t index)
+{
+	checkSpirv(index < id.operands.size());
+	return id.operands[index];
+}
+
+//Array lengths sized by spec constants use the default value of the constant
+static uint32_t spirvArrayLength(const std::vector<SpirvId>& ids, const SpirvId& arrayType)
+{
+	const SpirvId& length = spirvId(ids, spirvOperand(arrayType, 1));
+	checkSpirv(length.opcode == OpConstant || length.opcode == OpSpecConstant);
+	return spirvOperand(length, 1);
+}
+
+//Lengths computed by spec constant operations are only known once the pipeline is specialized
+static bool spirvHasConstantLength(const std::vector<SpirvId>& ids, const SpirvId& arrayType)
+{
+	const SpirvId& length = spirvId(ids, spirvOperand(arrayType, 1));
+	return length.opcode == OpConstant || length.opcode == OpSpecConstant;
+}
+
+//Default value of a workgroup size component, the spec id is kept so pipelines can apply their specialization
+static void spirvLocalSize(const std::vector<SpirvId>& ids, uint32_t constantId, vw::ShaderReflection& reflection, uint32_t dimension)
+{
+	const SpirvId& constant = spirvId(ids, constantId);
+	checkSpirv(constant.opcode == OpConstant || constant.opcode == OpSpecConstant);
+	reflection.localSize[dimension] = spirvOperand(constant, 1);
+	if (constant.opcode == OpSpecConstant && constant.hasSpecId)
+		reflection.localSizeSpecIds[dimension] = constant.specId;
+}
+
+static void setMemberDecoration(std::vector<uint32_t>& values, uint32_t member, uint32_t value)
+{
+	checkSpirv(member < SpirvMaxMembers);
+	if (values.size() <= member)
+		values.resize(member + 1, 0);
+	values[member] = value;
+}
+
+static uint32_t spirvTypeSize(const std::vector<SpirvId>& ids, uint32_t typeId, uint32_t depth = 0)
+{
+	//Malformed modules may reference types cyclically
+	checkSpirv(depth < SpirvMaxTypeDepth);
+	const SpirvId& type = spirvId(ids, typeId);
+	switch (type.opcode)
+	{
+	case OpTypeInt:
+	case OpTypeFloat:
+		return spirvOperand(type, 0) / 8;
+	case OpTypeVector:
+	case OpTypeMatrix:
+		return spirvOperand(type, 1) * spirvTypeSize(ids, spirvOperand(type, 0), depth + 1);
+	case OpTypeArray:
+	{
+		uint32_t length = spirvArrayLength(ids, type);
+		return length * (type.arrayStride ? type.arrayStride : spirvTypeSize(ids, spirvOperand(type, 0), depth + 1));
+	}
+	case OpTypeStruct:
+	{
+		uint32_t size = 0;
+		for (uint32_t i = 0; i < type.operands.size(); ++i)
+		{
+			const SpirvId& memberType = spirvId(ids, type.operands[i]);
+			uint32_t offset = i < type.memberOffsets.size() ? type.memberOffsets[i] : 0;
+			uint32_t matrixStride = i < type.memberMatrixStrides.size() ? type.memberMatrixStrides[i] : 0;
+			uint32_t memberSize = (memberType.opcode == OpTypeMatrix && matrixStride) ? spirvOperand(memberType, 1) * matrixStride : spirvTypeSize(ids, type.operands[i], depth + 1);
+			size = std::max(size, offset + memberSize);
+		}
+		return size;
+	}
+	default:
+		return 0;
+	}
+}
+
+//Returns false for types without a known descriptor type
+static bool spirvDescriptorType(const std::vector<SpirvId>& ids, uint32_t typeId, uint32_t storageClass, vk::DescriptorType& descriptorType)
+{
+	const SpirvId& type = spirvId(ids, typeId);
+	if (storageClass == StorageStorageBuffer || (storageClass == StorageUniform && type.bufferBlock))
+		descriptorType = vk::DescriptorType::eStorageBuffer;
+	else if (storageClass == StorageUniform)
+		descriptorType = vk::DescriptorType::eUniformBuffer;
+	else if (type.opcode == OpTypeSampler)
+		descriptorType = vk::DescriptorType::eSampler;
+	else if (type.opcode == OpTypeSampledImage)
+		descriptorType = vk::DescriptorType::eCombinedImageSampler;
+	else if (type.opcode == OpTypeImage)
+	{
+		//Operands: sampled type, dim, depth, arrayed, multisampled, sampled
+		uint32_t dim = spirvOperand(type, 1);
+		bool sampled = spirvOperand(type, 5) == 1;
+		if (dim == 5)
+			descriptorType = sampled ? vk::DescriptorType::eUniformTexelBuffer : vk::DescriptorType::eStorageTexelBuffer;
+		else if (dim == 6)
+			descriptorType = vk::DescriptorType::eInputAttachment;
+		else
+			descriptorType = sampled ? vk::DescriptorType::eSampledImage : vk::DescriptorType::eStorageImage;
+	}
+#ifdef VK_KHR_acceleration_structure
+	else if (type.opcode == OpTypeAccelerationStructureKHR)
+		descriptorType = vk::DescriptorType::eAccelerationStructureKHR;
+#endif
+	else
+		return false;
+	return true;
+}
+
+//eUndefined for inputs spanning several locations or components of other widths than 16, 32 and 64 bits
+static vk::Format spirvVertexFormat(const std::vector<SpirvId>& ids, uint32_t typeId)
+{
+	const SpirvId& type = spirvId(ids, typeId);
+	uint32_t componentCount = type.opcode == OpTypeVector ? spirvOperand(type, 1) : 1;
+	const SpirvId& component = type.opcode == OpTypeVector ? spirvId(ids, spirvOperand(type, 0)) : type;
+	if ((component.opcode != OpTypeFloat && component.opcode != OpTypeInt) || componentCount == 0 || componentCount > 4)
+		return vk::Format::eUndefined;
+
+	//Indexed by width, then float, signed and unsigned
+	static const vk::Format formats[3][3][4] =
+	{
+		{
+			{ vk::Format::eR16Sfloat, vk::Format::eR16G16Sfloat, vk::Format::eR16G16B16Sfloat, vk::Format::eR16G16B16A16Sfloat },
+			{ vk::Format::eR16Sint, vk::Format::eR16G16Sint, vk::Format::eR16G16B16Sint, vk::Format::eR16G16B16A16Sint },
+			{ vk::Format::eR16Uint, vk::Format::eR16G16Uint, vk::Format::eR16G16B16Uint, vk::Format::eR16G16B16A16Uint }
+		},
+		{
+			{ vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat },
+			{ vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint },
+			{ vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint }
+		},
+		{
+			{ vk::Format::eR64Sfloat, vk::Format::eR64G64Sfloat, vk::Format::eR64G64B64Sfloat, vk::Format::eR64G64B64A64Sfloat },
+			{ vk::Format::eR64Sint, vk::Format::eR64G64Sint, vk::Format::eR64G64B64Sint, vk::Format::eR64G64B64A64Sint },
+			{ vk::Format::eR64Uint, vk::Format::eR64G64Uint, vk::Format::eR64G64B64Uint, vk::Format::eR64G64B64A64Uint }
+		}
+	};
+	uint32_t width = spirvOperand(component, 0);
+	if (width != 16 && width != 32 && width != 64)
+		return vk::Format::eUndefined;
+	uint32_t widthIndex = width == 16 ? 0 : (width == 32 ? 1 : 2);
+	uint32_t kindIndex = component.opcode == OpTypeFloat ? 0 : (spirvOperand(component, 1) ? 1 : 2);
+	return formats[widthIndex][kindIndex][componentCount - 1];
+}
+
+vw::ShaderReflection vw::reflectSpirv(const uint32_t* code, size_t wordCount, vk::ShaderStageFlagBits stage)
+{
+	if (wordCount < 5 || code[0] != SpirvMagic)
+		throw std::runtime_error("VwReflection: invalid SPIR-V module!");
+	//Universal limit of the id bound, ids are checked against the bound before use
+	checkSpirv(code[3] <= SpirvMaxIdBound);
+
+	vw::ShaderReflection reflection;
+	reflection.stageFlags = stage;
+	std::vector<SpirvId> ids(code[3]);
+	std::vector<uint32_t> variables;
+	//Constants follow the execution modes, so ids of the workgroup size are resolved after the walk
+	uint32_t localSizeIds[3] = {};
+	uint32_t workgroupSizeId = 0;
+	for (size_t offset = 5; offset < wordCount;)
+	{
+		uint32_t opcode = code[offset] & 0xFFFF;
+		uint32_t instructionWords = code[offset] >> 16;
+		if (instructionWords == 0 || offset + instructionWords > wordCount)
+			throw std::runtime_error("VwReflection: invalid SPIR-V module!");
+		const uint32_t* words = code + offset;
+		offset += instructionWords;
+
+		switch (opcode)
+		{
+		case OpExecutionMode:
+			checkSpirv(instructionWords >= 3);
+			if (words[2] == ExecutionModeLocalSize && instructionWords >= 6)
+				std::copy(words + 3, words + 6, reflection.localSize);
+			break;
+		case OpExecutionModeId:
+			checkSpirv(instructionWords >= 3);
+			if (words[2] == ExecutionModeLocalSizeId)
+			{
+				checkSpirv(instructionWords >= 6);
+				std::copy(words + 3, words + 6, localSizeIds);
+			}
+			break;
+		case OpTypeInt:
+		case OpTypeFloat:
+		case OpTypeVector:
+		case OpTypeMatrix:
+		case OpTypeImage:
+		case OpTypeSampler:
+		case OpTypeSampledImage:
+		case OpTypeArray:
+		case OpTypeRuntimeArray:
+		case OpTypeStruct:
+		case OpTypePointer:
+		case OpTypeAccelerationStructureKHR:
+		{
+			checkSpirv(instructionWords >= 2);
+			SpirvId& type = spirvId(ids, words[1]);
+			type.opcode = opcode;
+			type.operands.assign(words + 2, words + instructionWords);
+			break;
+		}
+		case OpConstant:
+		case OpSpecConstant:
+		case OpVariable:
+		{
+			//Result type comes first, operands hold the result type followed by the value, default value or storage class
+			checkSpirv(instructionWords >= 4);
+			SpirvId& result = spirvId(ids, words[2]);
+			result.opcode = opcode;
+			result.operands = { words[1], words[3] };
+			if (opcode == OpVariable)
+				variables.push_back(words[2]);
+			break;
+		}
+		case OpConstantComposite:
+		case OpSpecConstantComposite:
+		{
+			//Operands hold the result type followed by the constituents
+			checkSpirv(instructionWords >= 3);
+			SpirvId& result = spirvId(ids, words[2]);
+			result.opcode = opcode;
+			result.operands.assign({ words[1] });
+			result.operands.insert(result.operands.end(), words + 3, words + instructionWords);
+			break;
+		}
+		case OpDecorate:
+		{
+			checkSpirv(instructionWords >= 3);
+			SpirvId& target = spirvId(ids, words[1]);
+			bool hasValue = instructionWords >= 4;
+			switch (words[2])
+			{
+			case DecorationBufferBlock: target.bufferBlock = true; break;
+			case DecorationBuiltIn:
+				checkSpirv(hasValue);
+				target.builtIn = true;
+				if (words[3] == BuiltInWorkgroupSize)
+					workgroupSizeId = words[1];
+				break;
+			case DecorationSpecId: checkSpirv(hasValue); target.specId = words[3]; target.hasSpecId = true; break;
+			case DecorationArrayStride: checkSpirv(hasValue); target.arrayStride = words[3]; break;
+			case DecorationLocation: checkSpirv(hasValue); target.location = words[3]; break;
+			case DecorationBinding: checkSpirv(hasValue); target.binding = words[3]; break;
+			case DecorationDescriptorSet: checkSpirv(hasValue); target.set = words[3]; break;
+			}
+			break;
+		}
+		case OpMemberDecorate:
+			checkSpirv(instructionWords >= 4);
+			if (words[3] == DecorationOffset)
+			{
+				checkSpirv(instructionWords >= 5);
+				setMemberDecoration(spirvId(ids, words[1]).memberOffsets, words[2], words[4]);
+			}
+			else if (words[3] == DecorationMatrixStride)
+			{
+				checkSpirv(instructionWords >= 5);
+				setMemberDecoration(spirvId(ids, words[1]).memberMatrixStrides, words[2], words[4]);
+			}
+			break;
+		}
+	}
+
+	//The WorkgroupSize built-in takes precedence over the execution modes
+	if (workgroupSizeId)
+	{
+		const SpirvId& workgroupSize = spirvId(ids, workgroupSizeId);
+		checkSpirv((workgroupSize.opcode == OpConstantComposite || workgroupSize.opcode == OpSpecConstantComposite) && workgroupSize.operands.size() == 4);
+		for (uint32_t i = 0; i < 3; ++i)
+			spirvLocalSize(ids, workgroupSize.operands[i + 1], reflection, i);
+	}
+	else if (localSizeIds[0])
+		for (uint32_t i = 0; i < 3; ++i)
+			spirvLocalSize(ids, localSizeIds[i], reflection, i);
+
+	for (auto variableId : variables)
+	{
+		const SpirvId& variable = ids[variableId];
+		uint32_t storageClass = spirvOperand(variable, 1);
+		const SpirvId& pointerType = spirvId(ids, spirvOperand(variable, 0));
+		checkSpirv(pointerType.opcode == OpTypePointer);
+		uint32_t typeId = spirvOperand(pointerType, 1);
+
+		if (storageClass == StoragePushConstant)
+		{
+			reflection.pushConstantSize = spirvTypeSize(ids, typeId);
+			reflection.pushConstantStages = stage;
+		}
+		else if (storageClass == StorageUniformConstant || storageClass == StorageUniform || storageClass == StorageStorageBuffer)
+		{
+			vw::ReflectedBinding binding;
+			binding.set = variable.set;
+			binding.binding = variable.binding;
+			binding.descriptorCount = 1;
+			for (uint32_t depth = 0; spirvId(ids, typeId).opcode == OpTypeArray || spirvId(ids, typeId).opcode == OpTypeRuntimeArray; ++depth)
+			{
+				checkSpirv(depth < SpirvMaxTypeDepth);
+				const SpirvId& arrayType = ids[typeId];
+				if (arrayType.opcode == OpTypeRuntimeArray)
+					binding.descriptorCount = 0;
+				else if (spirvHasConstantLength(ids, arrayType))
+					binding.descriptorCount *= spirvArrayLength(ids, arrayType);
+				else
+					binding.derivable = false;
+				typeId = spirvOperand(arrayType, 0);
+			}
+			if (!spirvDescriptorType(ids, typeId, storageClass, binding.descriptorType))
+			{
+				binding.descriptorType = vk::DescriptorType::eSampler;
+				binding.derivable = false;
+			}
+			binding.stageFlags = stage;
+			reflection.bindings.push_back(binding);
+		}
+		else if (storageClass == StorageInput && stage == vk::ShaderStageFlagBits::eVertex && !variable.builtIn && spirvId(ids, typeId).opcode != OpTypeStruct)
+		{
+			vw::ReflectedVertexInput vertexInput;
+			vertexInput.location = variable.location;
+			vertexInput.format = spirvVertexFormat(ids, typeId);
+			vertexInput.size = spirvTypeSize(ids, typeId);
+			reflection.vertexInputs.push_back(vertexInput);
+		}
+	}
+
+	std::sort(reflection.vertexInputs.begin(), reflection.vertexInputs.end(), [](const vw::ReflectedVertexInput& a, const vw::ReflectedVertexInput& b) { return a.location < b.location; });
+	return reflection;
+}
+
+vw::ShaderReflection vw::mergeReflections(const std::vector<vw::ShaderReflection>& reflections)
+{
+	vw::ShaderReflection merged;
+	for (auto& reflection : reflections)
+	{
+		merged.stageFlags |= reflection.stageFlags;
+		for (auto& binding : reflection.bindings)
+		{
+			auto found = std::find_if(merged.bindings.begin(), merged.bindings.end(), [&binding](const vw::ReflectedBinding& other) { return other.set == binding.set && other.binding == binding.binding; });
+			if (found == merged.bindings.end())
+				merged.bindings.push_back(binding);
+			else
+			{
+				if (found->derivable && binding.derivable && found->descriptorType != binding.descriptorType)
+					throw std::runtime_error("VwReflection: binding declared with different descriptor types!");
+				found->derivable &= binding.derivable;
+				found->stageFlags |= binding.stageFlags;
+				found->descriptorCount = std::max(found->descriptorCount, binding.descriptorCount);
+			}
+		}
+		merged.pushConstantSize = std::max(merged.pushConstantSize, reflection.pushConstantSize);
+		merged.pushConstantStages |= reflection.pushConstantStages;
+		if (!reflection.vertexInputs.empty())
+			merged.vertexInputs = reflection.vertexInputs;
+		if (reflection.stageFlags & vk::ShaderStageFlagBits::eCompute)
+		{
+			std::copy(reflection.localSize, reflection.localSize + 3, merged.localSize);
+			std::copy(reflection.localSizeSpecIds, reflection.localSizeSpecIds + 3, merged.localSizeSpecIds);
+		}
+	}
+	return merged;
+}
+
+vw::LayoutCache::LayoutCache(vk::Device device) : deviceHandle(device)
+{
+}
+
+vw::LayoutCache::~LayoutCache()
+{
+	for (auto& layout : pipelineLayouts)
+		deviceHandle.destroyPipelineLayout(layout.second);
+	for (auto& layout : setLayouts)
+		deviceHandle.destroyDescriptorSetLayout(layout.second);
+}
+
+vk::DescriptorSetLayout vw::LayoutCache::getSetLayout(std::vector<vk::DescriptorSetLayoutBinding> bindings, vk::DescriptorSetLayoutCreateFlags flags)
+{
+	std::sort(bindings.begin(), bindings.end(), [](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+	std::vector<uint64_t> key = { (uint64_t)(VkDescriptorSetLayoutCreateFlags)flags };
+	for (auto& binding : bindings)
+	{
+		if (binding.pImmutableSamplers)
+			throw std::runtime_error("VwLayoutCache: immutable samplers are not supported!");
+		key.insert(key.end(), { binding.binding, (uint64_t)binding.descriptorType, binding.descriptorCount, (uint64_t)(VkShaderStageFlags)binding.stageFlags });
+	}
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto found = setLayouts.find(key);
+	if (found != setLayouts.end())
+		return found->second;
+
+	vk::DescriptorSetLayoutCreateInfo layoutCreateInfo;
+	layoutCreateInfo.flags = flags;
+	layoutCreateInfo.bindingCount = (uint32_t)bindings.size();
+	layoutCreateInfo.pBindings = bindings.data();
+	vk::DescriptorSetLayout layout = deviceHandle.createDescriptorSetLayout(layoutCreateInfo);
+	setLayouts.emplace(key, layout);
+	setLayoutBindings.emplace(layout, bindings);
+	return layout;
+}
+
+const std::vector<vk::DescriptorSetLayoutBinding>* vw::LayoutCache::getBindings(vk::DescriptorSetLayout layout)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto found = setLayoutBindings.find(layout);
+	return found != setLayoutBindings.end() ? &found->second : nullptr;
+}
+
+vk::PipelineLayout vw::LayoutCache::getPipelineLayout(const std::vector<vk::DescriptorSetLayout>& layouts, const std::vector<vk::PushConstantRange>& pushConstants)
+{
+	std::vector<uint64_t> key;
+	for (auto layout : layouts)
+		key.push_back((uint64_t)static_cast<VkDescriptorSetLayout>(layout));
+	//Separates the set layouts from the push constant ranges
+	key.push_back(~0ull);
+	for (auto& range : pushConstants)
+		key.insert(key.end(), { (uint64_t)(VkShaderStageFlags)range.stageFlags, range.offset, range.size });
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto found = pipelineLayouts.find(key);
+	if (found != pipelineLayouts.end())
+		return found->second;
+
+	vk::PipelineLayoutCreateInfo layoutCreateInfo;
+	layoutCreateInfo.setLayoutCount = (uint32_t)layouts.size();
+	layoutCreateInfo.pSetLayouts = layouts.data();
+	layoutCreateInfo.pushConstantRangeCount = (uint32_t)pushConstants.size();
+	layoutCreateInfo.pPushConstantRanges = pushConstants.data();
+	vk::PipelineLayout layout = deviceHandle.createPipelineLayout(layoutCreateInfo);
+	pipelineLayouts.emplace(key, layout);
+	pushConstantRanges.emplace(layout, pushConstants);
+	return layout;
+}
+
+const std::vector<vk::PushConstantRange>* vw::LayoutCache::getPushConstantRanges(vk::PipelineLayout layout)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto found = pushConstantRanges.find(layout);
+	return found != pushConstantRanges.end() ? &found->second : nullptr;
+}
+
+vk::PipelineLayout vw::LayoutCache::getPipelineLayout(const vw::ShaderReflection& reflection, const std::map<uint32_t, vk::DescriptorSetLayout>& givenLayouts)
+{
+	std::map<uint32_t, std::vector<vk::DescriptorSetLayoutBinding>> setBindings;
+	for (auto& binding : reflection.bindings)
+	{
+		if (givenLayouts.count(binding.set))
+			continue;
+		if (binding.descriptorCount == 0)
+			throw std::runtime_error("VwLayoutCache: runtime sized descriptor arrays need an explicit layout!");
+		if (!binding.derivable)
+			throw std::runtime_error("VwLayoutCache: descriptor type or count of a binding could not be reflected, its set needs an explicit layout!");
+		setBindings[binding.set].push_back(vk::DescriptorSetLayoutBinding(binding.binding, binding.descriptorType, binding.descriptorCount, binding.stageFlags));
+	}
+
+	std::vector<vk::DescriptorSetLayout> layouts;
+	uint32_t setCount = setBindings.empty() ? 0 : setBindings.rbegin()->first + 1;
+	if (!givenLayouts.empty())
+		setCount = std::max(setCount, givenLayouts.rbegin()->first + 1);
+	for (uint32_t set = 0; set < setCount; ++set)
+	{
+		auto given = givenLayouts.find(set);
+		layouts.push_back(given != givenLayouts.end() ? given->second : getSetLayout(setBindings[set]));
+	}
+
+	std::vector<vk::PushConstantRange> pushConstants;
+	if (reflection.pushConstantSize)
+		pushConstants.push_back(vk::PushConstantRange(reflection.pushConstantStages, 0, reflection.pushConstantSize));
+	return getPipelineLayout(layouts, pushConstants);
+}
+
+vk::PipelineLayout vw::LayoutCache::getPipelineLayout(std::vector<std::reference_wrapper<vw::Shader>> shaders)
+{
+	std::vector<vw::ShaderReflection> reflections;
+	for (auto& shader : shaders)
+		reflections.push_back(shader.get().getReflection());
+	return getPipelineLayout(vw::mergeReflections(reflections));
+}
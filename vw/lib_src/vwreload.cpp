@@ -0,0 +1,208 @@
+#include "vwreload.h"
+#include "vkcore.h"
+#include "vwcompute.h"
+#include <algorithm>
+#include <iostream>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+static std::filesystem::path normalizePath(const std::filesystem::path& path)
+{
+	std::error_code error;
+	std::filesystem::path absolutePath = std::filesystem::absolute(path, error);
+	return (error ? path : absolutePath).lexically_normal();
+}
+
+vw::ShaderWatcher::ShaderWatcher(vw::Device& device, uint32_t framesInFlight, size_t retainedPipelines, std::chrono::milliseconds pollInterval) : interval(pollInterval), lastPoll(std::chrono::steady_clock::now()), deviceRef(device), evictionDelay(framesInFlight), retainedLimit(retainedPipelines)
+{
+#ifdef __linux__
+	notifyHandle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+vw::ShaderWatcher::~ShaderWatcher()
+{
+#ifdef __linux__
+	if (notifyHandle >= 0)
+		close(notifyHandle);
+#endif
+}
+
+void vw::ShaderWatcher::watch(vw::Shader& shader)
+{
+	WatchedShader watched;
+	watched.shader = &shader;
+	watchFile(watched, shader.getSourcePath());
+	shaders.push_back(watched);
+}
+
+void vw::ShaderWatcher::watchFile(WatchedShader& watched, const std::filesystem::path& path)
+{
+	WatchedFile file;
+	file.path = normalizePath(path);
+	std::error_code error;
+	file.lastWrite = std::filesystem::last_write_time(file.path, error);
+	watched.files.push_back(file);
+
+#ifdef __linux__
+	//Editors often replace the file, so the directory is watched instead of the file
+	//Only finished writes and renames into the directory count, creating or truncating a file would reload a partial source
+	std::filesystem::path directory = file.path.parent_path();
+	if (notifyHandle >= 0 && std::none_of(watchedDirectories.begin(), watchedDirectories.end(), [&directory](const std::pair<const int, std::filesystem::path>& entry) { return entry.second == directory; }))
+	{
+		int watchHandle = inotify_add_watch(notifyHandle, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (watchHandle >= 0)
+			watchedDirectories[watchHandle] = directory;
+	}
+#endif
+}
+
+//Includes can change with every compilation, the list is replaced with the one of the current module
+void vw::ShaderWatcher::updateIncludes(WatchedShader& watched)
+{
+	std::vector<std::string> includedFiles;
+	try
+	{
+		includedFiles = watched.shader->getIncludedFiles();
+	}
+	catch (const std::exception&)
+	{
+		//A failed compilation keeps the includes of the previous one
+		return;
+	}
+	watched.files.resize(1);
+	for (auto& includedFile : includedFiles)
+		watchFile(watched, includedFile);
+	watched.includesKnown = true;
+}
+
+void vw::ShaderWatcher::unwatch(vw::Shader& shader)
+{
+	shaders.erase(std::remove_if(shaders.begin(), shaders.end(), [&shader](const WatchedShader& watched) { return watched.shader == &shader; }), shaders.end());
+	reloadingShaders.erase(std::remove(reloadingShaders.begin(), reloadingShaders.end(), &shader), reloadingShaders.end());
+}
+
+void vw::ShaderWatcher::addDependent(vw::RenderPass& renderPass)
+{
+	dependents.push_back(&renderPass);
+}
+
+void vw::ShaderWatcher::removeDependent(vw::RenderPass& renderPass)
+{
+	dependents.erase(std::remove(dependents.begin(), dependents.end(), &renderPass), dependents.end());
+}
+
+void vw::ShaderWatcher::addDependent(vw::ComputePipeline& computePipeline)
+{
+	computeDependents.push_back(&computePipeline);
+}
+
+void vw::ShaderWatcher::removeDependent(vw::ComputePipeline& computePipeline)
+{
+	computeDependents.erase(std::remove(computeDependents.begin(), computeDependents.end(), &computePipeline), computeDependents.end());
+}
+
+void vw::ShaderWatcher::update()
+{
+	for (auto& watched : shaders)
+		if (!watched.includesKnown && watched.shader->isReady())
+			updateIncludes(watched);
+
+	for (auto& changedPath : findChangedFiles())
+		for (auto& watched : shaders)
+			if (std::any_of(watched.files.begin(), watched.files.end(), [&changedPath](const WatchedFile& file) { return file.path == changedPath; }))
+			{
+				watched.shader->reload();
+				if (std::find(reloadingShaders.begin(), reloadingShaders.end(), watched.shader) == reloadingShaders.end())
+					reloadingShaders.push_back(watched.shader);
+			}
+
+	for (auto shader = reloadingShaders.begin(); shader != reloadingShaders.end();)
+	{
+		bool applied;
+		try
+		{
+			applied = (*shader)->applyReload();
+		}
+		catch (const std::exception& error)
+		{
+			//The shader keeps its previous module until the source compiles again
+			std::cerr << error.what() << std::endl;
+			shader = reloadingShaders.erase(shader);
+			continue;
+		}
+		if (!applied)
+		{
+			++shader;
+			continue;
+		}
+
+		for (auto renderPass : dependents)
+			renderPass->rebuildPipelines(**shader);
+		for (auto computePipeline : computeDependents)
+			computePipeline->rebuildPipeline(**shader);
+		for (auto& watched : shaders)
+			if (watched.shader == *shader)
+				updateIncludes(watched);
+		shader = reloadingShaders.erase(shader);
+	}
+
+	bool swapped = false;
+	for (auto renderPass : dependents)
+		swapped |= renderPass->swapPipelines();
+	for (auto computePipeline : computeDependents)
+		swapped |= computePipeline->swapPipeline();
+
+	//Every reload adds pipelines to the cache, the replaced ones are evicted once frames in flight cannot use them anymore
+	if (swapped)
+		updatesUntilEviction = evictionDelay + 1;
+	if (updatesUntilEviction && --updatesUntilEviction == 0)
+	{
+		deviceRef.getPipelines().evictUnused(retainedLimit);
+		for (auto computePipeline : computeDependents)
+			computePipeline->destroyRetiredPipelines();
+	}
+}
+
+std::vector<std::filesystem::path> vw::ShaderWatcher::findChangedFiles()
+{
+	std::vector<std::filesystem::path> changedFiles;
+#ifdef __linux__
+	if (notifyHandle >= 0)
+	{
+		alignas(inotify_event) char buffer[4096];
+		ssize_t length;
+		while ((length = read(notifyHandle, buffer, sizeof(buffer))) > 0)
+			for (char* position = buffer; position < buffer + length;)
+			{
+				inotify_event* event = reinterpret_cast<inotify_event*>(position);
+				auto directory = watchedDirectories.find(event->wd);
+				if (event->len && directory != watchedDirectories.end())
+					changedFiles.push_back((directory->second / event->name).lexically_normal());
+				position += sizeof(inotify_event) + event->len;
+			}
+		return changedFiles;
+	}
+#endif
+
+	auto now = std::chrono::steady_clock::now();
+	if (now - lastPoll < interval)
+		return changedFiles;
+	lastPoll = now;
+
+	for (auto& watched : shaders)
+		for (auto& file : watched.files)
+		{
+			//Files being written may briefly be missing, they are picked up on a later poll
+			std::error_code error;
+			auto lastWrite = std::filesystem::last_write_time(file.path, error);
+			if (!error && lastWrite != file.lastWrite)
+			{
+				file.lastWrite = lastWrite;
+				changedFiles.push_back(file.path);
+			}
+		}
+	return changedFiles;
+}
@@ -1,6 +1,10 @@
 #include "vwrender.h"
+#include "vkcore.h"
+#include "vwjobs.h"
+#include "vwreflect.h"
+#include <algorithm>
 
-vw::RenderPass::RenderPass(vk::Device device, std::vector<vk::Format> attachmentFormats, std::vector<vk::ImageLayout> attachmentOutputLayouts, std::vector<vw::SubpassDescription> subpasses) : deviceHandle(device)
+vw::RenderPass::RenderPass(vw::Device& device, std::vector<vk::Format> attachmentFormats, std::vector<vk::ImageLayout> attachmentOutputLayouts, std::vector<vw::SubpassDescription> subpasses) : deviceHandle(device), deviceRef(device)
 {
 
 	subpassCount = subpasses.size();
@@ -163,6 +167,23 @@ vw::RenderPass::RenderPass(vk::Device device, std::vector<vk::Format> attachment
 	
 	renderPass = deviceHandle.createRenderPass(renderPassCreateInfo);
 
+	//Attachment formats and the attachments referenced by each subpass decide compatibility, all samples counts are 1
+	//Every list is preceded by its tag and length so different splits of the same values give different keys
+	vw::appendKey(compatibilityKey, (uint64_t)attachmentFormats.size());
+	vw::appendKeyBytes(compatibilityKey, attachmentFormats.data(), attachmentFormats.size() * sizeof(vk::Format));
+	vw::appendKey(compatibilityKey, (uint64_t)subpasses.size());
+	for (auto& subpass : subpasses)
+	{
+		uint32_t referenceTag = 0;
+		for (auto references : { &subpass.inputAttachments, &subpass.colorAttachments, &subpass.depthStencilAttachments })
+		{
+			vw::appendKey(compatibilityKey, referenceTag++);
+			vw::appendKey(compatibilityKey, (uint64_t)references->size());
+			vw::appendKeyBytes(compatibilityKey, references->data(), references->size() * sizeof(uint32_t));
+		}
+	}
+	compatibilityHash = vw::hashBytes(compatibilityKey.data(), compatibilityKey.size());
+
 	std::vector<vw::GraphicsPipelineSettings*> pipelineSettings(subpasses.size());
 	for (size_t i = 0; i < subpasses.size(); ++i)
 		pipelineSettings[i] = subpasses[i].pipelineSettings;
@@ -172,45 +193,358 @@ vw::RenderPass::RenderPass(vk::Device device, std::vector<vk::Format> attachment
  
 vw::RenderPass::~RenderPass()
 {
-	for (auto pipeline : pipelines)
-		deviceHandle.destroyPipeline(pipeline);
-	deviceHandle.destroyPipelineLayout(emptyLayout);
+	//Pipeline tasks refer to the render pass, they have to finish before anything is destroyed
+	//The pipelines belong to the device pipeline cache and stay usable with compatible render passes
+	for (auto& pipeline : pipelines)
+		pipeline.wait();
+	for (auto& rebuild : rebuilds)
+		if (rebuild.pipeline.valid())
+			rebuild.pipeline.wait();
+	for (auto& pipeline : supersededRebuilds)
+		pipeline.wait();
+
+	for (auto& pipeline : pipelines)
+		releasePipeline(pipeline);
+	for (auto& rebuild : rebuilds)
+		releasePipeline(rebuild.pipeline);
+	for (auto& pipeline : supersededRebuilds)
+		releasePipeline(pipeline);
 	deviceHandle.destroyRenderPass(renderPass);
 }
 
 vk::Pipeline vw::RenderPass::getSubpassPipeline(uint32_t subpassIndex)
+{
+	assert(subpassIndex < subpassCount);
+	return pipelines[subpassIndex].get();
+}
+
+std::shared_future<vk::Pipeline> vw::RenderPass::getSubpassPipelineFuture(uint32_t subpassIndex)
 {
 	assert(subpassIndex < subpassCount);
 	return pipelines[subpassIndex];
 }
 
+vk::PipelineLayout vw::RenderPass::getSubpassLayout(uint32_t subpassIndex)
+{
+	getSubpassPipeline(subpassIndex);
+	return *subpassLayouts[subpassIndex];
+}
+
+vk::Pipeline vw::RenderPass::getPipelineVariant(uint32_t subpassIndex, vw::GraphicsPipelineSettings& settings)
+{
+	assert(subpassIndex < subpassCount);
+	return deviceRef.getPipelines().getPipeline(settings, *this, subpassIndex, getSubpassPipeline(subpassIndex));
+}
+
+bool vw::RenderPass::rebuildPipelines(vw::Shader& shader)
+{
+	bool used = false;
+	vw::ThreadPool& threadPool = deviceRef.getThreadPool();
+	for (uint32_t i = 0; i < subpassCount; ++i)
+	{
+		auto& stages = subpassSettings[i]->shaderStages;
+		if (std::none_of(stages.begin(), stages.end(), [&shader](std::reference_wrapper<vw::Shader> stage) { return &stage.get() == &shader; }))
+			continue;
+
+		//A rebuild still in flight keeps running, its result is dropped in favor of this one
+		if (rebuilds[i].pipeline.valid())
+			supersededRebuilds.push_back(rebuilds[i].pipeline);
+		rebuilds[i] = startPipelineTask(i);
+		used = true;
+	}
+	return used;
+}
+
+bool vw::RenderPass::swapPipelines()
+{
+	auto finished = [](std::shared_future<vk::Pipeline>& pipeline) { return pipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready; };
+	auto released = [this, &finished](std::shared_future<vk::Pipeline>& pipeline)
+	{
+		if (!finished(pipeline))
+			return false;
+		releasePipeline(pipeline);
+		return true;
+	};
+	supersededRebuilds.erase(std::remove_if(supersededRebuilds.begin(), supersededRebuilds.end(), released), supersededRebuilds.end());
+
+	bool swapped = false;
+	for (uint32_t i = 0; i < subpassCount; ++i)
+	{
+		if (!rebuilds[i].pipeline.valid() || !finished(rebuilds[i].pipeline))
+			continue;
+
+		PipelineTask rebuilt = std::move(rebuilds[i]);
+		rebuilds[i] = PipelineTask();
+		try
+		{
+			rebuilt.pipeline.get();
+		}
+		catch (const std::exception& error)
+		{
+			//The previous pipeline stays in use until the shader is fixed
+			std::cerr << error.what() << std::endl;
+			continue;
+		}
+		//Frames in flight may still use the replaced pipeline, it stays in the cache until evicted
+		releasePipeline(pipelines[i]);
+		pipelines[i] = rebuilt.pipeline;
+		subpassLayouts[i] = rebuilt.layout;
+		swapped = true;
+	}
+	return swapped;
+}
+
+void vw::RenderPass::waitForPipelines()
+{
+	for (auto& pipeline : pipelines)
+		pipeline.wait();
+}
+
+//Every subpass pipeline is created by its own task of the device thread pool, shaders have to outlive the tasks
 void vw::RenderPass::createPipelines(std::vector<vw::GraphicsPipelineSettings*>& pipelineSettings)
 {
-	vw::PipelineLayout emptyLayout(deviceHandle, {}, {});
+	rebuilds.resize(pipelineSettings.size());
+	for (uint32_t i = 0; i < pipelineSettings.size(); ++i)
+	{
+		//Tasks work on a copy so the caller's settings may go out of scope
+		subpassSettings.push_back(std::make_shared<vw::GraphicsPipelineSettings>(*pipelineSettings[i]));
+		PipelineTask task = startPipelineTask(i);
+		pipelines.push_back(task.pipeline);
+		subpassLayouts.push_back(task.layout);
+	}
+}
+
+vw::RenderPass::PipelineTask vw::RenderPass::startPipelineTask(uint32_t subpassIndex)
+{
+	PipelineTask task;
+	task.layout = std::make_shared<vk::PipelineLayout>();
+	auto settings = subpassSettings[subpassIndex];
+	auto layout = task.layout;
+	task.pipeline = deviceRef.getThreadPool().submit([this, settings, subpassIndex, layout]() { return retainPipeline(*settings, subpassIndex, layout.get()); }).share();
+	return task;
+}
 
-	std::vector<vk::GraphicsPipelineCreateInfo> pipelineCreateInfos(subpassCount);
-	std::vector<std::vector<vk::PipelineShaderStageCreateInfo>> shaderStageInfos(subpassCount);
+//Subpass pipelines are retained so evicting unused pipelines never destroys them
+vk::Pipeline vw::RenderPass::retainPipeline(vw::GraphicsPipelineSettings& settings, uint32_t subpassIndex, vk::PipelineLayout* layout)
+{
+	vk::Pipeline pipeline = deviceRef.getPipelines().getPipeline(settings, *this, subpassIndex, nullptr, layout);
+	deviceRef.getPipelines().retain(pipeline);
+	return pipeline;
+}
 
-	for (size_t i = 0; i < pipelineSettings.size(); ++i)
+//Failed creations retained nothing
+void vw::RenderPass::releasePipeline(std::shared_future<vk::Pipeline>& pipeline)
+{
+	if (!pipeline.valid())
+		return;
+	try
+	{
+		deviceRef.getPipelines().release(pipeline.get());
+	}
+	catch (const std::exception&)
 	{
-		pipelineCreateInfos[i] = pipelineSettings[i]->operator vk::GraphicsPipelineCreateInfo();
-
-		pipelineCreateInfos[i].stageCount = pipelineSettings[i]->shaderStages.size();
-		shaderStageInfos[i].resize(pipelineCreateInfos[i].stageCount);
-		for (size_t j = 0; j < pipelineSettings[i]->shaderStages.size(); ++j)
-			shaderStageInfos[i][j] = pipelineSettings[i]->shaderStages[j].get().getShaderStageInfo();
-		pipelineCreateInfos[i].pStages = shaderStageInfos[i].data();
-		
-		if (!pipelineSettings[i]->pipelineCreateInfo.layout)
-			pipelineCreateInfos[i].layout = emptyLayout;
-	
-		pipelineCreateInfos[i].renderPass = renderPass;
-		pipelineCreateInfos[i].subpass = i;
 	}
+}
 
-	pipelines = deviceHandle.createGraphicsPipelines(vk::PipelineCache(), pipelineCreateInfos);
+vw::PipelineCache::PipelineCache(vw::Device& device) : deviceRef(device)
+{
 }
 
+vw::PipelineCache::~PipelineCache()
+{
+	clear();
+}
+
+vk::Pipeline vw::PipelineCache::getPipeline(vw::GraphicsPipelineSettings& settings, vw::RenderPass& renderPass, uint32_t subpassIndex, vk::Pipeline basePipeline, vk::PipelineLayout* layout)
+{
+	//Derivatives are functionally identical to their base, so the base pipeline is not part of the key
+	std::vector<uint8_t> key = renderPass.getCompatibilityKey();
+	vw::appendKey(key, subpassIndex);
+	std::vector<uint8_t> settingsKey = settings.getKey();
+	key.insert(key.end(), settingsKey.begin(), settingsKey.end());
+
+	std::promise<CachedPipeline> creation;
+	std::shared_future<CachedPipeline> cachedPipeline;
+	bool creating = false;
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto found = cachedPipelines.find(key);
+		if (found == cachedPipelines.end())
+		{
+			found = cachedPipelines.emplace(key, CacheEntry()).first;
+			found->second.pipeline = creation.get_future().share();
+			creating = true;
+		}
+		found->second.lastUse = nextUse++;
+		cachedPipeline = found->second.pipeline;
+	}
+
+	if (creating)
+	{
+		try
+		{
+			CachedPipeline created = createPipeline(settings, renderPass, subpassIndex, basePipeline);
+			{
+				//clear may have dropped the entry meanwhile, it destroys the pipeline once it is set
+				std::lock_guard<std::mutex> lock(cacheMutex);
+				if (cachedPipelines.count(key))
+					pipelineKeys.emplace(created.pipeline, key);
+			}
+			creation.set_value(created);
+		}
+		catch (...)
+		{
+			//Failed states are not cached so a later request tries again
+			{
+				std::lock_guard<std::mutex> lock(cacheMutex);
+				cachedPipelines.erase(key);
+			}
+			creation.set_exception(std::current_exception());
+		}
+	}
+
+	if (layout)
+		*layout = cachedPipeline.get().layout;
+	return cachedPipeline.get().pipeline;
+}
+
+void vw::PipelineCache::retain(vk::Pipeline pipeline)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto keyFound = pipelineKeys.find(pipeline);
+	if (keyFound == pipelineKeys.end())
+		throw std::runtime_error("VwPipelineCache: Pipeline was not created by the cache!");
+	cachedPipelines.at(keyFound->second).references++;
+}
+
+void vw::PipelineCache::release(vk::Pipeline pipeline)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto keyFound = pipelineKeys.find(pipeline);
+	if (keyFound == pipelineKeys.end())
+		throw std::runtime_error("VwPipelineCache: Pipeline was not created by the cache!");
+	CacheEntry& entry = cachedPipelines.at(keyFound->second);
+	if (entry.references == 0)
+		throw std::runtime_error("VwPipelineCache: Pipeline released more often than retained!");
+	entry.references--;
+}
+
+void vw::PipelineCache::evictUnused(size_t retainedLimit)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	//Pipelines in creation are not in pipelineKeys yet and are never evicted
+	std::vector<std::pair<uint64_t, vk::Pipeline>> unused;
+	for (auto& keyEntry : pipelineKeys)
+	{
+		CacheEntry& entry = cachedPipelines.at(keyEntry.second);
+		if (entry.references == 0)
+			unused.push_back({ entry.lastUse, keyEntry.first });
+	}
+	if (unused.size() <= retainedLimit)
+		return;
+
+	std::sort(unused.begin(), unused.end());
+	for (size_t i = 0; i < unused.size() - retainedLimit; ++i)
+	{
+		auto keyFound = pipelineKeys.find(unused[i].second);
+		deviceRef.destroyPipeline(unused[i].second);
+		cachedPipelines.erase(keyFound->second);
+		pipelineKeys.erase(keyFound);
+	}
+}
+
+size_t vw::PipelineCache::getPipelineCount()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return cachedPipelines.size();
+}
+
+void vw::PipelineCache::clear()
+{
+	//Creating threads lock the cache before completing, so pipelines in creation are waited for without the lock
+	std::map<std::vector<uint8_t>, CacheEntry> clearedPipelines;
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		clearedPipelines.swap(cachedPipelines);
+		pipelineKeys.clear();
+	}
+	for (auto& cachedPipeline : clearedPipelines)
+	{
+		try
+		{
+			deviceRef.destroyPipeline(cachedPipeline.second.pipeline.get().pipeline);
+		}
+		catch (const std::exception&)
+		{
+		}
+	}
+}
+
+vw::PipelineCache::CachedPipeline vw::PipelineCache::createPipeline(vw::GraphicsPipelineSettings& settings, vk::RenderPass renderPass, uint32_t subpassIndex, vk::Pipeline basePipeline)
+{
+	vk::GraphicsPipelineCreateInfo pipelineCreateInfo = settings;
+
+	std::vector<vk::PipelineShaderStageCreateInfo> shaderStageInfos;
+	std::vector<vw::ShaderReflection> reflections;
+	std::vector<vk::SpecializationInfo> specializationInfos;
+	specializationInfos.reserve(settings.shaderStages.size());
+	for (auto& shader : settings.shaderStages)
+	{
+		shaderStageInfos.push_back(shader.get().getShaderStageInfo());
+		reflections.push_back(shader.get().getReflection());
+
+		auto specialization = settings.specializations.find(shaderStageInfos.back().stage);
+		if (specialization != settings.specializations.end())
+		{
+			vw::SpecializationData& data = specialization->second;
+			specializationInfos.push_back(vk::SpecializationInfo((uint32_t)data.entries.size(), data.entries.data(), data.data.size(), data.data.data()));
+			shaderStageInfos.back().pSpecializationInfo = &specializationInfos.back();
+		}
+	}
+	pipelineCreateInfo.stageCount = shaderStageInfos.size();
+	pipelineCreateInfo.pStages = shaderStageInfos.data();
+	vw::ShaderReflection reflection = vw::mergeReflections(reflections);
+
+	//Vertex inputs not described by the settings are read from one tightly packed binding in location order
+	vk::PipelineVertexInputStateCreateInfo reflectedInputInfo;
+	vk::VertexInputBindingDescription reflectedBinding(0, 0, vk::VertexInputRate::eVertex);
+	std::vector<vk::VertexInputAttributeDescription> reflectedAttributes;
+	if (!settings.vertexInputInfo.vertexBindingDescriptionCount && !settings.vertexInputInfo.vertexAttributeDescriptionCount && !reflection.vertexInputs.empty())
+	{
+		for (auto& vertexInput : reflection.vertexInputs)
+		{
+			if (vertexInput.format == vk::Format::eUndefined)
+				throw std::runtime_error("VwPipelineCache: vertex input format could not be reflected, the vertex input state has to be set!");
+			reflectedAttributes.push_back(vk::VertexInputAttributeDescription(vertexInput.location, 0, vertexInput.format, reflectedBinding.stride));
+			reflectedBinding.stride += vertexInput.size;
+		}
+		reflectedInputInfo.vertexBindingDescriptionCount = 1;
+		reflectedInputInfo.pVertexBindingDescriptions = &reflectedBinding;
+		reflectedInputInfo.vertexAttributeDescriptionCount = (uint32_t)reflectedAttributes.size();
+		reflectedInputInfo.pVertexAttributeDescriptions = reflectedAttributes.data();
+		pipelineCreateInfo.pVertexInputState = &reflectedInputInfo;
+	}
+
+	if (!pipelineCreateInfo.layout)
+		pipelineCreateInfo.layout = deviceRef.getLayoutCache().getPipelineLayout(reflection, settings.descriptorSetLayouts);
+	pipelineCreateInfo.renderPass = renderPass;
+	pipelineCreateInfo.subpass = subpassIndex;
+
+	if (basePipeline)
+	{
+		pipelineCreateInfo.flags |= vk::PipelineCreateFlagBits::eDerivative;
+		pipelineCreateInfo.basePipelineHandle = basePipeline;
+		pipelineCreateInfo.basePipelineIndex = -1;
+	}
+
+	//The driver pipeline cache is internally synchronized, so all threads share it
+	CachedPipeline cachedPipeline;
+	cachedPipeline.pipeline = deviceRef.createGraphicsPipelines(deviceRef.getPipelineCache(), { pipelineCreateInfo })[0];
+	cachedPipeline.layout = pipelineCreateInfo.layout;
+	return cachedPipeline;
+}
+
+
 vw::Framebuffer::Framebuffer(vk::Device device, vk::RenderPass renderPass, vk::Extent2D dimensions, std::vector<vk::ImageView> attachments) : deviceHandle(device), renderPassHandle(renderPass), frameExtent(dimensions)
 {
 	vk::FramebufferCreateInfo framebufferCreateInfo;
@@ -230,7 +564,7 @@ vw::Framebuffer::~Framebuffer()
 		deviceHandle.destroyFramebuffer(framebuffer);
 }
 
-void vw::Framebuffer::beginRenderPass(vk::CommandBuffer commandBuffer, std::vector<vk::ClearValue> clearValues, bool firstSubpassInline)
+void vw::Framebuffer::beginRenderPass(vk::CommandBuffer commandBuffer, vk::ArrayProxy<const vk::ClearValue> clearValues, bool firstSubpassInline)
 {
 	vk::RenderPassBeginInfo renderPassBeginInfo;
 	renderPassBeginInfo.framebuffer = framebuffer;
@@ -308,11 +642,22 @@ vw::GraphicsPipelineSettings::GraphicsPipelineSettings()
 	pipelineCreateInfo.pDynamicState = &dynamicStateInfo;
 }
 
+//State pointers are set again so copies of the settings refer to their own state
 vw::GraphicsPipelineSettings::operator vk::GraphicsPipelineCreateInfo()
 {
 	colorBlendInfo.attachmentCount = colorBlendAttachmentStates.size();
 	colorBlendInfo.pAttachments = colorBlendAttachmentStates.data();
+	dynamicStateInfo.dynamicStateCount = dynamicStates.size();
+	dynamicStateInfo.pDynamicStates = dynamicStates.data();
+
+	pipelineCreateInfo.pVertexInputState = &vertexInputInfo;
+	pipelineCreateInfo.pInputAssemblyState = &inputAssemblyInfo;
+	pipelineCreateInfo.pViewportState = &viewportInfo;
+	pipelineCreateInfo.pRasterizationState = &rasterizerInfo;
+	pipelineCreateInfo.pMultisampleState = &multisamplingInfo;
+	pipelineCreateInfo.pDepthStencilState = &depthStencilInfo;
 	pipelineCreateInfo.pColorBlendState = &colorBlendInfo;
+	pipelineCreateInfo.pDynamicState = &dynamicStateInfo;
 
 	return pipelineCreateInfo;
 }
@@ -335,7 +680,134 @@ void vw::GraphicsPipelineSettings::setLayout(vk::PipelineLayout pipelineLayout)
 	pipelineCreateInfo.layout = pipelineLayout;
 }
 
-vw::PipelineLayout::PipelineLayout(vk::Device device, std::vector<vk::DescriptorSetLayout> setLayouts, std::vector<vk::PushConstantRange> pushConstants) : deviceHandle(device)
+void vw::GraphicsPipelineSettings::setDescriptorSetLayout(uint32_t setIndex, vk::DescriptorSetLayout setLayout)
+{
+	descriptorSetLayouts[setIndex] = setLayout;
+}
+
+void vw::GraphicsPipelineSettings::setSpecializationConstant(vk::ShaderStageFlagBits stage, uint32_t constantId, const void* value, size_t size)
+{
+	vw::SpecializationData& specialization = specializations[stage];
+	for (auto& entry : specialization.entries)
+		if (entry.constantID == constantId)
+		{
+			if (entry.size != size)
+				throw std::runtime_error("VwGraphicsPipelineSettings: specialization constant size changed!");
+			memcpy(specialization.data.data() + entry.offset, value, size);
+			return;
+		}
+
+	specialization.entries.push_back(vk::SpecializationMapEntry(constantId, (uint32_t)specialization.data.size(), size));
+	const uint8_t* bytes = static_cast<const uint8_t*>(value);
+	specialization.data.insert(specialization.data.end(), bytes, bytes + size);
+}
+
+void vw::GraphicsPipelineSettings::setSpecializationConstant(vk::ShaderStageFlagBits stage, uint32_t constantId, bool value)
+{
+	VkBool32 specializationValue = value ? VK_TRUE : VK_FALSE;
+	setSpecializationConstant(stage, constantId, &specializationValue, sizeof(specializationValue));
+}
+
+//Written field by field, the create info structures contain pointers and padding
+std::vector<uint8_t> vw::GraphicsPipelineSettings::getKey()
+{
+	std::vector<uint8_t> key;
+	vw::appendKey(key, (VkPipelineCreateFlags)pipelineCreateInfo.flags);
+	vw::appendKey(key, (VkPipelineLayout)pipelineCreateInfo.layout);
+	vw::appendKey(key, (uint64_t)shaderStages.size());
+	for (auto& shader : shaderStages)
+	{
+		vk::PipelineShaderStageCreateInfo stageInfo = shader.get().getShaderStageInfo();
+		vw::appendKey(key, (VkShaderStageFlagBits)stageInfo.stage);
+		//Module handles can be reused after the module is destroyed, the code identifies it
+		vw::appendKey(key, shader.get().getCodeHash());
+	}
+	vw::appendKey(key, (uint64_t)specializations.size());
+	for (auto& specialization : specializations)
+	{
+		vw::appendKey(key, (VkShaderStageFlagBits)specialization.first);
+		vw::appendKeyBytes(key, specialization.second.entries.data(), specialization.second.entries.size() * sizeof(vk::SpecializationMapEntry));
+		vw::appendKeyBytes(key, specialization.second.data.data(), specialization.second.data.size());
+	}
+	vw::appendKey(key, (uint64_t)descriptorSetLayouts.size());
+	for (auto& setLayout : descriptorSetLayouts)
+	{
+		vw::appendKey(key, setLayout.first);
+		vw::appendKey(key, (VkDescriptorSetLayout)setLayout.second);
+	}
+
+	vw::appendKey(key, (uint64_t)vertexInputInfo.vertexBindingDescriptionCount);
+	vw::appendKeyBytes(key, vertexInputInfo.pVertexBindingDescriptions, vertexInputInfo.vertexBindingDescriptionCount * sizeof(vk::VertexInputBindingDescription));
+	vw::appendKey(key, (uint64_t)vertexInputInfo.vertexAttributeDescriptionCount);
+	vw::appendKeyBytes(key, vertexInputInfo.pVertexAttributeDescriptions, vertexInputInfo.vertexAttributeDescriptionCount * sizeof(vk::VertexInputAttributeDescription));
+	vw::appendKey(key, (VkPrimitiveTopology)inputAssemblyInfo.topology);
+	vw::appendKey(key, inputAssemblyInfo.primitiveRestartEnable);
+
+	vw::appendKey(key, viewportInfo.viewportCount);
+	vw::appendKey(key, viewportInfo.scissorCount);
+	vw::appendKey(key, viewport);
+	vw::appendKey(key, scissor);
+
+	vw::appendKey(key, rasterizerInfo.depthClampEnable);
+	vw::appendKey(key, rasterizerInfo.rasterizerDiscardEnable);
+	vw::appendKey(key, (VkPolygonMode)rasterizerInfo.polygonMode);
+	vw::appendKey(key, (VkCullModeFlags)rasterizerInfo.cullMode);
+	vw::appendKey(key, (VkFrontFace)rasterizerInfo.frontFace);
+	vw::appendKey(key, rasterizerInfo.depthBiasEnable);
+	vw::appendKey(key, rasterizerInfo.depthBiasConstantFactor);
+	vw::appendKey(key, rasterizerInfo.depthBiasClamp);
+	vw::appendKey(key, rasterizerInfo.depthBiasSlopeFactor);
+	vw::appendKey(key, rasterizerInfo.lineWidth);
+
+	vw::appendKey(key, (VkSampleCountFlagBits)multisamplingInfo.rasterizationSamples);
+	vw::appendKey(key, multisamplingInfo.sampleShadingEnable);
+	vw::appendKey(key, multisamplingInfo.minSampleShading);
+	vw::appendKey(key, multisamplingInfo.alphaToCoverageEnable);
+	vw::appendKey(key, multisamplingInfo.alphaToOneEnable);
+
+	vw::appendKey(key, depthStencilInfo.depthTestEnable);
+	vw::appendKey(key, depthStencilInfo.depthWriteEnable);
+	vw::appendKey(key, (VkCompareOp)depthStencilInfo.depthCompareOp);
+	vw::appendKey(key, depthStencilInfo.depthBoundsTestEnable);
+	vw::appendKey(key, depthStencilInfo.stencilTestEnable);
+	vw::appendKey(key, depthStencilInfo.front);
+	vw::appendKey(key, depthStencilInfo.back);
+	vw::appendKey(key, depthStencilInfo.minDepthBounds);
+	vw::appendKey(key, depthStencilInfo.maxDepthBounds);
+
+	vw::appendKey(key, colorBlendInfo.logicOpEnable);
+	vw::appendKey(key, (VkLogicOp)colorBlendInfo.logicOp);
+	vw::appendKey(key, (uint64_t)colorBlendAttachmentStates.size());
+	vw::appendKeyBytes(key, colorBlendAttachmentStates.data(), colorBlendAttachmentStates.size() * sizeof(vk::PipelineColorBlendAttachmentState));
+	vw::appendKeyBytes(key, &colorBlendInfo.blendConstants[0], sizeof(float) * 4);
+
+	vw::appendKey(key, (uint64_t)dynamicStates.size());
+	vw::appendKeyBytes(key, dynamicStates.data(), dynamicStates.size() * sizeof(vk::DynamicState));
+	return key;
+}
+
+void vw::validatePushConstants(const std::vector<vk::PushConstantRange>& ranges, vk::ShaderStageFlags stages, uint32_t offset, uint32_t size)
+{
+	if (offset % 4 || size % 4 || size == 0)
+		throw std::runtime_error("VwPushConstants: Offset and size have to be non zero multiples of 4!");
+	//Ranges overlapping the update must not use stages outside of it, and every byte has to be visible to all of its stages
+	for (uint32_t byte = offset; byte < offset + size; byte += 4)
+	{
+		vk::ShaderStageFlags coveredStages;
+		for (auto& range : ranges)
+		{
+			if (byte < range.offset || byte >= range.offset + range.size)
+				continue;
+			if ((range.stageFlags & stages) != range.stageFlags)
+				throw std::runtime_error("VwPushConstants: Update overlaps a range of other stages!");
+			coveredStages |= range.stageFlags;
+		}
+		if ((coveredStages & stages) != stages)
+			throw std::runtime_error("VwPushConstants: Update is not covered by the layout ranges!");
+	}
+}
+
+vw::PipelineLayout::PipelineLayout(vk::Device device, std::vector<vk::DescriptorSetLayout> setLayouts, std::vector<vk::PushConstantRange> pushConstants) : deviceHandle(device), descriptorSetLayouts(setLayouts), pushConstantRanges(pushConstants)
 {
 	vk::PipelineLayoutCreateInfo layoutCreateInfo;
 	layoutCreateInfo.setLayoutCount = setLayouts.size();
@@ -354,3 +826,9 @@ vw::PipelineLayout::operator vk::PipelineLayout()
 {
 	return layout;
 }
+
+void vw::PipelineLayout::pushConstants(vk::CommandBuffer cmdBuffer, vk::ShaderStageFlags stages, uint32_t offset, uint32_t size, const void* data)
+{
+	vw::validatePushConstants(pushConstantRanges, stages, offset, size);
+	cmdBuffer.pushConstants(layout, stages, offset, size, data);
+}
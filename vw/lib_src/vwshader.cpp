@@ -1,19 +1,61 @@
 #include "vwshader.h"
+#include "vwutils.h"
+#include "vkcore.h"
+#include <chrono>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
 
-vw::ShaderCompiler::ShaderCompiler(vk::Device device, std::string sourcePath, shaderc_shader_kind shaderKind) : deviceHandle(device)
+vw::ShaderCompiler::ShaderCompiler(vw::Device& device, std::string sourcePath, vk::ShaderStageFlagBits shaderStage) : registryRef(device.getShaderModuleRegistry()), path(sourcePath), stage(shaderStage)
 {
-	compileThread = std::thread(&ShaderCompiler::compile, this, sourcePath, shaderKind);
+	completed = completion.get_future().share();
 }
 
 vw::ShaderCompiler::~ShaderCompiler()
 {
-	if (compileThread.joinable())
-		compileThread.join();
-	deviceHandle.destroyShaderModule(module);
+	if (module)
+		registryRef.release(module);
 }
 
-void vw::ShaderCompiler::compile(std::string sourcePath, shaderc_shader_kind shaderKind)
+void vw::ShaderCompiler::run()
 {
+	if (started.exchange(true))
+		return;
+	try
+	{
+		compile();
+		completion.set_value();
+	}
+	catch (...)
+	{
+		completion.set_exception(std::current_exception());
+	}
+}
+
+void vw::ShaderCompiler::cancel()
+{
+	if (!started.exchange(true))
+		completion.set_exception(std::make_exception_ptr(std::runtime_error("VwShader: Compilation was cancelled!")));
+}
+
+void vw::ShaderCompiler::waitUntilReady()
+{
+	//A job still queued behind other work is compiled on the waiting thread instead
+	run();
+	completed.get();
+}
+
+bool vw::ShaderCompiler::isReady()
+{
+	return completed.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void vw::ShaderCompiler::compile()
+{
+	const std::string& sourcePath = path;
 	bool precompiled = sourcePath.substr(sourcePath.length() - 4, 4) == ".spv";
 
 	std::ifstream shaderFile(sourcePath, std::ios::ate | (precompiled ? std::ios::binary : 0));
@@ -25,9 +67,12 @@ void vw::ShaderCompiler::compile(std::string sourcePath, shaderc_shader_kind sha
 
 	shaderFile.seekg(0);
 	shaderFile.read(shaderCode.data(), fileSize);
+	//Text mode may read fewer characters than the file size
+	shaderCode.resize((size_t)shaderFile.gcount());
 	shaderFile.close();
 
 	vk::ShaderModuleCreateInfo moduleCreateInfo;
+	std::vector<uint32_t> shaderBinary;
 	if (precompiled)
 	{
 		moduleCreateInfo.codeSize = shaderCode.size();
@@ -35,37 +80,479 @@ void vw::ShaderCompiler::compile(std::string sourcePath, shaderc_shader_kind sha
 	}
 	else
 	{
-		shaderc::Compiler compiler;
-		shaderc::CompileOptions options;
-		options.SetOptimizationLevel(shaderc_optimization_level::shaderc_optimization_level_size);
-
-		auto result = compiler.CompileGlslToSpv(shaderCode.data(), shaderKind, "shader", options);
-		if (result.GetCompilationStatus() != shaderc_compilation_status::shaderc_compilation_status_success)
-			std::cerr << result.GetErrorMessage();
-
-		std::vector<uint32_t> shaderBinary(result.begin(), result.end());
+		//Reused by every compilation on this thread, shaderc compilers are not thread safe
+		static thread_local shaderc::Compiler compiler;
+		shaderBinary = vw::SpirvCache::getDefault().compileGlsl(compiler, shaderCode, mapShaderStage.at(stage), sourcePath, vw::GlslOptions(), &includedFiles);
 		moduleCreateInfo.codeSize = shaderBinary.size() * 4;
 		moduleCreateInfo.pCode = shaderBinary.data();
 	}
-	module = deviceHandle.createShaderModule(moduleCreateInfo);
+	reflection = vw::reflectSpirv(moduleCreateInfo.pCode, moduleCreateInfo.codeSize / 4, stage);
+	codeHash = vw::hashValue(moduleCreateInfo.codeSize, vw::hashBytes(moduleCreateInfo.pCode, moduleCreateInfo.codeSize));
+	module = registryRef.acquire(moduleCreateInfo.pCode, moduleCreateInfo.codeSize);
+}
+
+vw::ShaderModuleRegistry::ShaderModuleRegistry(vk::Device device) : deviceHandle(device)
+{
+}
+
+vw::ShaderModuleRegistry::~ShaderModuleRegistry()
+{
+	for (auto& entry : modules)
+		deviceHandle.destroyShaderModule(entry.second.module.get());
+}
+
+vk::ShaderModule vw::ShaderModuleRegistry::acquire(const uint32_t* code, size_t codeSize)
+{
+	ModuleKey key(vw::hashBytes(code, codeSize), codeSize);
+	std::promise<vk::ShaderModule> creation;
+	std::shared_future<vk::ShaderModule> module;
+	ModuleMap::iterator created;
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		auto range = modules.equal_range(key);
+		auto found = std::find_if(range.first, range.second, [code, codeSize](const ModuleMap::value_type& entry) { return memcmp(entry.second.code.data(), code, codeSize) == 0; });
+		if (found != range.second)
+		{
+			if (found->second.references++ == 0)
+				retainedCount--;
+			module = found->second.module;
+		}
+		else
+		{
+			ModuleEntry entry;
+			entry.module = creation.get_future().share();
+			entry.code.assign(code, code + codeSize / sizeof(uint32_t));
+			entry.references = 1;
+			entry.releaseSerial = 0;
+			created = modules.emplace(key, std::move(entry));
+		}
+	}
+	if (module.valid())
+		return module.get();
+
+	//Created without the lock, other modules are acquired meanwhile
+	vk::ShaderModuleCreateInfo moduleCreateInfo;
+	moduleCreateInfo.codeSize = codeSize;
+	moduleCreateInfo.pCode = code;
+	vk::ShaderModule shaderModule;
+	try
+	{
+		shaderModule = deviceHandle.createShaderModule(moduleCreateInfo);
+	}
+	catch (...)
+	{
+		//Waiting threads get the error, their references go away with the entry
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			modules.erase(created);
+		}
+		creation.set_exception(std::current_exception());
+		throw;
+	}
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		moduleKeys.emplace(shaderModule, created);
+	}
+	creation.set_value(shaderModule);
+	return shaderModule;
+}
+
+void vw::ShaderModuleRegistry::release(vk::ShaderModule module)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	auto keyFound = moduleKeys.find(module);
+	if (keyFound == moduleKeys.end())
+		throw std::runtime_error("VwShaderModuleRegistry: module was not acquired from the registry!");
+
+	ModuleEntry& entry = keyFound->second->second;
+	if (--entry.references == 0)
+	{
+		entry.releaseSerial = nextReleaseSerial++;
+		retainedCount++;
+		evictOverLimit();
+	}
+}
+
+void vw::ShaderModuleRegistry::setRetainedLimit(size_t moduleCount)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	retainedLimit = moduleCount;
+	evictOverLimit();
+}
+
+size_t vw::ShaderModuleRegistry::getModuleCount()
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	return modules.size();
+}
+
+void vw::ShaderModuleRegistry::evictOverLimit()
+{
+	while (retainedCount > retainedLimit)
+	{
+		auto oldest = modules.end();
+		for (auto entry = modules.begin(); entry != modules.end(); ++entry)
+			if (entry->second.references == 0 && (oldest == modules.end() || entry->second.releaseSerial < oldest->second.releaseSerial))
+				oldest = entry;
+
+		vk::ShaderModule module = oldest->second.module.get();
+		deviceHandle.destroyShaderModule(module);
+		moduleKeys.erase(module);
+		modules.erase(oldest);
+		retainedCount--;
+	}
+}
+
+//Entry layout: magic, recorded compile time in microseconds, SPIR-V words
+static const uint32_t SpirvCacheMagic = 0x43565053;
+//Bumped whenever the key or the entry layout changes
+static const uint32_t SpirvCacheFormat = 2;
+
+//Resolves #include directives and records every included file so its contents become part of the cache key
+class GlslIncluder : public shaderc::CompileOptions::IncluderInterface
+{
+public:
+	GlslIncluder(const std::vector<std::string>& directories) : includeDirectories(directories) {}
+
+	shaderc_include_result* GetInclude(const char* requestedSource, shaderc_include_type type, const char* requestingSource, size_t includeDepth) override
+	{
+		std::vector<std::filesystem::path> candidates;
+		if (type == shaderc_include_type::shaderc_include_type_relative)
+			candidates.push_back(std::filesystem::path(requestingSource).parent_path() / requestedSource);
+		for (auto& directory : includeDirectories)
+			candidates.push_back(std::filesystem::path(directory) / requestedSource);
+
+		Include* include = new Include;
+		for (auto& candidate : candidates)
+		{
+			std::ifstream includeFile(candidate, std::ios::binary);
+			if (!includeFile.is_open())
+				continue;
+			include->name = candidate.generic_string();
+			include->content.assign(std::istreambuf_iterator<char>(includeFile), std::istreambuf_iterator<char>());
+			includes.push_back({ include->name, include->content });
+			break;
+		}
+		//An empty name reports the content as the error message
+		if (include->name.empty())
+			include->content = std::string("Include file ") + requestedSource + " not found";
+
+		include->result.source_name = include->name.c_str();
+		include->result.source_name_length = include->name.size();
+		include->result.content = include->content.c_str();
+		include->result.content_length = include->content.size();
+		include->result.user_data = include;
+		return &include->result;
+	}
+
+	void ReleaseInclude(shaderc_include_result* data) override
+	{
+		delete static_cast<Include*>(data->user_data);
+	}
+
+	//Resolved path and contents of each include, in the order they were read
+	std::vector<std::pair<std::string, std::string>> includes;
+private:
+	struct Include
+	{
+		shaderc_include_result result;
+		std::string name;
+		std::string content;
+	};
+
+	std::vector<std::string> includeDirectories;
+};
+
+vw::SpirvCache& vw::SpirvCache::getDefault()
+{
+	static vw::SpirvCache defaultCache;
+	return defaultCache;
+}
+
+void vw::SpirvCache::setDirectory(std::string directory)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	cacheDirectory = directory;
+}
+
+void vw::SpirvCache::setInstrumentationHook(std::function<void(const vw::SpirvCacheEvent&)> hook)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	instrumentationHook = hook;
+}
+
+vw::SpirvCacheStatistics vw::SpirvCache::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return statistics;
+}
+
+//Compiles a fixed shader once, its SPIR-V carries the generator version and changes with the code generation of the compiler
+uint64_t vw::SpirvCache::getCompilerKey(shaderc::Compiler& compiler)
+{
+	std::call_once(compilerKeyComputed, [this, &compiler]()
+	{
+		const char probeSource[] = "#version 450\nlayout(location = 0) out vec4 color;\nvoid main() { color = vec4(gl_FragCoord.xy, 0.0, 1.0); }\n";
+		auto probe = compiler.CompileGlslToSpv(probeSource, sizeof(probeSource) - 1, shaderc_shader_kind::shaderc_glsl_fragment_shader, "vw_compiler_probe");
+		if (probe.GetCompilationStatus() != shaderc_compilation_status::shaderc_compilation_status_success)
+			throw std::runtime_error("VwShader: " + probe.GetErrorMessage());
+		std::vector<uint32_t> probeSpirv(probe.begin(), probe.end());
+		compilerKey = vw::hashBytes(probeSpirv.data(), probeSpirv.size() * sizeof(uint32_t));
+	});
+	return compilerKey;
+}
+
+std::vector<uint32_t> vw::SpirvCache::compileGlsl(shaderc::Compiler& compiler, const std::vector<char>& source, shaderc_shader_kind shaderKind, const std::string& sourcePath, const vw::GlslOptions& glslOptions, std::vector<std::string>* includedFiles)
+{
+	shaderc::CompileOptions options;
+	options.SetOptimizationLevel(glslOptions.optimization);
+	if (glslOptions.debugInfo)
+		options.SetGenerateDebugInfo();
+	for (auto& macro : glslOptions.macros)
+		options.AddMacroDefinition(macro.first, macro.second);
+	GlslIncluder* includer = new GlslIncluder(glslOptions.includeDirectories);
+	options.SetIncluder(std::unique_ptr<shaderc::CompileOptions::IncluderInterface>(includer));
+
+	//Preprocessing resolves includes and macros, so the key covers everything that reaches the compiler
+	auto preprocessed = compiler.PreprocessGlsl(source.data(), source.size(), shaderKind, sourcePath.c_str(), options);
+	if (preprocessed.GetCompilationStatus() != shaderc_compilation_status::shaderc_compilation_status_success)
+		throw std::runtime_error("VwShader: " + preprocessed.GetErrorMessage());
+	std::string preprocessedSource(preprocessed.begin(), preprocessed.end());
+	if (includedFiles)
+		for (auto& include : includer->includes)
+			if (std::find(includedFiles->begin(), includedFiles->end(), include.first) == includedFiles->end())
+				includedFiles->push_back(include.first);
+
+	uint64_t key = vw::hashBytes(preprocessedSource.data(), preprocessedSource.size());
+	for (auto& include : includer->includes)
+	{
+		key = vw::hashBytes(include.first.data(), include.first.size(), key);
+		key = vw::hashBytes(include.second.data(), include.second.size(), key);
+	}
+	key = vw::hashBytes(&shaderKind, sizeof(shaderKind), key);
+	key = vw::hashValue(glslOptions.optimization, key);
+	key = vw::hashValue(glslOptions.debugInfo, key);
+	for (auto& macro : glslOptions.macros)
+	{
+		//Sizes separate names from values
+		key = vw::hashValue(macro.first.size(), vw::hashBytes(macro.first.data(), macro.first.size(), key));
+		key = vw::hashValue(macro.second.size(), vw::hashBytes(macro.second.data(), macro.second.size(), key));
+	}
+	key = vw::hashValue(getCompilerKey(compiler), key);
+	key = vw::hashBytes(&SpirvCacheFormat, sizeof(SpirvCacheFormat), key);
+
+	std::string directory;
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		directory = cacheDirectory;
+	}
+	char keyName[17];
+	snprintf(keyName, sizeof(keyName), "%016llx", (unsigned long long)key);
+	std::string entryPath = directory.empty() ? "" : directory + "/" + keyName + ".spvc";
+
+	std::promise<std::vector<uint32_t>> compilation;
+	std::shared_future<std::vector<uint32_t>> pendingCompilation;
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto found = compilations.find(key);
+		if (found != compilations.end())
+			pendingCompilation = found->second;
+		else
+			compilations.emplace(key, compilation.get_future().share());
+	}
+	if (pendingCompilation.valid())
+		return pendingCompilation.get();
+
+	std::vector<uint32_t> spirv;
+	try
+	{
+		spirv = loadOrCompile(compiler, preprocessedSource, shaderKind, sourcePath, options, entryPath);
+	}
+	catch (...)
+	{
+		{
+			std::lock_guard<std::mutex> lock(cacheMutex);
+			compilations.erase(key);
+		}
+		compilation.set_exception(std::current_exception());
+		throw;
+	}
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		compilations.erase(key);
+	}
+	compilation.set_value(spirv);
+	return spirv;
+}
+
+std::vector<uint32_t> vw::SpirvCache::loadOrCompile(shaderc::Compiler& compiler, const std::string& preprocessedSource, shaderc_shader_kind shaderKind, const std::string& sourcePath, const shaderc::CompileOptions& options, const std::string& entryPath)
+{
+	vw::SpirvCacheEvent cacheEvent;
+	cacheEvent.sourcePath = sourcePath;
+
+	std::vector<uint32_t> spirv;
+	uint32_t compileMicroseconds = 0;
+	auto start = std::chrono::steady_clock::now();
+	if (!entryPath.empty() && load(entryPath, spirv, compileMicroseconds))
+	{
+		cacheEvent.hit = true;
+		cacheEvent.compileTime = compileMicroseconds / 1000.0;
+		cacheEvent.loadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		report(cacheEvent);
+		return spirv;
+	}
+
+	auto result = compiler.CompileGlslToSpv(preprocessedSource.data(), preprocessedSource.size(), shaderKind, sourcePath.c_str(), options);
+	double compileTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	//Failed compilations are not cached so fixing the source is picked up
+	if (result.GetCompilationStatus() != shaderc_compilation_status::shaderc_compilation_status_success)
+		throw std::runtime_error("VwShader: " + result.GetErrorMessage());
+	spirv.assign(result.begin(), result.end());
+
+	if (!entryPath.empty())
+		store(entryPath, spirv, (uint32_t)(compileTime * 1000.0));
+
+	cacheEvent.hit = false;
+	cacheEvent.compileTime = compileTime;
+	cacheEvent.loadTime = 0.0;
+	report(cacheEvent);
+	return spirv;
 }
 
-vw::Shader::Shader(vk::Device device, vk::ShaderStageFlagBits shaderStage, std::string sourcePath)
+bool vw::SpirvCache::load(const std::string& entryPath, std::vector<uint32_t>& spirv, uint32_t& compileMicroseconds)
+{
+	std::ifstream entryFile(entryPath, std::ios::binary | std::ios::ate);
+	if (!entryFile.is_open())
+		return false;
+
+	size_t fileSize = (size_t)entryFile.tellg();
+	uint32_t magic;
+	if (fileSize <= 2 * sizeof(uint32_t) || fileSize % sizeof(uint32_t) != 0)
+		return false;
+	entryFile.seekg(0);
+	entryFile.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	entryFile.read(reinterpret_cast<char*>(&compileMicroseconds), sizeof(compileMicroseconds));
+	if (magic != SpirvCacheMagic)
+		return false;
+
+	spirv.resize(fileSize / sizeof(uint32_t) - 2);
+	return (bool)entryFile.read(reinterpret_cast<char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+}
+
+//Entries are written to a temporary file and renamed, concurrent readers never see partial entries
+void vw::SpirvCache::store(const std::string& entryPath, const std::vector<uint32_t>& spirv, uint32_t compileMicroseconds)
+{
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(entryPath).parent_path(), error);
+
+	std::ostringstream tempName;
+	tempName << entryPath << "." << std::this_thread::get_id() << ".tmp";
+	std::string tempPath = tempName.str();
+	{
+		std::ofstream entryFile(tempPath, std::ios::binary | std::ios::trunc);
+		entryFile.write(reinterpret_cast<const char*>(&SpirvCacheMagic), sizeof(SpirvCacheMagic));
+		entryFile.write(reinterpret_cast<const char*>(&compileMicroseconds), sizeof(compileMicroseconds));
+		entryFile.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+		if (!entryFile.good())
+			return;
+	}
+	std::filesystem::rename(tempPath, entryPath, error);
+	if (error)
+		std::filesystem::remove(tempPath, error);
+}
+
+void vw::SpirvCache::report(const vw::SpirvCacheEvent& cacheEvent)
+{
+	std::function<void(const vw::SpirvCacheEvent&)> hook;
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		if (cacheEvent.hit)
+		{
+			statistics.hits++;
+			statistics.savedTime += std::max(0.0, cacheEvent.compileTime - cacheEvent.loadTime);
+		}
+		else
+		{
+			statistics.misses++;
+			statistics.compileTime += cacheEvent.compileTime;
+		}
+		hook = instrumentationHook;
+	}
+	if (hook)
+		hook(cacheEvent);
+}
+
+vw::Shader::Shader(vw::Device& device, vk::ShaderStageFlagBits shaderStage, std::string sourcePath, vw::JobPriority priority) : deviceRef(device), path(sourcePath)
 {
 	stageCreateInfo.stage = shaderStage;
 	stageCreateInfo.pName = "main";
-	compiler = std::shared_ptr<ShaderCompiler>(new ShaderCompiler(device, sourcePath, mapShaderStage[shaderStage]));
+	startCompile(priority, compiler);
+}
+
+vw::Shader::~Shader()
+{
+	std::shared_ptr<ShaderCompiler> current = std::atomic_load(&compiler);
+	if (current)
+		current->cancel();
+	if (reloadCompiler)
+		reloadCompiler->cancel();
 }
 
+void vw::Shader::startCompile(vw::JobPriority priority, std::shared_ptr<ShaderCompiler>& target)
+{
+	target = std::shared_ptr<ShaderCompiler>(new ShaderCompiler(deviceRef, path, stageCreateInfo.stage));
+	std::shared_ptr<ShaderCompiler> job = target;
+	deviceRef.getThreadPool().submit([job]() { job->run(); }, priority);
+}
+
+//The compiler is swapped by applyReload while pipeline tasks read it, so it is always loaded atomically
 void vw::Shader::waitUntilReady()
 {
-	if (compiler->compileThread.joinable())
-		compiler->compileThread.join();
+	std::atomic_load(&compiler)->waitUntilReady();
 }
 
 vk::PipelineShaderStageCreateInfo vw::Shader::getShaderStageInfo()
 {
-	waitUntilReady();
-	stageCreateInfo.module = compiler->module;
-	return stageCreateInfo;
+	std::shared_ptr<ShaderCompiler> current = std::atomic_load(&compiler);
+	current->waitUntilReady();
+	vk::PipelineShaderStageCreateInfo stageInfo = stageCreateInfo;
+	stageInfo.module = current->module;
+	return stageInfo;
+}
+
+vw::ShaderReflection vw::Shader::getReflection()
+{
+	std::shared_ptr<ShaderCompiler> current = std::atomic_load(&compiler);
+	current->waitUntilReady();
+	return current->reflection;
+}
+
+uint64_t vw::Shader::getCodeHash()
+{
+	std::shared_ptr<ShaderCompiler> current = std::atomic_load(&compiler);
+	current->waitUntilReady();
+	return current->codeHash;
+}
+
+std::vector<std::string> vw::Shader::getIncludedFiles()
+{
+	std::shared_ptr<ShaderCompiler> current = std::atomic_load(&compiler);
+	current->waitUntilReady();
+	return current->includedFiles;
+}
+
+void vw::Shader::reload(vw::JobPriority priority)
+{
+	startCompile(priority, reloadCompiler);
+}
+
+bool vw::Shader::applyReload()
+{
+	if (!reloadCompiler || !reloadCompiler->isReady())
+		return false;
+
+	std::shared_ptr<ShaderCompiler> reloaded = std::move(reloadCompiler);
+	reloaded->waitUntilReady();
+	std::atomic_store(&compiler, reloaded);
+	return true;
 }
\ No newline at end of file
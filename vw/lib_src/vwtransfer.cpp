@@ -0,0 +1,272 @@
+#include "vwtransfer.h"
+
+vw::UploadBatch::UploadBatch(vw::Device& device, uint32_t dstQueueFamily) : dstFamily(dstQueueFamily), deviceRef(device)
+{
+}
+
+vw::UploadBatch::~UploadBatch()
+{
+	wait();
+	if (stagingSegment)
+		deviceRef.getStagingRing().releaseSegment(stagingSegment, vw::GpuFuture());
+}
+
+void vw::UploadBatch::copyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::BufferCopy region)
+{
+	if (!commands.empty() && commands.back().type == BufferCopy && commands.back().srcBuffer == srcBuffer && commands.back().dstBuffer == dstBuffer)
+	{
+		//Merge regions that continue the previous one in both buffers
+		vk::BufferCopy& lastRegion = bufferCopies.back();
+		if (lastRegion.srcOffset + lastRegion.size == region.srcOffset && lastRegion.dstOffset + lastRegion.size == region.dstOffset)
+			lastRegion.size += region.size;
+		else
+		{
+			bufferCopies.push_back(region);
+			commands.back().count++;
+		}
+		return;
+	}
+
+	Command command;
+	command.type = BufferCopy;
+	command.srcBuffer = srcBuffer;
+	command.dstBuffer = dstBuffer;
+	command.first = bufferCopies.size();
+	command.count = 1;
+	commands.push_back(command);
+	bufferCopies.push_back(region);
+}
+
+void vw::UploadBatch::copyBufferToImage(vk::Buffer srcBuffer, vk::Image dstImage, vk::BufferImageCopy region)
+{
+	if (!commands.empty() && commands.back().type == ImageCopy && commands.back().srcBuffer == srcBuffer && commands.back().dstImage == dstImage)
+	{
+		imageCopies.push_back(region);
+		commands.back().count++;
+		return;
+	}
+
+	Command command;
+	command.type = ImageCopy;
+	command.srcBuffer = srcBuffer;
+	command.dstImage = dstImage;
+	command.first = imageCopies.size();
+	command.count = 1;
+	commands.push_back(command);
+	imageCopies.push_back(region);
+}
+
+void vw::UploadBatch::transitionLayout(vw::ImageBase& image, vk::ImageLayout newLayout)
+{
+	vk::PipelineStageFlags srcStages, dstStages;
+	vk::ImageMemoryBarrier imageBarrier = image.createLayoutBarrier(newLayout, srcStages, dstStages);
+
+	//Consecutive transitions share one pipeline barrier unless the same image is transitioned twice
+	bool mergeable = !commands.empty() && commands.back().type == LayoutBarrier;
+	if (mergeable)
+		for (size_t i = commands.back().first; i < imageBarriers.size(); ++i)
+			mergeable &= (imageBarriers[i].image != imageBarrier.image);
+
+	if (mergeable)
+	{
+		commands.back().srcStages |= srcStages;
+		commands.back().dstStages |= dstStages;
+		commands.back().count++;
+	}
+	else
+	{
+		Command command;
+		command.type = LayoutBarrier;
+		command.first = imageBarriers.size();
+		command.count = 1;
+		command.srcStages = srcStages;
+		command.dstStages = dstStages;
+		commands.push_back(command);
+	}
+	imageBarriers.push_back(imageBarrier);
+}
+
+void vw::UploadBatch::loadBuffer(vk::Buffer dstBuffer, vk::DeviceSize dstOffset, void* data, vk::DeviceSize size)
+{
+	auto stagingRegion = deviceRef.getStagingRing().allocate(size, 4, stagingSegment);
+	stagingSegment = stagingRegion.segment;
+	memcpy(stagingRegion.data, data, static_cast<size_t>(size));
+	copyBuffer(stagingRegion.buffer, dstBuffer, vk::BufferCopy(stagingRegion.offset, dstOffset, size));
+}
+
+void vw::UploadBatch::loadImage(vw::ImageBase& image, uint32_t width, uint32_t height, void* data, vk::DeviceSize size)
+{
+	auto stagingRegion = deviceRef.getStagingRing().allocate(size, 16, stagingSegment);
+	stagingSegment = stagingRegion.segment;
+	memcpy(stagingRegion.data, data, static_cast<size_t>(size));
+
+	vk::BufferImageCopy copyRegion;
+	copyRegion.bufferOffset = stagingRegion.offset;
+	copyRegion.imageSubresource = vk::ImageSubresourceLayers(image.getAspectFlags(), 0, 0, 1);
+	copyRegion.imageExtent = vk::Extent3D(width, height, 1);
+
+	transitionLayout(image, vk::ImageLayout::eTransferDstOptimal);
+	copyBufferToImage(stagingRegion.buffer, image, copyRegion);
+}
+
+vw::GpuFuture vw::UploadBatch::flush()
+{
+	if (commands.empty())
+		return cmdBuffer ? cmdBuffer->getFuture() : vw::GpuFuture();
+
+	//The previous command buffer can only be freed once it has executed
+	wait();
+
+	uint32_t transferFamily = deviceRef.getTransferQueueFamily();
+	cmdBuffer = std::make_unique<vw::CommandBuffer>(deviceRef.createCommandBuffer(transferFamily, vk::CommandBufferLevel::ePrimary));
+	if (stagingSegment)
+	{
+		deviceRef.getStagingRing().releaseSegment(stagingSegment, *cmdBuffer);
+		stagingSegment = 0;
+	}
+	cmdBuffer->begin(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+	if (!recordHoisted())
+		recordInOrder();
+	releaseOwnership(transferFamily);
+	cmdBuffer->end();
+
+	cmdBuffer->submit();
+
+	commands.clear();
+	bufferCopies.clear();
+	imageCopies.clear();
+	imageBarriers.clear();
+	return cmdBuffer->getFuture();
+}
+
+//Copies of a batch never depend on each other, so every transition can move to the front or the back of the batch
+//Fails without recording for images transitioned twice on one side or copied again after a transition that follows a copy
+bool vw::UploadBatch::recordHoisted()
+{
+	std::vector<vk::Image> copiedImages;
+	std::vector<vk::ImageMemoryBarrier> preBarriers, postBarriers;
+	vk::PipelineStageFlags preSrcStages, preDstStages, postSrcStages, postDstStages;
+	auto contains = [](const std::vector<vk::ImageMemoryBarrier>& barriers, vk::Image image) { return std::any_of(barriers.begin(), barriers.end(), [image](const vk::ImageMemoryBarrier& barrier) { return barrier.image == image; }); };
+	for (auto& command : commands)
+	{
+		if (command.type == ImageCopy)
+		{
+			if (contains(postBarriers, command.dstImage))
+				return false;
+			copiedImages.push_back(command.dstImage);
+		}
+		else if (command.type == LayoutBarrier)
+		{
+			for (size_t i = command.first; i < command.first + command.count; ++i)
+			{
+				bool afterCopy = std::find(copiedImages.begin(), copiedImages.end(), imageBarriers[i].image) != copiedImages.end();
+				auto& barriers = afterCopy ? postBarriers : preBarriers;
+				if (contains(barriers, imageBarriers[i].image))
+					return false;
+				barriers.push_back(imageBarriers[i]);
+				//Stages are tracked per command, a command split across both sides contributes its stages to both
+				(afterCopy ? postSrcStages : preSrcStages) |= command.srcStages;
+				(afterCopy ? postDstStages : preDstStages) |= command.dstStages;
+			}
+		}
+	}
+
+	if (!preBarriers.empty())
+		cmdBuffer->pipelineBarrier(preSrcStages, preDstStages, vk::DependencyFlags(), {}, {}, preBarriers);
+	for (auto& command : commands)
+	{
+		if (command.type == BufferCopy)
+			cmdBuffer->copyBuffer(command.srcBuffer, command.dstBuffer, vk::ArrayProxy<const vk::BufferCopy>(command.count, &bufferCopies[command.first]));
+		else if (command.type == ImageCopy)
+			cmdBuffer->copyBufferToImage(command.srcBuffer, command.dstImage, vk::ImageLayout::eTransferDstOptimal, vk::ArrayProxy<const vk::BufferImageCopy>(command.count, &imageCopies[command.first]));
+	}
+	if (!postBarriers.empty())
+		cmdBuffer->pipelineBarrier(postSrcStages, postDstStages, vk::DependencyFlags(), {}, {}, postBarriers);
+	return true;
+}
+
+void vw::UploadBatch::recordInOrder()
+{
+	for (auto& command : commands)
+	{
+		switch (command.type)
+		{
+		case BufferCopy:
+			cmdBuffer->copyBuffer(command.srcBuffer, command.dstBuffer, vk::ArrayProxy<const vk::BufferCopy>(command.count, &bufferCopies[command.first]));
+			break;
+		case ImageCopy:
+			cmdBuffer->copyBufferToImage(command.srcBuffer, command.dstImage, vk::ImageLayout::eTransferDstOptimal, vk::ArrayProxy<const vk::BufferImageCopy>(command.count, &imageCopies[command.first]));
+			break;
+		case LayoutBarrier:
+			cmdBuffer->pipelineBarrier(command.srcStages, command.dstStages, vk::DependencyFlags(), {}, {}, vk::ArrayProxy<const vk::ImageMemoryBarrier>(command.count, &imageBarriers[command.first]));
+			break;
+		}
+	}
+}
+
+//Hands every written resource over to the destination family, images keep the layout the batch left them in
+//Within one family no ownership changes, but the consumers still wait for the batch
+void vw::UploadBatch::releaseOwnership(uint32_t transferFamily)
+{
+	std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+	std::map<vk::Image, std::pair<vk::ImageLayout, vk::ImageAspectFlags>> imageStates;
+	for (auto& command : commands)
+	{
+		switch (command.type)
+		{
+		case BufferCopy:
+			if (std::find_if(bufferBarriers.begin(), bufferBarriers.end(), [&command](const vk::BufferMemoryBarrier& barrier) { return barrier.buffer == command.dstBuffer; }) == bufferBarriers.end())
+			{
+				vk::BufferMemoryBarrier barrier;
+				barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+				barrier.buffer = command.dstBuffer;
+				barrier.offset = 0;
+				barrier.size = VK_WHOLE_SIZE;
+				bufferBarriers.push_back(barrier);
+			}
+			break;
+		case ImageCopy:
+		{
+			auto& imageState = imageStates.emplace(command.dstImage, std::make_pair(vk::ImageLayout::eTransferDstOptimal, vk::ImageAspectFlags())).first->second;
+			for (size_t i = command.first; i < command.first + command.count; ++i)
+				imageState.second |= imageCopies[i].imageSubresource.aspectMask;
+			break;
+		}
+		case LayoutBarrier:
+			for (size_t i = command.first; i < command.first + command.count; ++i)
+			{
+				auto& imageState = imageStates[imageBarriers[i].image];
+				imageState.first = imageBarriers[i].newLayout;
+				imageState.second |= imageBarriers[i].subresourceRange.aspectMask;
+			}
+			break;
+		}
+	}
+
+	std::vector<vk::ImageMemoryBarrier> releaseBarriers;
+	for (auto& imageState : imageStates)
+	{
+		vk::ImageMemoryBarrier barrier;
+		barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+		barrier.oldLayout = imageState.second.first;
+		barrier.newLayout = imageState.second.first;
+		barrier.image = imageState.first;
+		barrier.subresourceRange = vk::ImageSubresourceRange(imageState.second.second, 0, 1, 0, 1);
+		releaseBarriers.push_back(barrier);
+	}
+	deviceRef.transferOwnership(*cmdBuffer, transferFamily, dstFamily, bufferBarriers, releaseBarriers);
+}
+
+void vw::UploadBatch::wait()
+{
+	if (cmdBuffer)
+	{
+		cmdBuffer->getFuture().wait();
+		cmdBuffer.reset();
+	}
+}
+
+bool vw::UploadBatch::isComplete()
+{
+	return !cmdBuffer || cmdBuffer->getFuture().isReady();
+}